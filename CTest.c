@@ -1,3 +1,6 @@
+#ifdef __linux__
+#define _GNU_SOURCE // memfd_create, file seals, CPU affinity
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -5,8 +8,31 @@
 #include <errno.h>
 #include <assert.h>
 #include <stdint.h>
+#include <limits.h>
 #ifdef WIN32
 #include <windows.h>
+#else
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sched.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <ucontext.h>
+#include <sys/inotify.h>
+#endif
 #endif
 #include <time.h>
 #include <stdio.h>
@@ -36,32 +62,57 @@ int max_int(int count, ...) {
 }
 
 
+// Bump allocator block for registry nodes and names
+typedef struct CTestBlock {
+    struct CTestBlock* next;
+    size_t          used;           // Bytes taken from data
+    size_t          size;           // Capacity of data
+    char            data[];
+} CTestBlock;
+
 typedef struct CTestRegistry {
     unsigned int number_of_suites; // Number of registered suites in the registry
     unsigned int number_of_tests;  // Total number of registered tests in the registry
     CTestSuite*  suite;            // Pointer to the 1st suite in the test registry
+    CTestSuite*  last_suite;       // Pointer to the last suite in the test registry
+
+    // Flat storage: structure of arrays indexed by CTestCase::index / CTestSuite::index.
+    // Filtering and sharding are linear scans over these arrays.
+    unsigned int    tests;          // Number of test handles (table tests count once)
+    unsigned int    tests_capacity;
+    CTestCase**     test_handle;
+    const char**    test_name;      // Names point into the string pool or static storage
+    unsigned int*   test_suite;     // Suite index of each test
+    unsigned char*  test_active;    // Test is selected for the run
+    unsigned int    suites;
+    unsigned int    suites_capacity;
+    CTestSuite**    suite_handle;
+    unsigned int*   suite_active;   // Number of selected tests of each suite
+    unsigned int*   test_failed;    // Failed cases of each test in the last run
+    unsigned char*  suite_failed;   // CTEST_SUITE_FAILED / CTEST_SUITE_SKIPPED in the last run
+
+    // Suite dependencies: (suite, dependency) index pairs and their index by suite,
+    // dependency_list[dependency_start[s] .. dependency_start[s + 1]) are the dependencies of suite s
+    unsigned int*   dependency;
+    unsigned int    dependencies;
+    unsigned int    dependencies_capacity;
+    unsigned int*   dependency_start;
+    unsigned int*   dependency_list;
+
+    // Run plan: test indices in execution order, built when tests are reordered
+    unsigned int*   plan;
+    unsigned int    plan_size;
+
+    // Case insensitive name lookup, open addressing of index + 1 (0 - empty slot)
+    unsigned int*   test_lookup;
+    unsigned int    test_lookup_size;
+    unsigned int*   suite_lookup;
+    unsigned int    suite_lookup_size;
+
+    CTestBlock*     pool;           // String pool
+    CTestBlock*     nodes;          // CTestCase/CTestSuite nodes
 } CTestRegistry;
 
-// Types of failures occurring during test runs
-typedef enum CTest_FailureTypes {
-    CUF_SuiteInactive = 1,    // Inactive suite was run
-    CUF_SuiteInitFailed,      // Suite initialization function failed
-    CUF_SuiteCleanupFailed,   // Suite cleanup function failed
-    CUF_TestInactive,         // Inactive test was run
-    CUF_AssertFailed          // CTest assertion failed during test run
-} CTest_FailureType;          // Failure type
-
-// Data type for holding assertion failure information (linked list)
-typedef struct CTest_FailureRecord {
-    CTest_FailureType  type;        // Failure type
-    unsigned int    line;           // Line number of failure
-    char*           file;           // Name of file where failure occurred
-    char*           message;        // Test condition which failed
-    CTestCase*      test;           // Test containing failure
-    CTestSuite*     suite;          // Suite containing test having failure
-    struct CTest_FailureRecord* prev, *next;
-} CTest_FailureRecord;
-
 // Data type for holding statistics and assertion failures for a test run
 typedef struct CTestRunSummary {
     unsigned int suites_run;        // Number of suites completed during run
@@ -70,35 +121,180 @@ typedef struct CTestRunSummary {
     unsigned int tests_run;         // Number of tests completed during run
     unsigned int tests_failed;      // Number of tests containing failed assertions
     unsigned int tests_inactive;    // Number of tests which were inactive (in active suites)
-    unsigned int asserts;           // Number of assertions tested during run
-    unsigned int asserts_failed;    // Number of failed assertions
+    uint64_t     asserts;           // Number of assertions tested during run
+    uint64_t     asserts_failed;    // Number of failed assertions
     unsigned int failure_records;   // Number of failure records generated
     double       elapsed_time;      // Elapsed time for run in seconds
+    unsigned int tests_quarantined; // Failed tests matched by --quarantine, not counted in tests_failed
+    unsigned int suites_skipped;    // Suites not run because a dependency failed
+    unsigned int tests_skipped;     // Selected tests of the skipped suites
 } CTestRunSummary;
 
 int test_is_running = 0;
 
-CTestSuite* cur_suite = NULL;
-CTestCase* cur_test  = NULL;
+// State of the running test. Thread local: --workers threads collect their own summary and
+// failures and merge them into the main thread's after each test.
+CTEST_THREAD_LOCAL CTestSuite* cur_suite = NULL;
+CTEST_THREAD_LOCAL CTestCase* cur_test  = NULL;
+CTEST_THREAD_LOCAL long cur_row = -1; // Row of the running table case, -1 otherwise
+CTEST_THREAD_LOCAL int pool_thread = 0; // Test runs concurrently with others (pool thread, async task)
 
 // Global test registry
-CTestRegistry registry = {0, 0, NULL};
-
-CTestRunSummary summary = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-
-CTest_FailureRecord* failure_list = NULL;
-CTest_FailureRecord* last_failure = NULL;
+CTestRegistry registry = {0};
+
+CTEST_THREAD_LOCAL CTestRunSummary summary = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+// Failed test of the last run, with the outcomes of --rerun-failures
+typedef struct CTestRerun {
+    unsigned int    test;           // Test index
+    unsigned int    runs;           // Reruns done
+    unsigned int    passed;         // Reruns passed
+    int             quarantined;
+} CTestRerun;
+
+// Resource usage of an isolated test
+typedef struct CTestUsage {
+    unsigned int    test;           // Test index
+    long            max_rss;        // KB
+    uint64_t        user_us, sys_us;
+    long            minor_faults, major_faults;
+    long            voluntary_switches, involuntary_switches;
+} CTestUsage;
+
+CTestUsage* usages = NULL;
+unsigned int usage_count = 0;
+unsigned int usage_capacity = 0;
+unsigned int limit_violations = 0;
+
+CTestRerun* reruns = NULL;
+unsigned int rerun_count = 0;
+
+// Outcome of --bisect-order for one failed test
+typedef enum CTestBisectState {
+    CTB_FailsAlone = 0,             // Not order dependent
+    CTB_Polluter,                   // Fails after the single test polluter
+    CTB_Combination,                // Fails only after count preceding tests together
+    CTB_NotReproduced               // Passes after all the preceding tests in a new process
+} CTestBisectState;
+
+typedef struct CTestBisect {
+    unsigned int    test;
+    CTestBisectState state;
+    unsigned int    polluter;       // First remaining preceding test
+    unsigned int    count;          // Remaining preceding tests
+} CTestBisect;
+
+CTestBisect* bisects = NULL;
+unsigned int bisect_count = 0;
+
+CTEST_THREAD_LOCAL CTest_FailureRecord* failure_list = NULL;
+CTEST_THREAD_LOCAL CTest_FailureRecord* last_failure = NULL;
+CTEST_THREAD_LOCAL CTest_FailureRecord* last_emitted_failure = NULL; // Last failure written to --event-fd
+
+// Console, progress and merged results of worker threads; event stream writes
+#ifndef WIN32
+pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+#define REPORT_LOCK() pthread_mutex_lock(&report_lock)
+#define REPORT_UNLOCK() pthread_mutex_unlock(&report_lock)
+#else
+#define REPORT_LOCK()
+#define REPORT_UNLOCK()
+#endif
 
 // Variable for storage of start time for test run
 clock_t start_time;
 
+// Command line options
+typedef struct CTestOptions {
+    uint64_t        seed;           // Base seed for property tests
+    int             seed_set;       // --seed was given
+    unsigned long   iterations;     // Default number of property iterations
+    unsigned int    threads;        // Worker threads for property iterations
+    uint64_t        replay;         // Case seed to replay
+    int             replay_set;     // --replay was given
+    int             fuzz;           // Fuzz FUZZ targets instead of replaying their corpus
+    unsigned long   fuzz_runs;      // Fuzz iterations per target, 0 - unlimited
+    unsigned long   fuzz_seconds;   // Fuzz time per target
+    size_t          fuzz_max_len;   // Maximal length of a fuzz input
+    const char*     corpus;         // Corpus root directory
+    const char*     filter;         // Glob on "suite/test", NULL - all tests
+    unsigned int    shard_index;    // Run the shard_index-th of shard_count slices
+    unsigned int    shard_count;
+    int             event_fd;       // Binary event stream, -1 - off
+    int             watch;          // Rerun the binary on changes
+    const char*     watch_paths;    // ':' separated files/directories watched besides the binary
+    const char*     run_order;      // Order file written by the --watch supervisor
+    int             argc;           // Command line of the binary, re-executed by --watch
+    char**          argv;
+    unsigned int    rerun;          // Isolated reruns of each failed test
+    unsigned int    jobs;           // Concurrent child processes
+    const char*     quarantine;     // File of "suite/test" globs whose failures do not fail the run
+    long            run_index;      // Run only this test index (rerun child), -1 - off
+    int             shuffle;        // Randomize suite and test order
+    uint64_t        shuffle_seed;
+    int             bisect;         // Find the test polluting an order dependent failure
+    int             progress;       // One throttled status line instead of a line per test
+    const char*     timings;        // Test durations of previous runs, for the progress ETA
+    unsigned int    workers;        // Threads for reentrant tests, 1 - serial
+    const char*     self_benchmark; // Results file of --self-benchmark, NULL - run the tests
+    int             isolate;        // Run every test in a child process
+    CTestLimits     limits;         // Default limits of isolated tests
+    const char*     cache_dir;      // Result cache of deterministic tests, NULL - off
+    int             no_cache;
+    const char*     journal;        // Journal of completed tests, NULL - off
+    int             resume;         // Skip the tests recorded in the journal
+    const char*     coordinator;    // Serve the tests to workers on this address, NULL - off
+    unsigned int    local_workers;  // Workers the coordinator starts itself
+    unsigned int    batch;          // Tests per batch, 0 - shrinking with the queue
+    const char*     worker;         // Run the batches of the coordinator on this address, NULL - off
+    const char*     histograms;     // Percentiles of the exported histograms, NULL - not written
+    unsigned long   stress_ms;      // Time budget of each stress run
+    int             stress_sweep;   // Run stress tests with 1, 2, 4... threads
+} CTestOptions;
+
+// Defaults, the fields not listed are 0/NULL
+CTestOptions options = {
+    .iterations = 100,
+    .threads = 1,
+    .fuzz_seconds = 60,
+    .fuzz_max_len = 4096,
+    .corpus = "corpus",
+    .shard_count = 1,
+    .event_fd = -1,
+    .jobs = 1,
+    .run_index = -1,
+    .timings = "TIMINGS.TXT",
+    .workers = 1,
+    .stress_ms = 200
+};
+
+// Property registered by CTest_add_property()
+typedef struct CTestProperty {
+    const CTestGen* gen;
+    CTestCheckFunc  check;
+    unsigned long   iterations;     // 0 - options.iterations
+    const char*     file;           // Registration place, reported on failure
+    int             line;
+} CTestProperty;
+
 // Allocate memory + sprintf
 // Caller function must call free(str)
 char* CT_avsprintf(const char* format, va_list args) {
-    // Dynamically calculate length of buffer
-    int bytes = vsnprintf(NULL, 0, format, args);
-    char* buf = malloc(bytes + 1);
-    vsprintf(buf, format, args); // Print to buf
+    va_list copy;
+    int bytes;
+    char* buf;
+
+    // The length pass consumes a copy, args is still needed to print
+    va_copy(copy, args);
+    bytes = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    buf = (char*)malloc((size_t)bytes + 1);
+
+    if(NULL != buf) {
+        vsnprintf(buf, (size_t)bytes + 1, format, args);
+    }
+
     return buf;
 }
 
@@ -132,6 +328,14 @@ void xprintf(const char* format, ...) {
     char* buf = CT_avsprintf(format, args);
     va_end(args);
 
+    if(NULL == buf) {
+        if(log) {
+            fclose(log);
+        }
+
+        return;
+    }
+
     if(log) {
         fputs(buf, log);
         fclose(log);
@@ -155,11 +359,11 @@ void xprintf(const char* format, ...) {
                         0, // lpDefaultChar
                         NULL // lpUsedDefaultChar
                        );
-    printf(dos);
+    fputs(dos, stdout); // Formatted text, printf(dos) would read '%' in it as conversions
     free(lpWideCharStr);
     free(dos);
 #else
-    printf(buf);
+    fputs(buf, stdout); // Formatted text, printf(buf) would read '%' in it as conversions
 #endif
 
     free(buf);
@@ -171,556 +375,5522 @@ void error(const char* message) {
     exit(1);
 }
 
-void add_failure(CTest_FailureRecord** ppFailure, CTest_FailureType type, unsigned int line, const char* szCondition, const char* file, CTestSuite* suite, CTestCase* test) {
-    CTest_FailureRecord* fn = NULL;
-    CTest_FailureRecord* temp = NULL;
+// == Flat registry storage ==
 
-    assert(NULL != ppFailure);
+#define CTEST_NODE_BLOCK (32 * 1024)
+#define CTEST_POOL_BLOCK (64 * 1024)
 
-    fn = (CTest_FailureRecord*)malloc(sizeof(CTest_FailureRecord));
+// Take size bytes from the first block of *head, start a new block when it is full
+void* block_alloc(CTestBlock** head, size_t size, size_t block_size) {
+    CTestBlock* block = *head;
+    void* ptr;
 
-    if(NULL == fn) {
-        return;
-    }
+    size = (size + 15) & ~(size_t)15;
 
-    fn->file = NULL;
-    fn->message = NULL;
+    if((NULL == block) || (block->used + size > block->size)) {
+        if(size > block_size) {
+            block_size = size;
+        }
 
-    if(NULL != file) {
-        fn->file = (char*)malloc(strlen(file) + 1);
+        block = (CTestBlock*)malloc(sizeof(CTestBlock) + block_size);
 
-        if(NULL == fn->file) {
-            free(fn);
-            return;
+        if(NULL == block) {
+            error("Memory allocation failed");
         }
 
-        strcpy(fn->file, file);
+        block->used = 0;
+        block->size = block_size;
+        block->next = *head;
+        *head = block;
     }
 
-    if(NULL != szCondition) {
-        fn->message = (char*)malloc(strlen(szCondition) + 1);
-
-        if(NULL == fn->message) {
-            if(NULL != fn->file) {
-                free(fn->file);
-            }
+    ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
 
-            free(fn);
-            return;
-        }
+void block_free(CTestBlock** head) {
+    CTestBlock* next;
 
-        strcpy(fn->message, szCondition);
+    while(NULL != *head) {
+        next = (*head)->next;
+        free(*head);
+        *head = next;
     }
+}
 
-    fn->type = type;
-    fn->line = line;
-    fn->test = test;
-    fn->suite = suite;
-    fn->next = NULL;
-    fn->prev = NULL;
-
-    temp = *ppFailure;
+// Copy of str in the string pool
+char* pool_strdup(const char* str) {
+    size_t len = strlen(str) + 1;
+    char* copy = (char*)block_alloc(&registry.pool, len, CTEST_POOL_BLOCK);
+    memcpy(copy, str, len);
+    return copy;
+}
 
-    if(NULL != temp) {
-        while(NULL != temp->next) {
-            temp = temp->next;
-        }
+void* grow_array(void* array, unsigned int capacity, size_t item) {
+    array = realloc(array, capacity * item);
 
-        temp->next = fn;
-        fn->prev = temp;
-    } else {
-        *ppFailure = fn;
+    if(NULL == array) {
+        error("Memory allocation failed");
     }
 
-    ++(summary.failure_records);
-
-    last_failure = fn;
+    return array;
 }
 
-// Basic assert
-int CTest(int condition, const char* message, const char* file, const int line) {
-    assert(NULL != cur_suite);
-    assert(NULL != cur_test);
+// Case insensitive FNV-1a
+unsigned int name_hash(unsigned int hash, const char* name) {
+    while('\0' != *name) {
+        hash = (hash ^ (unsigned int)toupper((unsigned char) * name++)) * 16777619u;
+    }
 
-    ++summary.asserts;
+    return hash;
+}
 
-    if(!condition) {
-        ++summary.asserts_failed;
-        add_failure(&failure_list, CUF_AssertFailed, line, message, file, cur_suite, cur_test);
+int name_equal(const char* a, const char* b) {
+    while(('\0' != *a) && (toupper((unsigned char)*a) == toupper((unsigned char)*b))) {
+        a++;
+        b++;
     }
 
-    return condition;
+    return toupper((unsigned char)*a) == toupper((unsigned char)*b);
 }
 
-// Basic assert
-int CTestFatal(int condition, const char* message, const char* file, const int line) {
-    assert(NULL != cur_suite);
-    assert(NULL != cur_test);
+unsigned int test_key(unsigned int suite, const char* name) {
+    return name_hash(2166136261u ^ (suite * 0x9E3779B1u), name);
+}
 
-    ++summary.asserts;
+// Insert index under hash, doubling the table at half load
+void lookup_insert(unsigned int** table, unsigned int* size, unsigned int count, unsigned int hash, unsigned int index);
 
-    if(!condition) {
-        ++summary.asserts_failed;
-        add_failure(&failure_list, CUF_AssertFailed, line, message, file, cur_suite, cur_test);
+// Move the entries of table into a new table of new_size slots (a power of two)
+void lookup_rehash(unsigned int** table, unsigned int* size, unsigned int new_size) {
+    unsigned int old_size = *size;
+    unsigned int* old = *table;
+    unsigned int i, index;
 
-        if(NULL != cur_test->jumpBuf) {
-            longjmp(*(cur_test->jumpBuf), 1);
+    *size = new_size;
+    *table = (unsigned int*)calloc(*size, sizeof(unsigned int));
+
+    if(NULL == *table) {
+        error("Memory allocation failed");
+    }
+
+    for(i = 0; i < old_size; i++) {
+        if(0 != old[i]) {
+            index = old[i] - 1;
+
+            if(table == &registry.test_lookup) {
+                lookup_insert(table, size, 0, test_key(registry.test_suite[index], registry.test_name[index]), index);
+            } else {
+                lookup_insert(table, size, 0, name_hash(2166136261u, registry.suite_handle[index]->name), index);
+            }
         }
     }
 
-    return condition;
+    free(old);
 }
 
-void CTestStrings(const char* actual, // Actual string
-                  const char* expected, // Expected string
-                  const char* message, // Message
-                  const char* file, const int line
-                 ) {
-    if(NULL == actual) {
-        char* buf = CT_asprintf("%s\n ACTUAL is NULL", message);
-        CTest(0, buf, file, line);
-        free(buf);
-        return;
-    }
+void lookup_insert(unsigned int** table, unsigned int* size, unsigned int count, unsigned int hash, unsigned int index) {
+    unsigned int slot;
 
-    int res = strcmp(actual, expected);
-    int i;
-    char sa[80] = {0}, se[80] = {0};
+    if(2 * (count + 1) > *size) {
+        lookup_rehash(table, size, (0 == *size) ? 64 : *size * 2);
+    }
 
-    if(res) {
-        const char* a = actual, *e = expected;
+    for(slot = hash & (*size - 1); 0 != (*table)[slot]; slot = (slot + 1) & (*size - 1)) {
+    }
 
-        while((*a != '\0') && (*e != '\0') && (*a == *e)) {
-            a++;
-            e++;
-        }
+    (*table)[slot] = index + 1;
+}
 
-        // Comparison two strings in two neighboring lines
-        for(i = 0; i < 79; i++) {
-            sa[i] = *a;
-            se[i] = *e;
-            a++;
-            e++;
-        }
+// Size table for count entries at most half load, so inserting them does not rehash
+void lookup_reserve(unsigned int** table, unsigned int* size, unsigned int count) {
+    unsigned int new_size = 64;
 
-        sa[i] = '\0';
-        se[i] = '\0';
-        char* buf = CT_asprintf("%s\n === actual ===\n\"%s\"\n === expected===\n\"%s\"\n[a]%s\n[e]%s", message, actual, expected, sa, se);
-        CTest(!res, buf, file, line);
-        free(buf);
+    while(new_size < 2 * count) {
+        new_size *= 2;
     }
 
-    CTest(!res, message, file, line);
+    if(new_size > *size) {
+        lookup_rehash(table, size, new_size);
+    }
 }
 
-// Compare integers
-void CTestInt(uint64_t a, uint64_t e, const char* message, const char* file, const int line) {
-    if(a != e) {
-        char* buf = CT_asprintf("actual=%I64d expected=%I64d %s\n", a, e, message);
-        CTest(0, buf, file, line);
-        free(buf);
+// Room for capacity suites in the flat arrays and the suite lookup
+void flat_reserve_suites(unsigned int capacity) {
+    if(capacity > registry.suites_capacity) {
+        registry.suites_capacity = capacity;
+        registry.suite_handle = (CTestSuite**)grow_array(registry.suite_handle, registry.suites_capacity, sizeof(CTestSuite*));
+        registry.suite_active = (unsigned int*)grow_array(registry.suite_active, registry.suites_capacity, sizeof(unsigned int));
+        registry.suite_failed = (unsigned char*)grow_array(registry.suite_failed, registry.suites_capacity, sizeof(unsigned char));
+        lookup_reserve(&registry.suite_lookup, &registry.suite_lookup_size, capacity);
     }
-
-    CTest(1, message, file, line);
 }
 
-// == Compare files ==
-// Input parameters:
-//   filename_actual - actual file
-//   filename_expected - file standard to verify
-// Return:
-//   error message or NULL - OK
-char* compare_files(char* filename_actual, char* filename_expected) {
-    FILE* a = fopen(filename_actual, "r");
+// Room for capacity tests in the flat arrays and the test lookup
+void flat_reserve_tests(unsigned int capacity) {
+    if(capacity > registry.tests_capacity) {
+        registry.tests_capacity = capacity;
+        registry.test_handle = (CTestCase**)grow_array(registry.test_handle, registry.tests_capacity, sizeof(CTestCase*));
+        registry.test_name = (const char**)grow_array(registry.test_name, registry.tests_capacity, sizeof(const char*));
+        registry.test_suite = (unsigned int*)grow_array(registry.test_suite, registry.tests_capacity, sizeof(unsigned int));
+        registry.test_active = (unsigned char*)grow_array(registry.test_active, registry.tests_capacity, sizeof(unsigned char));
+        registry.test_failed = (unsigned int*)grow_array(registry.test_failed, registry.tests_capacity, sizeof(unsigned int));
+        lookup_reserve(&registry.test_lookup, &registry.test_lookup_size, capacity);
+    }
+}
 
-    if(!a) {
-        return CT_asprintf("File \"%s\" not found!\n", filename_actual);
+void flat_add_suite(CTestSuite* suite) {
+    if(registry.suites == registry.suites_capacity) {
+        flat_reserve_suites((0 == registry.suites_capacity) ? 16 : registry.suites_capacity * 2);
     }
 
-    FILE* b = fopen(filename_expected, "r");
+    suite->index = registry.suites;
+    registry.suite_handle[suite->index] = suite;
+    registry.suite_active[suite->index] = 0;
+    registry.suite_failed[suite->index] = 0;
+    lookup_insert(&registry.suite_lookup, &registry.suite_lookup_size, registry.suites, name_hash(2166136261u, suite->name), suite->index);
+    registry.suites++;
+}
 
-    if(!b) {
-        return CT_asprintf("File \"%s\" not found!\n", filename_expected);
+void flat_add_test(CTestSuite* suite, CTestCase* test) {
+    if(registry.tests == registry.tests_capacity) {
+        flat_reserve_tests((0 == registry.tests_capacity) ? 64 : registry.tests_capacity * 2);
     }
 
-    int pos = 0;
-    char ca, ce;
+    test->index = registry.tests;
+    registry.test_handle[test->index] = test;
+    registry.test_name[test->index] = test->name;
+    registry.test_suite[test->index] = suite->index;
+    registry.test_active[test->index] = 1;
+    registry.test_failed[test->index] = 0;
+    lookup_insert(&registry.test_lookup, &registry.test_lookup_size, registry.tests, test_key(suite->index, test->name), test->index);
+    registry.tests++;
+}
 
-    while(!feof(a) && !feof(b)) {
-        ca = fgetc(a);
-        ce = fgetc(b);
-        pos++;
+CTestSuite* find_suite(const char* name) {
+    unsigned int slot;
 
-        if(feof(a) || feof(b)) {
-            break;
-        }
+    if(0 == registry.suite_lookup_size) {
+        return NULL;
+    }
 
-        if(ca != ce) {
-            fclose(a);
-            fclose(b);
-            return CT_asprintf("\"%s\" \"%s\" diff pos %d '%c'!='%c'\n", filename_actual, filename_expected, pos, ca, ce);
+    for(slot = name_hash(2166136261u, name) & (registry.suite_lookup_size - 1); 0 != registry.suite_lookup[slot];
+            slot = (slot + 1) & (registry.suite_lookup_size - 1)) {
+        CTestSuite* suite = registry.suite_handle[registry.suite_lookup[slot] - 1];
+
+        if(name_equal(suite->name, name)) {
+            return suite;
         }
     }
 
-    if(feof(a) && !feof(b)) {
-        fclose(a);
-        fclose(b);
-        return CT_asprintf("size(\"%s\") < size(\"%s\")\n", filename_actual, filename_expected);
+    return NULL;
+}
+
+CTestCase* find_test(const CTestSuite* suite, const char* name) {
+    unsigned int slot, index;
+
+    if(0 == registry.test_lookup_size) {
+        return NULL;
     }
 
-    if(!feof(a) && feof(b)) {
-        fclose(a);
-        fclose(b);
-        return CT_asprintf("size(\"%s\") > size(\"%s\")\n", filename_actual, filename_expected);
+    for(slot = test_key(suite->index, name) & (registry.test_lookup_size - 1); 0 != registry.test_lookup[slot];
+            slot = (slot + 1) & (registry.test_lookup_size - 1)) {
+        index = registry.test_lookup[slot] - 1;
+
+        if(registry.test_suite[index] == suite->index && name_equal(registry.test_name[index], name)) {
+            return registry.test_handle[index];
+        }
     }
 
-    fclose(a);
-    fclose(b);
     return NULL;
 }
 
-// == Files compare ==
-// Input parameters:
-//   filename_actual - file with the results of processing
-//   filename_expected - expected file
-//   uiLine - program line with ASSERT
-//   message - condition description
-//   strFile - sorce file name
-//   bFatal - stop testings if this test fails
-void CTestFiles(char* filename_actual, char* filename_expected, const char* message, const char* file, const int line) {
-    assert(NULL != cur_suite);
-    assert(NULL != cur_test);
+void flat_clear() {
+    free(registry.test_handle);
+    free(registry.test_name);
+    free(registry.test_suite);
+    free(registry.test_active);
+    free(registry.test_failed);
+    free(registry.suite_handle);
+    free(registry.suite_active);
+    free(registry.suite_failed);
+    free(registry.dependency);
+    free(registry.dependency_start);
+    free(registry.dependency_list);
+    free(registry.test_lookup);
+    free(registry.suite_lookup);
+    free(registry.plan);
+    block_free(&registry.pool);
+    block_free(&registry.nodes);
+
+    registry.test_handle = NULL;
+    registry.test_name = NULL;
+    registry.test_suite = NULL;
+    registry.test_active = NULL;
+    registry.test_failed = NULL;
+    registry.suite_handle = NULL;
+    registry.suite_active = NULL;
+    registry.suite_failed = NULL;
+    registry.dependency = NULL;
+    registry.dependency_start = NULL;
+    registry.dependency_list = NULL;
+    registry.dependencies = registry.dependencies_capacity = 0;
+    registry.test_lookup = NULL;
+    registry.suite_lookup = NULL;
+    registry.plan = NULL;
+    registry.plan_size = 0;
+    registry.tests = registry.tests_capacity = registry.test_lookup_size = 0;
+    registry.suites = registry.suites_capacity = registry.suite_lookup_size = 0;
+}
 
-    ++summary.asserts;
+// == Suite dependencies ==
+// A suite runs after the suites it depends on and is skipped when one of them failed or was skipped.
+// Cycles are refused when a dependency is added, so the graph is always a DAG.
 
-    // Run file comparison
-    char* error = compare_files(filename_actual, filename_expected);
+#define CTEST_SUITE_FAILED  1       // A test, the initialization or the cleanup of the suite failed
+#define CTEST_SUITE_SKIPPED 2       // A dependency of the suite failed or was skipped
 
-    if(NULL != error) {
-        ++summary.asserts_failed;
+// Rebuild dependency_start/dependency_list from the pairs, keeping the order the dependencies were added in
+void dependency_index() {
+    unsigned int k;
 
-        // Prepair error message
-        char* msg = CT_asprintf("%s %s", message, error);
-        add_failure(&failure_list, CUF_AssertFailed, line, msg, file, cur_suite, cur_test);
-        free(msg);
-        free(error);
+    registry.dependency_start = (unsigned int*)grow_array(registry.dependency_start, registry.suites + 2, sizeof(unsigned int));
+    registry.dependency_list = (unsigned int*)grow_array(registry.dependency_list, registry.dependencies + 1, sizeof(unsigned int));
+    memset(registry.dependency_start, 0, (registry.suites + 2) * sizeof(unsigned int));
+
+    for(k = 0; k < registry.dependencies; k++) {
+        registry.dependency_start[registry.dependency[2 * k] + 2]++;
+    }
+
+    for(k = 2; k < registry.suites + 2; k++) {
+        registry.dependency_start[k] += registry.dependency_start[k - 1];
+    }
+
+    // dependency_start[s + 1] is the fill cursor of suite s and ends as its end offset
+    for(k = 0; k < registry.dependencies; k++) {
+        registry.dependency_list[registry.dependency_start[registry.dependency[2 * k] + 1]++] = registry.dependency[2 * k + 1];
     }
 }
 
-void CTestFilesFatal(char* filename_actual, char* filename_expected, const char* message, const char* file, const int line) {
-    assert(NULL != cur_suite);
-    assert(NULL != cur_test);
+// "from -> ... -> to" along dependencies, NULL if to cannot be reached. Caller must call free()
+char* dependency_path(unsigned int from, unsigned int to) {
+    unsigned int* parent = (unsigned int*)malloc((registry.suites + 1) * sizeof(unsigned int));
+    unsigned int* stack = (unsigned int*)malloc((registry.suites + 1) * sizeof(unsigned int));
+    unsigned int top = 0, suite, k;
+    char* path = NULL;
+    char* line;
 
-    ++summary.asserts;
+    if(NULL == parent || NULL == stack) {
+        error("Memory allocation failed");
+    }
 
-    // Run file comparison
-    char* error = compare_files(filename_actual, filename_expected);
+    memset(parent, 0xFF, (registry.suites + 1) * sizeof(unsigned int));
+    parent[from] = from;
+    stack[top++] = from;
 
-    if(NULL != error) {
-        ++summary.asserts_failed;
+    while(0 != top && UINT_MAX == parent[to]) {
+        suite = stack[--top];
 
-        // Prepair error message
-        char* msg = CT_asprintf("%s %s", message, error);
-        add_failure(&failure_list, CUF_AssertFailed, line, msg, file, cur_suite, cur_test);
-        free(msg);
-        free(error);
+        for(k = registry.dependency_start[suite]; k < registry.dependency_start[suite + 1]; k++) {
+            if(UINT_MAX == parent[registry.dependency_list[k]]) {
+                parent[registry.dependency_list[k]] = suite;
+                stack[top++] = registry.dependency_list[k];
+            }
+        }
+    }
 
-        if(NULL != cur_test->jumpBuf) {
-            longjmp(*(cur_test->jumpBuf), 1);
+    if(UINT_MAX != parent[to]) {
+        path = CT_asprintf("%s", registry.suite_handle[to]->name);
+
+        for(suite = to; suite != from; suite = parent[suite]) {
+            line = CT_asprintf("%s -> %s", registry.suite_handle[parent[suite]]->name, path);
+            free(path);
+            path = line;
         }
     }
+
+    free(parent);
+    free(stack);
+    return path;
 }
 
-double get_elapsed_time(void) {
-    if(test_is_running) {
-        return ((double)clock() - (double)start_time) / (double)CLOCKS_PER_SEC;
-    } else {
-        return summary.elapsed_time;
+void suite_order_visit(unsigned int suite, unsigned char* seen, unsigned int* order, unsigned int* count) {
+    unsigned int k;
+
+    if(seen[suite]) {
+        return;
     }
-}
 
-// Pointer to the currently running suite
-CTestSuite* running_suite = NULL;
+    seen[suite] = 1;
 
-/** Handler function called at completion of each test.
- *  @param test   The test being run.
- *  @param suite  The suite containing the test.
- *  @param pFailure Pointer to the 1st failure record for this test.
- */
-void basic_test_complete_message_handler(const CTestCase* test, const CTestSuite* suite, CTest_FailureRecord* pFailureList) {
-    CTest_FailureRecord* failure = pFailureList;
-    int i;
-#ifdef WIN32
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-#endif
+    for(k = registry.dependency_start[suite]; k < registry.dependency_start[suite + 1]; k++) {
+        suite_order_visit(registry.dependency_list[k], seen, order, count);
+    }
 
-    assert(NULL != suite);
-    assert(NULL != test);
+    order[(*count)++] = suite;
+}
 
-    if(NULL == failure) {
-#ifdef WIN32
-        // Save attributes
-        GetConsoleScreenBufferInfo(hConsole, &csbi);
-        SetConsoleTextAttribute(hConsole, 10);
-#endif
-        xprintf("OK");
-#ifdef WIN32
-        SetConsoleTextAttribute(hConsole, csbi.wAttributes);
-#endif
-    } else {
-#ifdef WIN32
-        // Save attributes
-        GetConsoleScreenBufferInfo(hConsole, &csbi);
-        SetConsoleTextAttribute(hConsole, 12);
-#endif
-        xprintf("FAIL");
-#ifdef WIN32
-        SetConsoleTextAttribute(hConsole, csbi.wAttributes);
-#endif
+// Suite indices, each after its dependencies and otherwise in the order of suites (NULL - registration order).
+// Caller must call free()
+unsigned int* suite_order(const unsigned int* suites, unsigned int count) {
+    unsigned int* order = (unsigned int*)malloc((registry.suites + 1) * sizeof(unsigned int));
+    unsigned char* seen = (unsigned char*)calloc(registry.suites + 1, 1);
+    unsigned int n = 0, k;
+    CTestSuite* suite;
 
-        for(i = 1 ; (NULL != failure) ; failure = failure->next, i++) {
-            xprintf("\n    %d. %s:%u  - %s", i,
-                    (NULL != failure->file) ? failure->file : "",
-                    failure->line,
-                    (NULL != failure->message) ? failure->message : "");
+    if(NULL == order || NULL == seen) {
+        error("Memory allocation failed");
+    }
+
+    dependency_index();
+
+    if(NULL != suites) {
+        for(k = 0; k < count; k++) {
+            suite_order_visit(suites[k], seen, order, &n);
         }
     }
-}
 
-void run_single_test(CTestCase* test) {
-    volatile unsigned int start_failures;
-    /* keep track of the last failure BEFORE running the test */
-    CTest_FailureRecord* pLastFailure = last_failure;
-    jmp_buf buf;
+    for(suite = registry.suite; NULL != suite; suite = suite->next) {
+        suite_order_visit(suite->index, seen, order, &n);
+    }
 
-    assert(NULL != cur_suite);
-    assert(0 != cur_suite->active);
-    assert(NULL != test);
+    free(seen);
+    return order;
+}
 
-    start_failures = summary.failure_records;
+// Regroup the plan by suite in dependency order, suites in the order of their first planned test
+void order_plan() {
+    unsigned int* suites = (unsigned int*)malloc((registry.plan_size + 1) * sizeof(unsigned int));
+    unsigned int* position = (unsigned int*)malloc((registry.suites + 1) * sizeof(unsigned int));
+    unsigned int* start = (unsigned int*)calloc(registry.suites + 2, sizeof(unsigned int));
+    unsigned int* plan = (unsigned int*)malloc((registry.plan_size + 1) * sizeof(unsigned int));
+    unsigned int* order;
+    unsigned int k;
+
+    if(NULL == suites || NULL == position || NULL == start || NULL == plan) {
+        error("Memory allocation failed");
+    }
 
-    cur_test = test;
+    for(k = 0; k < registry.plan_size; k++) {
+        suites[k] = registry.test_suite[registry.plan[k]];
+    }
 
-    // Before test
-    assert(NULL != cur_suite);
-    assert(NULL != cur_test);
-    assert(NULL != cur_test->name);
+    order = suite_order(suites, registry.plan_size);
 
-    if((NULL == running_suite) || (running_suite != cur_suite)) {
-        assert(NULL != cur_suite->name);
-        xprintf("\n--== %s ==--", cur_suite->name);
-        xprintf("\n  * %s.. ", cur_test->name);
-        running_suite = cur_suite;
-    } else {
-        xprintf("\n  * %s.. ", cur_test->name);
+    for(k = 0; k < registry.suites; k++) {
+        position[order[k]] = k;
     }
 
-    /* run test if it is active */
-    if(0 != test->active) {
+    // Stable counting sort by the position of the suite
+    for(k = 0; k < registry.plan_size; k++) {
+        start[position[suites[k]] + 1]++;
+    }
 
-        /* set jmp_buf and run test */
-        test->jumpBuf = &buf;
+    for(k = 0; k < registry.suites; k++) {
+        start[k + 1] += start[k];
+    }
 
-        if(0 == setjmp(buf)) {
-            if(NULL != test->test) {
-                (*test->test)();
-            }
+    for(k = 0; k < registry.plan_size; k++) {
+        plan[start[position[suites[k]]]++] = registry.plan[k];
+    }
+
+    memcpy(registry.plan, plan, registry.plan_size * sizeof(unsigned int));
+
+    free(order);
+    free(plan);
+    free(start);
+    free(position);
+    free(suites);
+}
+
+// Suite of a complete run: failed if any of its tests failed
+void suite_done(CTestSuite* suite) {
+    CTestCase* test;
+
+    for(test = suite->test; NULL != test && 0 == registry.suite_failed[suite->index]; test = test->next) {
+        if(0 != registry.test_failed[test->index]) {
+            registry.suite_failed[suite->index] = CTEST_SUITE_FAILED;
         }
+    }
+}
 
-        summary.tests_run++;
-    } else {
-        summary.tests_inactive++;
+// First dependency of suite that failed or was skipped, NULL - suite may run
+CTestSuite* suite_blocker(const CTestSuite* suite) {
+    unsigned int k;
 
-        add_failure(&failure_list, CUF_TestInactive, 0, "Test inactive", "CTest System", cur_suite, cur_test);
+    for(k = registry.dependency_start[suite->index]; k < registry.dependency_start[suite->index + 1]; k++) {
+        if(0 != registry.suite_failed[registry.dependency_list[k]]) {
+            return registry.suite_handle[registry.dependency_list[k]];
+        }
     }
 
-    // if additional failures have occurred..
-    if(summary.failure_records > start_failures) {
-        summary.tests_failed++;
+    return NULL;
+}
 
-        if(NULL != pLastFailure) {
-            pLastFailure = pLastFailure->next;  /* was a previous failure, so go to next one */
+// Glob match with * and ?
+int glob_match(const char* pattern, const char* str) {
+    const char* star = NULL;
+    const char* retry = NULL;
+
+    while('\0' != *str) {
+        if('*' == *pattern) {
+            star = pattern++;
+            retry = str;
+        } else if('?' == *pattern || *pattern == *str) {
+            pattern++;
+            str++;
+        } else if(NULL != star) {
+            pattern = star + 1;
+            str = ++retry;
         } else {
-            pLastFailure = failure_list;       /* no previous failure - go to 1st one */
+            return 0;
         }
-    } else {
-        pLastFailure = NULL;                   /* no additional failure - set to NULL */
     }
 
-    basic_test_complete_message_handler(cur_test, cur_suite, pLastFailure);
+    while('*' == *pattern) {
+        pattern++;
+    }
 
-    test->jumpBuf = NULL;
-    cur_test = NULL;
+    return '\0' == *pattern;
 }
 
-// Runs all tests in a specified suite
-void run_single_suite(CTestSuite* suite) {
-    CTestCase* test = NULL;
-    unsigned int nStartFailures;
+// Apply --filter and --shard to the flat arrays, a linear scan
+void select_tests() {
+    unsigned int i, selected = 0;
+    char* full = NULL;
+    size_t full_size = 0;
 
-    /* keep track of the last failure BEFORE running the test */
-    CTest_FailureRecord* pLastFailure = last_failure;
+    for(i = 0; i < registry.suites; i++) {
+        registry.suite_active[i] = 0;
+    }
 
-    assert(NULL != suite);
+    for(i = 0; i < registry.tests; i++) {
+        unsigned char active = 1;
 
-    nStartFailures = summary.failure_records;
+        if(options.run_index >= 0) {
+            // --run-index overrides --filter and --shard
+            registry.test_active[i] = (i == (unsigned long)options.run_index);
+            registry.suite_active[registry.test_suite[i]] += registry.test_active[i];
+            continue;
+        }
 
-    cur_test = NULL;
-    cur_suite = suite;
+        if(NULL != options.filter) {
+            const char* suite_name = registry.suite_handle[registry.test_suite[i]]->name;
+            size_t len = strlen(suite_name) + strlen(registry.test_name[i]) + 2;
 
-    /* run suite if it's active */
-    if(suite->active) {
+            if(len > full_size) {
+                full_size = len * 2;
+                full = (char*)realloc(full, full_size);
 
-        /* run the suite initialization function, if any */
-        if((NULL != suite->initialize) && (0 != (*suite->initialize)())) {
-            /* init function had an error - call handler, if any */
-            assert(NULL != suite);
-            assert(NULL != suite->name);
-            xprintf("\nWARNING - Suite initialization failed for '%s'.", suite->name);
+                if(NULL == full) {
+                    error("Memory allocation failed");
+                }
+            }
 
-            summary.suites_failed++;
-            add_failure(&failure_list, CUF_SuiteInitFailed, 0, "Suite Initialization failed - Suite Skipped", "CTest System", suite, NULL);
+            sprintf(full, "%s/%s", suite_name, registry.test_name[i]);
+            active = (unsigned char)glob_match(options.filter, full);
+        }
 
-            error("Suite initialization failed");
-            return;
-        } else { /* reach here if no suite initialization, or if it succeeded */
-            test = suite->test;
+        if(active && options.shard_count > 1) {
+            active = (selected % options.shard_count) == options.shard_index;
+            selected++;
+        }
 
-            while(NULL != test) {
-                if(0 != test->active) {
-                    run_single_test(test);
-                } else {
-                    summary.tests_inactive++;
-                    add_failure(&failure_list, CUF_TestInactive, 0, "Test inactive", "CTest System", suite, test);
-                }
+        registry.test_active[i] = active;
+        registry.suite_active[registry.test_suite[i]] += active;
+    }
 
-                test = test->next;
+    free(full);
+}
+
+// Changed path matches __FILE__ if one is a suffix of the other at a path separator
+int path_matches(const char* changed, const char* file) {
+    size_t lc, lf;
+
+    if(NULL == changed || NULL == file) {
+        return 0;
+    }
+
+    while('.' == file[0] && '/' == file[1]) {
+        file += 2;
+    }
+
+    lc = strlen(changed);
+    lf = strlen(file);
+
+    if(lc >= lf) {
+        return 0 == strcmp(changed + lc - lf, file) && (lc == lf || '/' == changed[lc - lf - 1]);
+    }
+
+    return 0 == strcmp(file + lf - lc, changed) && '/' == file[lf - lc - 1];
+}
+
+// Rank tests by the --run-order file: 0 - failed last time, 1 - file changed, 2 - the rest.
+// "I\tindex" lines give the exact plan instead (--bisect-order children).
+void load_run_order(unsigned char* rank) {
+    FILE* f = fopen(options.run_order, "r");
+    char line[4096];
+    unsigned int i;
+
+    if(NULL == f) {
+        return;
+    }
+
+    while(NULL != fgets(line, sizeof(line), f)) {
+        char* name = line + 2;
+        char* tab;
+
+        line[strcspn(line, "\n")] = '\0';
+
+        if('F' == line[0] && '\t' == line[1] && NULL != (tab = strchr(name, '\t'))) {
+            CTestSuite* suite;
+            CTestCase* test;
+
+            *tab = '\0';
+            suite = find_suite(name);
+            test = (NULL != suite) ? find_test(suite, tab + 1) : NULL;
+
+            if(NULL != test) {
+                rank[test->index] = 0;
             }
+        } else if('I' == line[0] && '\t' == line[1]) {
+            unsigned long index = strtoul(name, NULL, 10);
 
-            summary.suites_run++;
+            if(index < registry.tests && registry.plan_size < registry.tests) {
+                registry.plan[registry.plan_size++] = (unsigned int)index;
+            }
+        } else if('C' == line[0] && '\t' == line[1]) {
+            for(i = 0; i < registry.tests; i++) {
+                CTestCase* test = registry.test_handle[i];
 
-            /* call the suite cleanup function, if any */
-            if((NULL != suite->cleanup) && (0 != (*suite->cleanup)())) {
-                assert(NULL != suite);
-                assert(NULL != suite->name);
-                xprintf("\nWARNING - Suite cleanup failed for '%s'.", suite->name);
+                if(rank[i] > 1 && (path_matches(name, test->file) || path_matches(name, registry.suite_handle[registry.test_suite[i]]->file))) {
+                    rank[i] = 1;
+                }
+            }
+        }
+    }
 
-                summary.suites_failed++;
-                add_failure(&failure_list, CUF_SuiteCleanupFailed, 0, "Suite cleanup failed.", "CTest System", suite, NULL);
+    fclose(f);
+}
+
+void shuffle_indices(CTestRandom* rnd, unsigned int* items, unsigned int count) {
+    unsigned int i, j, t;
+
+    for(i = count; i > 1; i--) {
+        j = (unsigned int)CTest_random_below(rnd, i);
+        t = items[i - 1];
+        items[i - 1] = items[j];
+        items[j] = t;
+    }
+}
+
+// Build registry.plan: selected (and inactive) tests of the suites that run,
+// registration order or --shuffle order (suites stay contiguous), stable sorted by rank
+void build_plan(const unsigned char* rank) {
+    CTestRandom rnd;
+    CTestSuite* suite;
+    CTestCase* test;
+    unsigned int* suites = (unsigned int*)malloc((registry.suites + 1) * sizeof(unsigned int));
+    unsigned int* order = (unsigned int*)malloc((registry.tests + 1) * sizeof(unsigned int));
+    unsigned int suite_count = 0, count = 0, first, i;
+    unsigned char r;
+
+    if(NULL == suites || NULL == order) {
+        error("Memory allocation failed");
+    }
+
+    rnd.state = options.shuffle_seed;
+
+    for(suite = registry.suite; suite; suite = suite->next) {
+        if(0 != suite->active && 0 != registry.suite_active[suite->index]) {
+            suites[suite_count++] = suite->index;
+        }
+    }
+
+    if(options.shuffle) {
+        shuffle_indices(&rnd, suites, suite_count);
+    }
+
+    for(i = 0; i < suite_count; i++) {
+        first = count;
+
+        for(test = registry.suite_handle[suites[i]]->test; test; test = test->next) {
+            if(0 == test->active || registry.test_active[test->index]) {
+                order[count++] = test->index;
             }
         }
-    } else { /* otherwise record inactive suite and failure if appropriate */
-        summary.suites_inactive++;
 
-        add_failure(&failure_list, CUF_SuiteInactive, 0, "Suite inactive", "CTest System", suite, NULL);
+        if(options.shuffle) {
+            shuffle_indices(&rnd, order + first, count - first);
+        }
     }
 
-    //if additional failures have occurred..
-    if(summary.failure_records > nStartFailures) {
-        if(NULL != pLastFailure) {
-            pLastFailure = pLastFailure->next;  /* was a previous failure, so go to next one */
-        } else {
-            pLastFailure = failure_list;       /* no previous failure - go to 1st one */
+    registry.plan_size = 0;
+
+    for(r = 0; r < 3; r++) {
+        for(i = 0; i < count; i++) {
+            if(rank[order[i]] == r) {
+                registry.plan[registry.plan_size++] = order[i];
+            }
         }
+    }
+
+    free(suites);
+    free(order);
+}
+
+// Order the run by --run-order, --shuffle or for --bisect-order.
+// Return: 1 - registry.plan is used, 0 - registration order
+int prepare_plan() {
+    unsigned char* rank;
+
+    if(NULL == options.run_order && !options.shuffle && !options.bisect) {
+        return 0;
+    }
+
+    rank = (unsigned char*)malloc(registry.tests + 1);
+
+    if(NULL == rank) {
+        error("Memory allocation failed");
+    }
+
+    memset(rank, 2, registry.tests + 1);
+    registry.plan = (unsigned int*)grow_array(registry.plan, registry.tests + 1, sizeof(unsigned int));
+    registry.plan_size = 0;
+
+    if(NULL != options.run_order) {
+        load_run_order(rank);
+    }
+
+    if(0 == registry.plan_size) {
+        build_plan(rank);
+    }
+
+    if(0 != registry.dependencies) {
+        order_plan();
+    }
+
+    free(rank);
+    return 1;
+}
+
+// == Binary result protocol ==
+
+uint64_t CTest_time_ns(void) {
+#ifdef WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Frame writer, keeps counting when buf is too small
+typedef struct CTestWriter {
+    unsigned char*  pos;
+    unsigned char*  end;
+    size_t          size;
+} CTestWriter;
+
+void put_bytes(CTestWriter* w, const void* data, size_t size) {
+    if(NULL != w->pos && w->pos + size <= w->end) {
+        memcpy(w->pos, data, size);
+        w->pos += size;
     } else {
-        pLastFailure = NULL;                   /* no additional failure - set to NULL */
+        w->pos = NULL;
     }
 
-    cur_suite = NULL;
+    w->size += size;
 }
 
-void cleanup_failure_list() {
-    CTest_FailureRecord* cur = NULL;
-    CTest_FailureRecord* next = NULL;
+void put_u32(CTestWriter* w, uint32_t value) {
+    unsigned char b[4];
+    int i;
 
-    cur = failure_list;
+    for(i = 0; i < 4; i++) {
+        b[i] = (unsigned char)(value >> (8 * i));
+    }
 
-    while(NULL != cur) {
+    put_bytes(w, b, 4);
+}
+
+void put_u64(CTestWriter* w, uint64_t value) {
+    put_u32(w, (uint32_t)value);
+    put_u32(w, (uint32_t)(value >> 32));
+}
+
+// Longer strings are truncated, so that any event fits in CTEST_MAX_FRAME
+#define CTEST_MAX_STRING (CTEST_MAX_FRAME / 8)
+
+void put_str(CTestWriter* w, const char* str) {
+    size_t len;
 
-        if(NULL != cur->message) {
-            free(cur->message);
+    if(NULL == str) {
+        put_u32(w, 0);
+        return;
+    }
+
+    len = strlen(str);
+    len = (len > CTEST_MAX_STRING) ? CTEST_MAX_STRING : len;
+    put_u32(w, (uint32_t)len + 1);
+    put_bytes(w, str, len);
+    put_bytes(w, "", 1);
+}
+
+size_t CTest_encode_event(const CTestEvent* event, unsigned char* buf, size_t size) {
+    CTestWriter w;
+    unsigned char header[4] = {'C', 'T', CTEST_PROTOCOL_VERSION, (unsigned char)event->type};
+    int i;
+
+    w.pos = buf;
+    w.end = buf + size;
+    w.size = 0;
+
+    put_bytes(&w, header, 4);
+    put_u32(&w, 0); // Payload length, patched below
+
+    switch(event->type) {
+    case CTE_RunStart:
+        put_u64(&w, event->count[0]);
+        put_u64(&w, event->count[1]);
+        put_u64(&w, event->count[2]);
+        break;
+
+    case CTE_TestStart:
+        put_u32(&w, event->suite);
+        put_u32(&w, event->test);
+        put_str(&w, event->suite_name);
+        put_str(&w, event->name);
+        break;
+
+    case CTE_TestEnd:
+        put_u32(&w, event->suite);
+        put_u32(&w, event->test);
+        put_u32(&w, event->status);
+        put_u64(&w, event->asserts);
+        put_u64(&w, event->asserts_failed);
+        put_u64(&w, event->duration_ns);
+        break;
+
+    case CTE_Failure:
+        put_u32(&w, event->suite);
+        put_u32(&w, event->test);
+        put_u32(&w, event->failure_type);
+        put_u32(&w, event->line);
+        put_u64(&w, (uint64_t)event->row);
+        put_u32(&w, event->payload);
+        put_u64(&w, event->actual);
+        put_u64(&w, event->expected);
+        put_str(&w, event->file);
+        put_str(&w, event->message);
+        put_str(&w, event->actual_str);
+        put_str(&w, event->expected_str);
+        break;
+
+    case CTE_RunEnd:
+        for(i = 0; i < 6; i++) {
+            put_u64(&w, event->count[i]);
         }
 
-        if(NULL != cur->file) {
-            free(cur->file);
+        put_u64(&w, event->asserts);
+        put_u64(&w, event->asserts_failed);
+        put_u64(&w, event->duration_ns);
+        break;
+    }
+
+    if(NULL != w.pos) {
+        uint32_t len = (uint32_t)(w.size - CTEST_FRAME_HEADER);
+
+        for(i = 0; i < 4; i++) {
+            buf[4 + i] = (unsigned char)(len >> (8 * i));
         }
+    }
 
-        next = cur->next;
-        free(cur);
-        cur = next;
+    return w.size;
+}
+
+void CTest_failure_event(const CTest_FailureRecord* failure, CTestEvent* event) {
+    memset(event, 0, sizeof(CTestEvent));
+    event->type = CTE_Failure;
+    event->suite = (NULL != failure->suite) ? failure->suite->index : CTEST_NO_TEST;
+    event->test = (NULL != failure->test) ? failure->test->index : CTEST_NO_TEST;
+    event->failure_type = (uint32_t)failure->type;
+    event->line = failure->line;
+    event->row = failure->row;
+    event->payload = (uint32_t)failure->payload;
+    event->actual = failure->actual;
+    event->expected = failure->expected;
+    event->file = failure->file;
+    event->message = failure->message;
+    event->actual_str = failure->actual_str;
+    event->expected_str = failure->expected_str;
+}
+
+// Frame reader over one complete payload
+typedef struct CTestReader {
+    const unsigned char* pos;
+    const unsigned char* end;
+    int             error;
+} CTestReader;
+
+uint32_t get_u32(CTestReader* r) {
+    uint32_t value = 0;
+    int i;
+
+    if(r->pos + 4 > r->end) {
+        r->error = 1;
+        return 0;
     }
 
-    failure_list = NULL;
+    for(i = 0; i < 4; i++) {
+        value |= (uint32_t)r->pos[i] << (8 * i);
+    }
+
+    r->pos += 4;
+    return value;
 }
 
-void clear_previous_results() {
-    summary.suites_run = 0;
-    summary.suites_failed = 0;
-    summary.suites_inactive = 0;
-    summary.tests_run = 0;
-    summary.tests_failed = 0;
-    summary.tests_inactive = 0;
-    summary.asserts = 0;
-    summary.asserts_failed = 0;
-    summary.failure_records = 0;
-    summary.elapsed_time = 0.0;
+uint64_t get_u64(CTestReader* r) {
+    uint64_t low = get_u32(r);
+    return low | ((uint64_t)get_u32(r) << 32);
+}
 
-    if(NULL != failure_list) {
-        cleanup_failure_list(failure_list);
+const char* get_str(CTestReader* r) {
+    uint32_t len = get_u32(r);
+    const char* str = (const char*)r->pos;
+
+    if(0 == len) {
+        return NULL;
     }
 
-    last_failure = NULL;
+    if((size_t)(r->end - r->pos) < len || '\0' != r->pos[len - 1]) {
+        r->error = 1;
+        return NULL;
+    }
+
+    r->pos += len;
+    return str;
 }
 
-size_t number_width(int number) {
-    char buf[33];
+// Decode one complete frame, return -1 on error
+int decode_frame(const unsigned char* frame, size_t size, CTestEventHandler handler, void* context) {
+    CTestEvent event;
+    CTestReader r;
+    int i;
 
-    snprintf(buf, 33, "%d", number);
-    buf[32] = '\0';
-    return strlen(buf);
+    memset(&event, 0, sizeof(event));
+    event.type = (CTestEventType)frame[3];
+    r.pos = frame + CTEST_FRAME_HEADER;
+    r.end = frame + size;
+    r.error = 0;
+
+    switch(event.type) {
+    case CTE_RunStart:
+        event.count[0] = get_u64(&r);
+        event.count[1] = get_u64(&r);
+        event.count[2] = get_u64(&r);
+        break;
+
+    case CTE_TestStart:
+        event.suite = get_u32(&r);
+        event.test = get_u32(&r);
+        event.suite_name = get_str(&r);
+        event.name = get_str(&r);
+        break;
+
+    case CTE_TestEnd:
+        event.suite = get_u32(&r);
+        event.test = get_u32(&r);
+        event.status = get_u32(&r);
+        event.asserts = get_u64(&r);
+        event.asserts_failed = get_u64(&r);
+        event.duration_ns = get_u64(&r);
+        break;
+
+    case CTE_Failure:
+        event.suite = get_u32(&r);
+        event.test = get_u32(&r);
+        event.failure_type = get_u32(&r);
+        event.line = get_u32(&r);
+        event.row = (int64_t)get_u64(&r);
+        event.payload = get_u32(&r);
+        event.actual = get_u64(&r);
+        event.expected = get_u64(&r);
+        event.file = get_str(&r);
+        event.message = get_str(&r);
+        event.actual_str = get_str(&r);
+        event.expected_str = get_str(&r);
+        break;
+
+    case CTE_RunEnd:
+        for(i = 0; i < 6; i++) {
+            event.count[i] = get_u64(&r);
+        }
+
+        event.asserts = get_u64(&r);
+        event.asserts_failed = get_u64(&r);
+        event.duration_ns = get_u64(&r);
+        break;
+
+    default:
+        return 0; // Unknown event types of the same version are skipped
+    }
+
+    if(r.error) {
+        return -1;
+    }
+
+    handler(&event, context);
+    return 0;
 }
 
-char* CU_get_run_results_string() {
-    size_t width[9];
-    size_t len;
-    char* result;
+// Size of the frame starting at data, 0 if the header is incomplete, (size_t)-1 if malformed or too long
+size_t frame_size(const unsigned char* data, size_t size) {
+    uint32_t len = 0;
+    int i;
 
-    width[0] = strlen("Run Summary:");
-    width[1] = max_int(5, 6, strlen("Type"), strlen("suites"), strlen("tests"), strlen("asserts")) + 1;
-    width[2] = max_int(5, 6, strlen("Total"), number_width(registry.number_of_suites), number_width(registry.number_of_tests), number_width(summary.asserts)) + 1;
-    width[3] = max_int(5, 6, strlen("Ran"), number_width(summary.suites_run), number_width(summary.tests_run), number_width(summary.asserts)) + 1;
-    width[4] = max_int(5, 6, strlen("Passed"), strlen("n/a"), number_width(summary.tests_run - summary.tests_failed), number_width(summary.asserts - summary.asserts_failed)) + 1;
-    width[5] = max_int(5, 6, strlen("Failed"), number_width(summary.suites_failed), number_width(summary.tests_failed), number_width(summary.asserts_failed)) + 1;
-    width[6] = max_int(5, 6, strlen("Inactive"), number_width(summary.suites_inactive), number_width(summary.tests_inactive), strlen("n/a")) + 1;
+    if(size < CTEST_FRAME_HEADER) {
+        return 0;
+    }
 
-    width[7] = strlen("Elapsed time = ");
-    width[8] = strlen(" seconds");
+    if('C' != data[0] || 'T' != data[1] || CTEST_PROTOCOL_VERSION != data[2]) {
+        return (size_t) -1;
+    }
 
-    len = 13 + 4 * (width[0] + width[1] + width[2] + width[3] + width[4] + width[5] + width[6]) + width[7] + width[8] + 1 + 2;
-    result = (char*)malloc(len);
+    for(i = 0; i < 4; i++) {
+        len |= (uint32_t)data[4 + i] << (8 * i);
+    }
 
-    if(NULL != result) {
-        snprintf(result, len, "\n%*s%*s%*s%*s%*s%*s%*s\n"   /* if you change this, be sure  */
-                 "%*s%*s%*u%*u%*s%*u%*u\n"   /* to change the calculation of */
-                 "%*s%*s%*u%*u%*u%*u%*u\n"   /* len above!                   */
-                 "%*s%*s%*u%*u%*u%*u%*s\n\n"
-                 "%*s%8.3f%*s",
-                 width[0], "Run Summary:",
-                 width[1], "Type",
-                 width[2], "Total",
-                 width[3], "Ran",
-                 width[4], "Passed",
-                 width[5], "Failed",
-                 width[6], "Inactive",
-                 width[0], " ",
-                 width[1], "suites",
-                 width[2], registry.number_of_suites,
-                 width[3], summary.suites_run,
-                 width[4], "n/a",
-                 width[5], summary.suites_failed,
-                 width[6], summary.suites_inactive,
-                 width[0], " ",
+    if(len > CTEST_MAX_FRAME) {
+        return (size_t) -1;
+    }
+
+    return CTEST_FRAME_HEADER + (size_t)len;
+}
+
+void CTest_decoder_init(CTestDecoder* decoder) {
+    decoder->partial = NULL;
+    decoder->partial_size = 0;
+    decoder->partial_capacity = 0;
+}
+
+void CTest_decoder_free(CTestDecoder* decoder) {
+    free(decoder->partial);
+    CTest_decoder_init(decoder);
+}
+
+// Append to the partial frame buffer
+void decoder_keep(CTestDecoder* decoder, const unsigned char* data, size_t size) {
+    if(decoder->partial_size + size > decoder->partial_capacity) {
+        decoder->partial_capacity = (decoder->partial_size + size) * 2;
+        decoder->partial = (unsigned char*)realloc(decoder->partial, decoder->partial_capacity);
+
+        if(NULL == decoder->partial) {
+            error("Memory allocation failed");
+        }
+    }
+
+    memcpy(decoder->partial + decoder->partial_size, data, size);
+    decoder->partial_size += size;
+}
+
+int CTest_decoder_feed(CTestDecoder* decoder, const void* data, size_t size, CTestEventHandler handler, void* context) {
+    const unsigned char* p = (const unsigned char*)data;
+    size_t need, take;
+
+    // Complete a frame split by the previous feed
+    while(0 != decoder->partial_size && 0 != size) {
+        need = frame_size(decoder->partial, decoder->partial_size);
+
+        if((size_t) -1 == need) {
+            return -1;
+        }
+
+        take = (0 == need) ? CTEST_FRAME_HEADER - decoder->partial_size : need - decoder->partial_size;
+
+        if(take > size) {
+            take = size;
+        }
+
+        decoder_keep(decoder, p, take);
+        p += take;
+        size -= take;
+
+        // The header may be complete now
+        if(0 == need && (size_t) -1 == (need = frame_size(decoder->partial, decoder->partial_size))) {
+            return -1;
+        }
+
+        if(0 != need && decoder->partial_size == need) {
+            if(0 != decode_frame(decoder->partial, need, handler, context)) {
+                return -1;
+            }
+
+            decoder->partial_size = 0;
+        }
+    }
+
+    // Frames complete in the fed buffer are decoded without copying
+    while(0 != size) {
+        need = frame_size(p, size);
+
+        if((size_t) -1 == need) {
+            return -1;
+        }
+
+        if(0 == need || need > size) {
+            decoder_keep(decoder, p, size);
+            break;
+        }
+
+        if(0 != decode_frame(p, need, handler, context)) {
+            return -1;
+        }
+
+        p += need;
+        size -= need;
+    }
+
+    return 0;
+}
+
+// Write a frame to --event-fd
+void emit_event(const CTestEvent* event) {
+    unsigned char stack_buf[512];
+    unsigned char* buf = stack_buf;
+    size_t size = CTest_encode_event(event, buf, sizeof(stack_buf));
+
+    if(size > sizeof(stack_buf)) {
+        buf = (unsigned char*)malloc(size);
+
+        if(NULL == buf) {
+            return;
+        }
+
+        CTest_encode_event(event, buf, size);
+    }
+
+#ifndef WIN32
+    {
+        size_t done = 0;
+        ssize_t res;
+
+        pthread_mutex_lock(&event_lock);
+
+        while(done < size) {
+            res = write(options.event_fd, buf + done, size - done);
+
+            if(res < 0 && EINTR == errno) {
+                continue;
+            }
+
+            if(res <= 0) {
+                options.event_fd = -1; // Reader is gone
+                break;
+            }
+
+            done += (size_t)res;
+        }
+
+        pthread_mutex_unlock(&event_lock);
+    }
+#endif
+
+    if(buf != stack_buf) {
+        free(buf);
+    }
+}
+
+// Failure payloads are filled after append_failure() returns,
+// so records are streamed just before the next test or run event
+void emit_failures(void) {
+    CTest_FailureRecord* failure = (NULL != last_emitted_failure) ? last_emitted_failure->next : failure_list;
+    CTestEvent event;
+
+    for(; NULL != failure; failure = failure->next) {
+        CTest_failure_event(failure, &event);
+        emit_event(&event);
+        last_emitted_failure = failure;
+    }
+}
+
+void emit_run_event(CTestEventType type) {
+    CTestEvent event;
+
+    if(options.event_fd < 0) {
+        return;
+    }
+
+    emit_failures();
+
+    memset(&event, 0, sizeof(event));
+    event.type = type;
+
+    if(CTE_RunStart == type) {
+        event.count[0] = registry.number_of_suites;
+        event.count[1] = registry.number_of_tests;
+        event.count[2] = options.seed;
+    } else {
+        event.count[0] = summary.suites_run;
+        event.count[1] = summary.suites_failed;
+        event.count[2] = summary.suites_inactive;
+        event.count[3] = summary.tests_run;
+        event.count[4] = summary.tests_failed;
+        event.count[5] = summary.tests_inactive;
+        event.asserts = summary.asserts;
+        event.asserts_failed = summary.asserts_failed;
+        event.duration_ns = (uint64_t)(summary.elapsed_time * 1e9);
+    }
+
+    emit_event(&event);
+}
+
+// Parts of a failure copied into its record by append_failure()
+#define CTEST_COPY_MESSAGE 1
+#define CTEST_COPY_FILE 2
+
+// Append a failure record. The record, extra payload bytes and the parts selected by copy
+// (CTEST_COPY_*) are one allocation; message and file not copied must be static (literals).
+CTest_FailureRecord* append_failure(CTest_FailureType type, unsigned int line, const char* message, int copy,
+                                    const char* file, CTestSuite* suite, CTestCase* test, size_t extra) {
+    size_t message_size = (0 != (copy & CTEST_COPY_MESSAGE) && NULL != message) ? strlen(message) + 1 : 0;
+    size_t file_size = (0 != (copy & CTEST_COPY_FILE) && NULL != file) ? strlen(file) + 1 : 0;
+    CTest_FailureRecord* fn = (CTest_FailureRecord*)malloc(sizeof(CTest_FailureRecord) + extra + message_size + file_size);
+    char* copies;
+
+    if(NULL == fn) {
+        return NULL;
+    }
+
+    copies = (char*)(fn + 1) + extra;
+
+    if(0 != message_size) {
+        memcpy(copies, message, message_size);
+        message = copies;
+    }
+
+    if(0 != file_size) {
+        memcpy(copies + message_size, file, file_size);
+        file = copies + message_size;
+    }
+
+    fn->type = type;
+    fn->line = line;
+    fn->file = file;
+    fn->message = message;
+    fn->test = test;
+    fn->suite = suite;
+    fn->row = (NULL != test) ? cur_row : -1;
+    fn->payload = CTP_Message;
+    fn->actual = fn->expected = 0;
+    fn->actual_str = fn->expected_str = NULL;
+    fn->actual_len = fn->expected_len = 0;
+    fn->next = NULL;
+    fn->prev = last_failure;
+
+    // last_failure is the tail of failure_list
+    if(NULL != last_failure) {
+        last_failure->next = fn;
+    } else {
+        failure_list = fn;
+    }
+
+    ++(summary.failure_records);
+
+    last_failure = fn;
+
+    return fn;
+}
+
+// Extra payload bytes of a record created by append_failure()
+char* failure_extra(CTest_FailureRecord* failure) {
+    return (char*)(failure + 1);
+}
+
+// Failure with copies of szCondition and file
+void add_failure(CTest_FailureRecord** ppFailure, CTest_FailureType type, unsigned int line, const char* szCondition, const char* file, CTestSuite* suite, CTestCase* test) {
+    assert(&failure_list == ppFailure);
+
+    append_failure(type, line, szCondition, CTEST_COPY_MESSAGE | CTEST_COPY_FILE, file, suite, test, 0);
+}
+
+// Recreate a failure record from a CTE_Failure event of another process or of the journal
+CTest_FailureRecord* replay_failure(const CTestEvent* event, CTestSuite* suite, CTestCase* test) {
+    size_t la = (NULL != event->actual_str) ? strlen(event->actual_str) : 0;
+    size_t le = (NULL != event->expected_str) ? strlen(event->expected_str) : 0;
+    CTest_FailureRecord* failure;
+    const char* file;
+    char* extra;
+
+    // File names are mostly the one of the test registration
+    file = (NULL != event->file && NULL != test && NULL != test->file && 0 == strcmp(event->file, test->file)) ? test->file :
+           pool_strdup((NULL != event->file) ? event->file : "");
+    failure = append_failure((CTest_FailureType)event->failure_type, event->line, event->message, CTEST_COPY_MESSAGE, file, suite, test, la + le + 2);
+
+    if(NULL != failure) {
+        failure->row = (NULL != test) ? (long)event->row : -1;
+        failure->payload = (CTest_PayloadType)event->payload;
+        failure->actual = event->actual;
+        failure->expected = event->expected;
+        failure->actual_len = la;
+        failure->expected_len = le;
+        extra = failure_extra(failure);
+
+        if(NULL != event->actual_str) {
+            memcpy(extra, event->actual_str, la + 1);
+            failure->actual_str = extra;
+        }
+
+        if(NULL != event->expected_str) {
+            memcpy(extra + la + 1, event->expected_str, le + 1);
+            failure->expected_str = extra + la + 1;
+        }
+    }
+
+    return failure;
+}
+
+// Failed table cases of a test whose results are replayed from events
+typedef struct CTestReplay {
+    unsigned int    failed_rows;
+    long            last_row;
+} CTestReplay;
+
+void replay_row(CTestReplay* replay, const CTestEvent* event) {
+    if(event->row >= 0 && event->row != replay->last_row) {
+        replay->failed_rows++;
+        replay->last_row = (long)event->row;
+    }
+}
+
+// Count a replayed CTE_TestEnd like run_single_test() and run_table_cases() do
+void replay_test_end(CTestReplay* replay, const CTestEvent* event) {
+    CTestCase* test = registry.test_handle[event->test];
+    unsigned int failed = (CTS_Failed != event->status) ? 0 : ((NULL != test->rows && 0 != replay->failed_rows) ? replay->failed_rows : 1);
+
+    summary.tests_run += (NULL != test->rows) ? (unsigned int)test->row_count : 1;
+    summary.tests_failed += failed;
+    summary.asserts += event->asserts;
+    summary.asserts_failed += event->asserts_failed;
+    registry.test_failed[event->test] += failed;
+
+    replay->failed_rows = 0;
+    replay->last_row = -1;
+}
+
+// Human readable text of a failure, caller must call free(str)
+char* CTest_format_failure(const CTest_FailureRecord* failure) {
+    const char* message = (NULL != failure->message) ? failure->message : "";
+
+    switch(failure->payload) {
+    case CTP_Integers:
+        return CT_asprintf("actual=%lld expected=%lld %s", (long long)failure->actual, (long long)failure->expected, message);
+
+    case CTP_Strings: {
+        const char* a = failure->actual_str;
+        const char* e = failure->expected_str;
+        size_t i = 0;
+
+        if(NULL == a) {
+            return CT_asprintf("%s\n ACTUAL is NULL", message);
+        }
+
+        if(NULL == e) {
+            return CT_asprintf("%s\n EXPECTED is NULL", message);
+        }
+
+        // Comparison two strings in two neighboring lines from the first difference
+        while(i < failure->actual_len && i < failure->expected_len && a[i] == e[i]) {
+            i++;
+        }
+
+        return CT_asprintf("%s\n === actual ===\n\"%s\"\n === expected===\n\"%s\"\n[a]%.79s\n[e]%.79s", message, a, e, a + i, e + i);
+    }
+
+    default:
+        return CT_asprintf("%s", message);
+    }
+}
+
+// Passing assertions from the inline macros, folded into summary.asserts after each test.
+// Tests running at once count on their own threads (see CTEST_EMULATED_TLS in CTest.h).
+#ifdef CTEST_EMULATED_TLS
+uint64_t CTest_asserts_passed = 0;
+int CTest_concurrent = 0;
+#define SET_CONCURRENT(on) (CTest_concurrent = (on))
+CTEST_THREAD_LOCAL uint64_t thread_passed = 0;
+
+void CTest_add_passed(uint64_t count) {
+    if(CTest_concurrent) {
+        thread_passed += count;
+    } else {
+        CTest_asserts_passed += count;
+    }
+}
+
+void fold_passed_asserts() {
+    if(CTest_concurrent) {
+        summary.asserts += thread_passed;
+        thread_passed = 0;
+    } else {
+        summary.asserts += CTest_asserts_passed;
+        CTest_asserts_passed = 0;
+    }
+}
+#else
+CTEST_THREAD_LOCAL uint64_t CTest_asserts_passed = 0;
+#define SET_CONCURRENT(on) ((void)0)
+
+void CTest_add_passed(uint64_t count) {
+    CTest_asserts_passed += count;
+}
+
+void fold_passed_asserts() {
+    summary.asserts += CTest_asserts_passed;
+    CTest_asserts_passed = 0;
+}
+#endif
+
+void CTest_fail(const char* expression, const char* file, const int line) {
+    assert(NULL != cur_suite);
+    assert(NULL != cur_test);
+
+    ++summary.asserts;
+    ++summary.asserts_failed;
+    append_failure(CUF_AssertFailed, line, expression, 0, file, cur_suite, cur_test, 0);
+}
+
+void CTest_fail_fatal(const char* expression, const char* file, const int line) {
+    CTest_fail(expression, file, line);
+
+    if(NULL != cur_test->jumpBuf) {
+        longjmp(*(cur_test->jumpBuf), 1);
+    }
+}
+
+// Basic assert
+int CTest(int condition, const char* message, const char* file, const int line) {
+    assert(NULL != cur_suite);
+    assert(NULL != cur_test);
+
+    ++summary.asserts;
+
+    if(!condition) {
+        ++summary.asserts_failed;
+        add_failure(&failure_list, CUF_AssertFailed, line, message, file, cur_suite, cur_test);
+    }
+
+    return condition;
+}
+
+// Basic assert
+int CTestFatal(int condition, const char* message, const char* file, const int line) {
+    assert(NULL != cur_suite);
+    assert(NULL != cur_test);
+
+    ++summary.asserts;
+
+    if(!condition) {
+        ++summary.asserts_failed;
+        add_failure(&failure_list, CUF_AssertFailed, line, message, file, cur_suite, cur_test);
+
+        if(NULL != cur_test->jumpBuf) {
+            longjmp(*(cur_test->jumpBuf), 1);
+        }
+    }
+
+    return condition;
+}
+
+// Record a failed string comparison, only the raw strings are kept. copy - CTEST_COPY_* of message and file
+void fail_strings(const char* actual, const char* expected, const char* message, int copy, const char* file, const int line) {
+    CTest_FailureRecord* failure;
+    size_t la = (NULL != actual) ? strlen(actual) : 0;
+    size_t le = (NULL != expected) ? strlen(expected) : 0;
+    char* extra;
+
+    ++summary.asserts_failed;
+    failure = append_failure(CUF_AssertFailed, line, message, copy, file, cur_suite, cur_test, la + le + 2);
+
+    if(NULL != failure) {
+        extra = failure_extra(failure);
+        failure->payload = CTP_Strings;
+        failure->actual_len = la;
+        failure->expected_len = le;
+
+        if(NULL != actual) {
+            memcpy(extra, actual, la + 1);
+            failure->actual_str = extra;
+        }
+
+        if(NULL != expected) {
+            memcpy(extra + la + 1, expected, le + 1);
+            failure->expected_str = extra + la + 1;
+        }
+    }
+}
+
+// Record a failed integer comparison, only the raw values are kept
+void fail_int(uint64_t a, uint64_t e, const char* message, int copy, const char* file, const int line) {
+    CTest_FailureRecord* failure;
+
+    ++summary.asserts_failed;
+    failure = append_failure(CUF_AssertFailed, line, message, copy, file, cur_suite, cur_test, 0);
+
+    if(NULL != failure) {
+        failure->payload = CTP_Integers;
+        failure->actual = a;
+        failure->expected = e;
+    }
+}
+
+// Compare strings
+void CTestStrings(const char* actual, // Actual string
+                  const char* expected, // Expected string
+                  const char* message, // Message
+                  const char* file, const int line
+                 ) {
+    assert(NULL != cur_suite);
+    assert(NULL != cur_test);
+
+    ++summary.asserts;
+
+    if((NULL == actual) || (NULL == expected) || (0 != strcmp(actual, expected))) {
+        fail_strings(actual, expected, message, CTEST_COPY_MESSAGE | CTEST_COPY_FILE, file, line);
+    }
+}
+
+// Compare integers
+void CTestInt(uint64_t a, uint64_t e, const char* message, const char* file, const int line) {
+    assert(NULL != cur_suite);
+    assert(NULL != cur_test);
+
+    ++summary.asserts;
+
+    if(a != e) {
+        fail_int(a, e, message, CTEST_COPY_MESSAGE | CTEST_COPY_FILE, file, line);
+    }
+}
+
+void CTest_fail_strings(const char* actual, const char* expected, const char* expression, const char* file, const int line) {
+    assert(NULL != cur_suite);
+    assert(NULL != cur_test);
+
+    ++summary.asserts;
+    fail_strings(actual, expected, expression, 0, file, line);
+}
+
+void CTest_fail_int(uint64_t a, uint64_t e, const char* expression, const char* file, const int line) {
+    assert(NULL != cur_suite);
+    assert(NULL != cur_test);
+
+    ++summary.asserts;
+    fail_int(a, e, expression, 0, file, line);
+}
+
+// == Latency histograms ==
+// Bucket index of value v: octave o = max(0, msb(v) - CTEST_HISTOGRAM_BITS), index = (o << BITS) + (v >> o).
+// Octave 0 holds the exact values below 2^(BITS + 1), every further octave 2^BITS buckets.
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HISTOGRAM_ADD(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#else
+#define HISTOGRAM_ADD(p, v) (*(p) += (v))
+#endif
+
+// Percentiles of the tables, exports and --histograms
+static const double histogram_percents[] = {50.0, 90.0, 99.0, 99.9, 99.99};
+#define CTEST_HISTOGRAM_PERCENTS (sizeof(histogram_percents) / sizeof(histogram_percents[0]))
+
+// Histogram kept by CTest_histogram_export()
+typedef struct CTestHistogramExport {
+    const CTestSuite* suite;
+    const CTestCase* test;
+    char*           name;
+    uint64_t        count, min, max;
+    double          mean;
+    uint64_t        values[CTEST_HISTOGRAM_PERCENTS];
+} CTestHistogramExport;
+
+CTestHistogramExport* histogram_exports = NULL;
+unsigned int histogram_export_count = 0;
+
+unsigned int histogram_index(uint64_t value) {
+    unsigned int msb;
+
+#if defined(__GNUC__) || defined(__clang__)
+    msb = 63 - (unsigned int)__builtin_clzll(value | 1);
+#else
+    for(msb = 63; 0 == (value >> msb) && 0 != msb; msb--) {
+    }
+#endif
+    msb = (msb > CTEST_HISTOGRAM_BITS) ? msb - CTEST_HISTOGRAM_BITS : 0;
+    return (msb << CTEST_HISTOGRAM_BITS) + (unsigned int)(value >> msb);
+}
+
+// Largest value of bucket index
+uint64_t histogram_upper(unsigned int index) {
+    unsigned int octave = index >> CTEST_HISTOGRAM_BITS;
+
+    if(octave <= 1) {
+        return index;
+    }
+
+    octave--;
+    return ((uint64_t)(index - (octave << CTEST_HISTOGRAM_BITS)) << octave) + (((uint64_t)1 << octave) - 1);
+}
+
+CTestHistogram* CTest_histogram_new(const char* name) {
+    size_t len = (NULL != name) ? strlen(name) + 1 : 1;
+    CTestHistogram* h = (CTestHistogram*)malloc(sizeof(CTestHistogram) + len);
+
+    if(NULL == h) {
+        error("Memory allocation failed");
+    }
+
+    h->name = (char*)(h + 1);
+    memcpy(h->name, (NULL != name) ? name : "", len);
+    CTest_histogram_reset(h);
+    return h;
+}
+
+void CTest_histogram_free(CTestHistogram* h) {
+    free(h);
+}
+
+void CTest_histogram_reset(CTestHistogram* h) {
+    memset(h->counts, 0, sizeof(h->counts));
+    h->count = h->sum = h->max = 0;
+    h->min = UINT64_MAX;
+}
+
+void CTest_histogram_record(CTestHistogram* h, uint64_t value) {
+    HISTOGRAM_ADD(&h->counts[histogram_index(value)], 1);
+    HISTOGRAM_ADD(&h->count, 1);
+    HISTOGRAM_ADD(&h->sum, value);
+
+#if defined(__GNUC__) || defined(__clang__)
+    {
+        uint64_t seen = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+
+        while(value < seen && !__atomic_compare_exchange_n(&h->min, &seen, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+
+        seen = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+        while(value > seen && !__atomic_compare_exchange_n(&h->max, &seen, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+#else
+    h->min = (value < h->min) ? value : h->min;
+    h->max = (value > h->max) ? value : h->max;
+#endif
+}
+
+void CTest_histogram_merge(CTestHistogram* to, const CTestHistogram* from) {
+    unsigned int i;
+
+    for(i = 0; i < CTEST_HISTOGRAM_BUCKETS; i++) {
+        to->counts[i] += from->counts[i];
+    }
+
+    to->count += from->count;
+    to->sum += from->sum;
+    to->min = (from->min < to->min) ? from->min : to->min;
+    to->max = (from->max > to->max) ? from->max : to->max;
+}
+
+uint64_t CTest_histogram_percentile(const CTestHistogram* h, double percent) {
+    uint64_t target, seen = 0;
+    double rank = percent / 100.0 * (double)h->count;
+    unsigned int i;
+
+    if(0 == h->count) {
+        return 0;
+    }
+
+    // Rank rounded up in integers, the library does not need libm
+    if(rank >= (double)h->count) {
+        target = h->count;
+    } else if(rank <= 1.0) {
+        target = 1;
+    } else {
+        target = (uint64_t)rank;
+        target += (rank > (double)target);
+    }
+
+    for(i = 0; i < CTEST_HISTOGRAM_BUCKETS; i++) {
+        seen += h->counts[i];
+
+        if(seen >= target) {
+            return (histogram_upper(i) < h->max) ? histogram_upper(i) : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+char* CTest_histogram_table(const CTestHistogram* h) {
+    char* table;
+    char* line;
+    unsigned int i;
+
+    if(0 == h->count) {
+        return CT_asprintf("%s: no values", h->name);
+    }
+
+    table = CT_asprintf("%s: %llu values, min %llu, mean %.1f, max %llu ns", h->name, (unsigned long long)h->count,
+                        (unsigned long long)h->min, (double)h->sum / (double)h->count, (unsigned long long)h->max);
+
+    for(i = 0; i < CTEST_HISTOGRAM_PERCENTS; i++) {
+        line = CT_asprintf("%s\n    p%-6g %12llu ns", table, histogram_percents[i],
+                           (unsigned long long)CTest_histogram_percentile(h, histogram_percents[i]));
+        free(table);
+        table = line;
+    }
+
+    return table;
+}
+
+void CTest_histogram_export(const CTestHistogram* h) {
+    CTestHistogramExport* item;
+    unsigned int i;
+
+    REPORT_LOCK();
+    histogram_exports = (CTestHistogramExport*)grow_array(histogram_exports, histogram_export_count + 1, sizeof(CTestHistogramExport));
+    item = &histogram_exports[histogram_export_count++];
+    item->suite = cur_suite;
+    item->test = cur_test;
+    item->name = CT_asprintf("%s", h->name);
+    item->count = h->count;
+    item->min = (0 != h->count) ? h->min : 0;
+    item->max = h->max;
+    item->mean = (0 != h->count) ? (double)h->sum / (double)h->count : 0.0;
+
+    for(i = 0; i < CTEST_HISTOGRAM_PERCENTS; i++) {
+        item->values[i] = CTest_histogram_percentile(h, histogram_percents[i]);
+    }
+
+    REPORT_UNLOCK();
+}
+
+void CTestPercentile(const CTestHistogram* h, double percent, uint64_t limit, const char* message, const char* file, const int line) {
+    char* table = CTest_histogram_table(h);
+    char* msg = CT_asprintf("%s p%g = %llu ns, limit %llu ns\n    %s", message, percent,
+                            (unsigned long long)CTest_histogram_percentile(h, percent), (unsigned long long)limit, table);
+
+    assert(NULL != cur_suite);
+    assert(NULL != cur_test);
+
+    ++summary.asserts;
+    ++summary.asserts_failed;
+    add_failure(&failure_list, CUF_AssertFailed, line, msg, file, cur_suite, cur_test);
+    free(msg);
+    free(table);
+}
+
+void histogram_clear() {
+    unsigned int i;
+
+    for(i = 0; i < histogram_export_count; i++) {
+        free(histogram_exports[i].name);
+    }
+
+    free(histogram_exports);
+    histogram_exports = NULL;
+    histogram_export_count = 0;
+}
+
+// "suite<TAB>test<TAB>histogram<TAB>count<TAB>min<TAB>mean<TAB>p50 ... p99.99<TAB>max" lines
+void histogram_save() {
+    FILE* f;
+    unsigned int i, k;
+
+    if(NULL == options.histograms || 0 == histogram_export_count) {
+        return;
+    }
+
+    f = fopen(options.histograms, "w");
+
+    if(NULL == f) {
+        xprintf("\nWARNING - Cannot write %s", options.histograms);
+        return;
+    }
+
+    for(i = 0; i < histogram_export_count; i++) {
+        const CTestHistogramExport* item = &histogram_exports[i];
+
+        fprintf(f, "%s\t%s\t%s\t%llu\t%llu\t%.1f", (NULL != item->suite) ? item->suite->name : "",
+                (NULL != item->test) ? item->test->name : "", item->name, (unsigned long long)item->count,
+                (unsigned long long)item->min, item->mean);
+
+        for(k = 0; k < CTEST_HISTOGRAM_PERCENTS; k++) {
+            fprintf(f, "\t%llu", (unsigned long long)item->values[k]);
+        }
+
+        fprintf(f, "\t%llu\n", (unsigned long long)item->max);
+    }
+
+    fclose(f);
+}
+
+// Percentiles of the exported histograms in the run results
+char* histogram_section(char* report) {
+    char* line;
+    unsigned int i, k;
+
+    line = CT_asprintf("%s\n\nLatency histograms (ns):\n  %10s %10s", (NULL != report) ? report : "", "count", "mean");
+    free(report);
+    report = line;
+
+    for(k = 0; k < CTEST_HISTOGRAM_PERCENTS; k++) {
+        char title[16];
+
+        snprintf(title, sizeof(title), "p%g", histogram_percents[k]);
+        line = CT_asprintf("%s %10s", report, title);
+        free(report);
+        report = line;
+    }
+
+    line = CT_asprintf("%s %10s", report, "max");
+    free(report);
+    report = line;
+
+    for(i = 0; i < histogram_export_count; i++) {
+        const CTestHistogramExport* item = &histogram_exports[i];
+
+        line = CT_asprintf("%s\n  %10llu %10.1f", report, (unsigned long long)item->count, item->mean);
+        free(report);
+        report = line;
+
+        for(k = 0; k < CTEST_HISTOGRAM_PERCENTS; k++) {
+            line = CT_asprintf("%s %10llu", report, (unsigned long long)item->values[k]);
+            free(report);
+            report = line;
+        }
+
+        line = CT_asprintf("%s %10llu  %s/%s/%s", report, (unsigned long long)item->max, (NULL != item->suite) ? item->suite->name : "",
+                           (NULL != item->test) ? item->test->name : "", item->name);
+        free(report);
+        report = line;
+    }
+
+    return report;
+}
+
+// == Compare files ==
+// Input parameters:
+//   filename_actual - actual file
+//   filename_expected - file standard to verify
+// Return:
+//   error message or NULL - OK
+char* compare_files(char* filename_actual, char* filename_expected) {
+    FILE* a = fopen(filename_actual, "r");
+
+    if(!a) {
+        return CT_asprintf("File \"%s\" not found!\n", filename_actual);
+    }
+
+    FILE* b = fopen(filename_expected, "r");
+
+    if(!b) {
+        return CT_asprintf("File \"%s\" not found!\n", filename_expected);
+    }
+
+    int pos = 0;
+    char ca, ce;
+
+    while(!feof(a) && !feof(b)) {
+        ca = fgetc(a);
+        ce = fgetc(b);
+        pos++;
+
+        if(feof(a) || feof(b)) {
+            break;
+        }
+
+        if(ca != ce) {
+            fclose(a);
+            fclose(b);
+            return CT_asprintf("\"%s\" \"%s\" diff pos %d '%c'!='%c'\n", filename_actual, filename_expected, pos, ca, ce);
+        }
+    }
+
+    if(feof(a) && !feof(b)) {
+        fclose(a);
+        fclose(b);
+        return CT_asprintf("size(\"%s\") < size(\"%s\")\n", filename_actual, filename_expected);
+    }
+
+    if(!feof(a) && feof(b)) {
+        fclose(a);
+        fclose(b);
+        return CT_asprintf("size(\"%s\") > size(\"%s\")\n", filename_actual, filename_expected);
+    }
+
+    fclose(a);
+    fclose(b);
+    return NULL;
+}
+
+// == Files compare ==
+// Input parameters:
+//   filename_actual - file with the results of processing
+//   filename_expected - expected file
+//   uiLine - program line with ASSERT
+//   message - condition description
+//   strFile - sorce file name
+//   bFatal - stop testings if this test fails
+void CTestFiles(char* filename_actual, char* filename_expected, const char* message, const char* file, const int line) {
+    assert(NULL != cur_suite);
+    assert(NULL != cur_test);
+
+    ++summary.asserts;
+
+    // Run file comparison
+    char* error = compare_files(filename_actual, filename_expected);
+
+    if(NULL != error) {
+        ++summary.asserts_failed;
+
+        // Prepair error message
+        char* msg = CT_asprintf("%s %s", message, error);
+        add_failure(&failure_list, CUF_AssertFailed, line, msg, file, cur_suite, cur_test);
+        free(msg);
+        free(error);
+    }
+}
+
+void CTestFilesFatal(char* filename_actual, char* filename_expected, const char* message, const char* file, const int line) {
+    assert(NULL != cur_suite);
+    assert(NULL != cur_test);
+
+    ++summary.asserts;
+
+    // Run file comparison
+    char* error = compare_files(filename_actual, filename_expected);
+
+    if(NULL != error) {
+        ++summary.asserts_failed;
+
+        // Prepair error message
+        char* msg = CT_asprintf("%s %s", message, error);
+        add_failure(&failure_list, CUF_AssertFailed, line, msg, file, cur_suite, cur_test);
+        free(msg);
+        free(error);
+
+        if(NULL != cur_test->jumpBuf) {
+            longjmp(*(cur_test->jumpBuf), 1);
+        }
+    }
+}
+
+double get_elapsed_time(void) {
+    if(test_is_running) {
+        return ((double)clock() - (double)start_time) / (double)CLOCKS_PER_SEC;
+    } else {
+        return summary.elapsed_time;
+    }
+}
+
+// Pointer to the currently running suite
+CTestSuite* running_suite = NULL;
+
+/** Handler function called at completion of each test.
+ *  @param test   The test being run.
+ *  @param suite  The suite containing the test.
+ *  @param pFailure Pointer to the 1st failure record for this test.
+ */
+void basic_test_complete_message_handler(const CTestCase* test, const CTestSuite* suite, CTest_FailureRecord* pFailureList) {
+    CTest_FailureRecord* failure = pFailureList;
+    int i;
+#ifdef WIN32
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+#endif
+
+    assert(NULL != suite);
+    assert(NULL != test);
+
+    if(NULL == failure) {
+#ifdef WIN32
+        // Save attributes
+        GetConsoleScreenBufferInfo(hConsole, &csbi);
+        SetConsoleTextAttribute(hConsole, 10);
+#endif
+        xprintf("OK");
+#ifdef WIN32
+        SetConsoleTextAttribute(hConsole, csbi.wAttributes);
+#endif
+    } else {
+#ifdef WIN32
+        // Save attributes
+        GetConsoleScreenBufferInfo(hConsole, &csbi);
+        SetConsoleTextAttribute(hConsole, 12);
+#endif
+        xprintf("FAIL");
+#ifdef WIN32
+        SetConsoleTextAttribute(hConsole, csbi.wAttributes);
+#endif
+
+        for(i = 1 ; (NULL != failure) ; failure = failure->next, i++) {
+            // Failure text is formatted only here, when it is printed
+            char* text = CTest_format_failure(failure);
+
+            if(failure->row >= 0) {
+                // Case name is derived from the row index only when it is reported
+                xprintf("\n    %d. %s[%ld] %s:%u  - %s", i,
+                        test->name,
+                        failure->row,
+                        (NULL != failure->file) ? failure->file : "",
+                        failure->line,
+                        text);
+            } else {
+                xprintf("\n    %d. %s:%u  - %s", i,
+                        (NULL != failure->file) ? failure->file : "",
+                        failure->line,
+                        text);
+            }
+
+            free(text);
+        }
+    }
+}
+
+// == Property-based testing ==
+
+uint64_t CTest_random_next(CTestRandom* rnd) {
+    uint64_t z = (rnd->state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+uint64_t CTest_random_below(CTestRandom* rnd, uint64_t bound) {
+    if(0 == bound) {
+        return CTest_random_next(rnd);
+    }
+
+    return CTest_random_next(rnd) % bound;
+}
+
+// Seed of a single property case, printed on failure and accepted by --replay
+uint64_t property_case_seed(uint64_t base, unsigned long iteration) {
+    CTestRandom rnd;
+    rnd.state = base ^ ((uint64_t)iteration * 0xD1B54A32D192ED03ULL);
+    return CTest_random_next(&rnd);
+}
+
+void CTest_gen_int_generate(const CTestGen* gen, CTestRandom* rnd, CTestValue* value) {
+    uint64_t span = (uint64_t)gen->max - (uint64_t)gen->min + 1;
+
+    // Boundaries are far more interesting than their probability suggests
+    switch(CTest_random_below(rnd, 16)) {
+    case 0:
+        value->i = gen->min;
+        break;
+
+    case 1:
+        value->i = gen->max;
+        break;
+
+    default:
+        value->i = (int64_t)((uint64_t)gen->min + CTest_random_below(rnd, span));
+        break;
+    }
+
+    value->size = 0;
+}
+
+// Candidates move value towards 0 (or the range boundary closest to 0)
+int CTest_gen_int_shrink(const CTestGen* gen, const CTestValue* value, unsigned int step, CTestValue* candidate) {
+    int64_t target = 0;
+    uint64_t delta;
+
+    if(target < gen->min) {
+        target = gen->min;
+    } else if(target > gen->max) {
+        target = gen->max;
+    }
+
+    if(value->i == target || step >= 64) {
+        return 0;
+    }
+
+    // Distance in uint64_t, it does not fit int64_t for ranges from INT64_MIN
+    delta = (value->i > target) ? ((uint64_t)value->i - (uint64_t)target) : ((uint64_t)target - (uint64_t)value->i);
+    delta >>= step;
+
+    if(0 == delta) {
+        return 0;
+    }
+
+    candidate->i = (int64_t)((value->i > target) ? ((uint64_t)value->i - delta) : ((uint64_t)value->i + delta));
+    candidate->size = 0;
+    return 1;
+}
+
+char* CTest_gen_int_print(const CTestGen* gen, const CTestValue* value) {
+    (void)gen;
+    return CT_asprintf("%lld", (long long)value->i);
+}
+
+void CTest_gen_bytes_generate(const CTestGen* gen, CTestRandom* rnd, CTestValue* value) {
+    size_t i;
+    uint64_t span = (uint64_t)(gen->max - gen->min + 1);
+
+    value->size = (size_t)CTest_random_below(rnd, (uint64_t)gen->max_size + 1);
+
+    for(i = 0; i < value->size; i++) {
+        value->data[i] = (unsigned char)(gen->min + (int64_t)CTest_random_below(rnd, span));
+    }
+
+    value->data[value->size] = '\0';
+    value->i = 0;
+}
+
+void CTest_gen_string_generate(const CTestGen* gen, CTestRandom* rnd, CTestValue* value) {
+    CTest_gen_bytes_generate(gen, rnd, value);
+}
+
+// Candidates: empty, either half, without one byte, one byte set to minimum
+int CTest_gen_bytes_shrink(const CTestGen* gen, const CTestValue* value, unsigned int step, CTestValue* candidate) {
+    size_t n = value->size;
+    size_t half = n / 2;
+    size_t pos;
+
+    candidate->i = 0;
+
+    if(0 == n) {
+        return 0;
+    }
+
+    if(0 == step || (step < 3 && n < 2)) {
+        candidate->size = 0; // Halves of a single byte are the empty candidate again
+    } else if(1 == step) {
+        memcpy(candidate->data, value->data, half);
+        candidate->size = half;
+    } else if(2 == step) {
+        memcpy(candidate->data, value->data + half, n - half);
+        candidate->size = n - half;
+    } else if(step < 3 + n) {
+        pos = step - 3;
+        memcpy(candidate->data, value->data, pos);
+        memcpy(candidate->data + pos, value->data + pos + 1, n - pos - 1);
+        candidate->size = n - 1;
+    } else if(step < 3 + 2 * n) {
+        pos = step - 3 - n;
+
+        if(value->data[pos] == (unsigned char)gen->min) {
+            candidate->size = 0; // Nothing to simplify, repeat the empty candidate
+        } else {
+            memcpy(candidate->data, value->data, n);
+            candidate->data[pos] = (unsigned char)gen->min;
+            candidate->size = n;
+        }
+    } else {
+        return 0;
+    }
+
+    candidate->data[candidate->size] = '\0';
+    return 1;
+}
+
+char* CTest_gen_bytes_print(const CTestGen* gen, const CTestValue* value) {
+    size_t i;
+    size_t shown = (value->size > 64) ? 64 : value->size;
+    char* buf = malloc(shown * 3 + 32);
+    char* p = buf;
+
+    (void)gen;
+
+    p += sprintf(p, "[%lu]", (unsigned long)value->size);
+
+    for(i = 0; i < shown; i++) {
+        p += sprintf(p, " %02x", value->data[i]);
+    }
+
+    if(shown < value->size) {
+        strcpy(p, " ...");
+    }
+
+    return buf;
+}
+
+char* CTest_gen_string_print(const CTestGen* gen, const CTestValue* value) {
+    (void)gen;
+    return CT_asprintf("\"%s\"", (const char*)value->data);
+}
+
+void property_value_init(CTestValue* value, const CTestGen* gen) {
+    value->i = 0;
+    value->size = 0;
+    value->data = (unsigned char*)malloc(gen->max_size + 1);
+
+    if(NULL == value->data) {
+        error("Memory allocation failed");
+    }
+
+    value->data[0] = '\0';
+}
+
+// Evaluate the check of a property. On the thread of the test a fatal assertion in the check
+// returns here and fails the case; --threads workers have no test (checks must not assert there).
+int property_holds(const CTestProperty* prop, const CTestValue* value) {
+    CTestCase* test = cur_test;
+    jmp_buf* saved;
+    jmp_buf buf;
+    volatile int holds = 0;
+
+    if(NULL == test) {
+        return prop->check(value);
+    }
+
+    saved = test->jumpBuf;
+    test->jumpBuf = &buf;
+
+    if(0 == setjmp(buf)) {
+        holds = prop->check(value);
+    }
+
+    test->jumpBuf = saved;
+    return holds;
+}
+
+// Minimize a failing value, returns the number of accepted shrink steps
+unsigned int property_shrink(const CTestProperty* prop, CTestValue* value) {
+    CTestValue candidate, tmp;
+    unsigned int step = 0;
+    unsigned int accepted = 0;
+    unsigned int attempts = 0;
+
+    if(NULL == prop->gen->shrink) {
+        return 0;
+    }
+
+    property_value_init(&candidate, prop->gen);
+
+    while(attempts++ < 100000 && prop->gen->shrink(prop->gen, value, step, &candidate)) {
+        if(!property_holds(prop, &candidate)) {
+            // Simpler counterexample found - continue from it
+            tmp = *value;
+            *value = candidate;
+            candidate = tmp;
+            step = 0;
+            accepted++;
+        } else {
+            step++;
+        }
+    }
+
+    free(candidate.data);
+    return accepted;
+}
+
+// Shared state of the workers checking one property
+typedef struct CTestPropertyRun {
+    const CTestProperty* prop;
+    uint64_t        seed;           // Base seed
+    unsigned long   iterations;
+    unsigned long   next;           // Next iteration to take
+    unsigned long   failed;         // Smallest failed iteration, iterations if none
+#ifndef WIN32
+    pthread_mutex_t lock;
+#endif
+} CTestPropertyRun;
+
+#define PROPERTY_CHUNK 64
+
+void* property_worker(void* arg) {
+    CTestPropertyRun* run = (CTestPropertyRun*)arg;
+    const CTestGen* gen = run->prop->gen;
+    CTestValue value;
+    CTestRandom rnd;
+    unsigned long i, first, last;
+
+    property_value_init(&value, gen);
+
+    for(;;) {
+#ifndef WIN32
+        first = __atomic_fetch_add(&run->next, PROPERTY_CHUNK, __ATOMIC_RELAXED);
+
+        if(first >= run->iterations || first >= __atomic_load_n(&run->failed, __ATOMIC_RELAXED)) {
+            break;
+        }
+
+#else
+        first = run->next;
+        run->next += PROPERTY_CHUNK;
+
+        if(first >= run->iterations || first >= run->failed) {
+            break;
+        }
+
+#endif
+        last = first + PROPERTY_CHUNK;
+
+        if(last > run->iterations) {
+            last = run->iterations;
+        }
+
+        for(i = first; i < last; i++) {
+            rnd.state = property_case_seed(run->seed, i);
+            gen->generate(gen, &rnd, &value);
+
+            if(!property_holds(run->prop, &value)) {
+#ifndef WIN32
+                pthread_mutex_lock(&run->lock);
+#endif
+
+                if(i < run->failed) {
+#ifndef WIN32
+                    __atomic_store_n(&run->failed, i, __ATOMIC_RELAXED);
+#else
+                    run->failed = i;
+#endif
+                }
+
+#ifndef WIN32
+                pthread_mutex_unlock(&run->lock);
+#endif
+                break;
+            }
+        }
+    }
+
+    free(value.data);
+    return NULL;
+}
+
+// Check a property for the configured number of iterations, shrink and report the first counterexample
+void run_property(CTestCase* test) {
+    CTestProperty* prop = test->property;
+    const CTestGen* gen = prop->gen;
+    CTestPropertyRun run;
+    CTestValue value;
+    CTestRandom rnd;
+    uint64_t case_seed;
+    unsigned int shrinks;
+    char* shown;
+    char* msg;
+
+    run.prop = prop;
+    run.seed = options.seed;
+    run.iterations = (0 != prop->iterations) ? prop->iterations : options.iterations;
+    run.next = 0;
+    run.failed = run.iterations;
+
+    if(options.replay_set) {
+        // Replay exactly one case
+        rnd.state = options.replay;
+        case_seed = options.replay;
+        property_value_init(&value, gen);
+        gen->generate(gen, &rnd, &value);
+        run.iterations = 1;
+        run.failed = property_holds(prop, &value) ? 1 : 0;
+        free(value.data);
+    } else {
+#ifndef WIN32
+        unsigned int i;
+        unsigned int threads = (options.threads > 0) ? options.threads : 1;
+        pthread_t* workers = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+
+        pthread_mutex_init(&run.lock, NULL);
+
+        // The calling thread is worker number 0
+        for(i = 1; i < threads; i++) {
+            if(0 != pthread_create(&workers[i], NULL, property_worker, &run)) {
+                threads = i;
+                break;
+            }
+        }
+
+        property_worker(&run);
+
+        for(i = 1; i < threads; i++) {
+            pthread_join(workers[i], NULL);
+        }
+
+        pthread_mutex_destroy(&run.lock);
+        free(workers);
+#else
+        property_worker(&run);
+#endif
+        case_seed = property_case_seed(run.seed, run.failed);
+    }
+
+    ++summary.asserts;
+
+    if(run.failed >= run.iterations) {
+        return;
+    }
+
+    // Regenerate the counterexample from its seed and minimize it
+    rnd.state = case_seed;
+    property_value_init(&value, gen);
+    gen->generate(gen, &rnd, &value);
+    shrinks = property_shrink(prop, &value);
+
+    shown = gen->print(gen, &value);
+    msg = CT_asprintf("Property failed on iteration %lu after %u shrinks: %s\n seed=0x%016llx (replay: --replay=0x%016llx)",
+                      options.replay_set ? 0 : run.failed, shrinks, shown,
+                      (unsigned long long)case_seed, (unsigned long long)case_seed);
+
+    ++summary.asserts_failed;
+    add_failure(&failure_list, CUF_AssertFailed, prop->line, msg, prop->file, cur_suite, test);
+
+    free(msg);
+    free(shown);
+    free(value.data);
+}
+
+// == Fuzzing ==
+
+// Edge coverage collected by -fsanitize-coverage=trace-pc-guard instrumentation.
+// CTest.c itself must be compiled without the instrumentation.
+#define CTEST_COV_SIZE (1 << 16)
+
+unsigned char cov_counters[CTEST_COV_SIZE]; // Hits of the current input
+unsigned char cov_seen[CTEST_COV_SIZE];     // Hit buckets seen so far
+uint32_t cov_guards = 0;                    // Number of instrumented edges
+
+void __sanitizer_cov_trace_pc_guard_init(uint32_t* start, uint32_t* stop) {
+    uint32_t* guard;
+
+    if(start == stop || 0 != *start) {
+        return; // Module is already initialized
+    }
+
+    for(guard = start; guard < stop; guard++) {
+        *guard = ++cov_guards;
+    }
+}
+
+void __sanitizer_cov_trace_pc_guard(uint32_t* guard) {
+    cov_counters[*guard & (CTEST_COV_SIZE - 1)]++;
+}
+
+// Coarse hit count classes, so loops do not flood the corpus
+unsigned char cov_bucket(unsigned char hits) {
+    if(hits <= 2) {
+        return hits;
+    } else if(hits == 3) {
+        return 4;
+    } else if(hits <= 7) {
+        return 8;
+    } else if(hits <= 15) {
+        return 16;
+    } else if(hits <= 31) {
+        return 32;
+    } else if(hits <= 127) {
+        return 64;
+    }
+
+    return 128;
+}
+
+// Merge hits of the last input into the seen map, return the number of new edges/buckets
+size_t cov_merge(void) {
+    size_t i;
+    size_t found = 0;
+    size_t n = (cov_guards + 1 < CTEST_COV_SIZE) ? cov_guards + 1 : CTEST_COV_SIZE;
+    unsigned char bucket;
+
+    for(i = 0; i < n; i++) {
+        if(0 != cov_counters[i]) {
+            bucket = cov_bucket(cov_counters[i]);
+
+            if((cov_seen[i] | bucket) != cov_seen[i]) {
+                cov_seen[i] |= bucket;
+                found++;
+            }
+
+            cov_counters[i] = 0;
+        }
+    }
+
+    return found;
+}
+
+// FNV-1a, names saved inputs
+uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* p = (const unsigned char*)data;
+    size_t i;
+
+    for(i = 0; i < size; i++) {
+        hash = (hash ^ p[i]) * 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+#define CTEST_HASH_INIT 0xCBF29CE484222325ULL
+
+typedef struct CTestFuzzInput {
+    unsigned char*  data;
+    size_t          size;
+    char*           path;           // File the input was loaded from, NULL if generated
+} CTestFuzzInput;
+
+typedef struct CTestCorpus {
+    CTestFuzzInput* inputs;
+    size_t          count;
+    size_t          capacity;
+    char*           dir;            // Directory of the target corpus
+} CTestCorpus;
+
+void corpus_add(CTestCorpus* corpus, const unsigned char* data, size_t size) {
+    CTestFuzzInput* input;
+
+    if(corpus->count == corpus->capacity) {
+        corpus->capacity = (0 == corpus->capacity) ? 64 : corpus->capacity * 2;
+        corpus->inputs = (CTestFuzzInput*)realloc(corpus->inputs, corpus->capacity * sizeof(CTestFuzzInput));
+
+        if(NULL == corpus->inputs) {
+            error("Memory allocation failed");
+        }
+    }
+
+    input = &corpus->inputs[corpus->count++];
+    input->data = (unsigned char*)malloc(size + 1);
+
+    if(NULL == input->data) {
+        error("Memory allocation failed");
+    }
+
+    memcpy(input->data, data, size);
+    input->size = size;
+    input->path = NULL;
+}
+
+void corpus_free(CTestCorpus* corpus) {
+    size_t i;
+
+    for(i = 0; i < corpus->count; i++) {
+        free(corpus->inputs[i].data);
+        free(corpus->inputs[i].path);
+    }
+
+    free(corpus->inputs);
+    free(corpus->dir);
+}
+
+// Input and directory of the running fuzz target, used by the crash handler
+const unsigned char* volatile fuzz_data = NULL;
+volatile size_t fuzz_size = 0;
+const char* volatile fuzz_dir = NULL;
+
+// Write input to dir/<prefix><hash>, return the path (caller must call free) or NULL
+char* fuzz_save_input(const char* dir, const char* prefix, const unsigned char* data, size_t size) {
+    char* path = CT_asprintf("%s/%s%016llx", dir, prefix, (unsigned long long)hash_bytes(CTEST_HASH_INIT, data, size));
+    FILE* f = fopen(path, "wb");
+
+    if(NULL == f) {
+        free(path);
+        return NULL;
+    }
+
+    fwrite(data, 1, size, f);
+    fclose(f);
+    return path;
+}
+
+#ifndef WIN32
+// Only async-signal-safe calls: save the crashing input and re-raise
+void fuzz_crash_handler(int sig) {
+    static const char hex[] = "0123456789abcdef";
+    char path[4096];
+    size_t len = 0;
+    uint64_t hash;
+    int fd, i;
+
+    if(NULL != fuzz_dir && NULL != fuzz_data) {
+        hash = hash_bytes(CTEST_HASH_INIT, fuzz_data, fuzz_size);
+
+        while(fuzz_dir[len] != '\0' && len < sizeof(path) - 32) {
+            path[len] = fuzz_dir[len];
+            len++;
+        }
+
+        memcpy(path + len, "/crash-", 7);
+        len += 7;
+
+        for(i = 15; i >= 0; i--) {
+            path[len++] = hex[(hash >> (i * 4)) & 0xF];
+        }
+
+        path[len] = '\0';
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if(fd >= 0) {
+            if(write(fd, fuzz_data, fuzz_size) < 0) {
+                // Nothing more can be done in a signal handler
+            }
+
+            close(fd);
+        }
+
+        if(write(STDOUT_FILENO, "\nCRASH: input saved to ", 23) < 0 || write(STDOUT_FILENO, path, len) < 0 || write(STDOUT_FILENO, "\n", 1) < 0) {
+            // Ignore
+        }
+    }
+
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// Load every regular file of dir into corpus
+void corpus_load(CTestCorpus* corpus, size_t max_len) {
+    DIR* dir = opendir(corpus->dir);
+    struct dirent* entry;
+    unsigned char* buf = (unsigned char*)malloc(max_len + 1);
+
+    if(NULL == dir || NULL == buf) {
+        if(NULL != dir) {
+            closedir(dir);
+        }
+
+        free(buf);
+        return;
+    }
+
+    while(NULL != (entry = readdir(dir))) {
+        char* path;
+        FILE* f;
+        size_t size;
+
+        if('.' == entry->d_name[0]) {
+            continue;
+        }
+
+        path = CT_asprintf("%s/%s", corpus->dir, entry->d_name);
+        f = fopen(path, "rb");
+
+        if(NULL == f) {
+            free(path);
+            continue;
+        }
+
+        size = fread(buf, 1, max_len, f);
+        fclose(f);
+        corpus_add(corpus, buf, size);
+        corpus->inputs[corpus->count - 1].path = path;
+    }
+
+    closedir(dir);
+    free(buf);
+}
+#endif
+
+// Directory <corpus>/<suite>.<test> with unsafe characters replaced
+char* fuzz_target_dir(const CTestSuite* suite, const CTestCase* test) {
+    char* dir = CT_asprintf("%s/%s.%s", options.corpus, suite->name, test->name);
+    char* p;
+
+    for(p = dir + strlen(options.corpus) + 1; '\0' != *p; p++) {
+        if(!isalnum((unsigned char)*p) && '.' != *p && '-' != *p) {
+            *p = '_';
+        }
+    }
+
+    return dir;
+}
+
+// Run one input, return nonzero if it produced failures
+int fuzz_execute(CTestCase* test, jmp_buf* buf, const unsigned char* data, size_t size) {
+    unsigned int start_failures = summary.failure_records;
+
+    fuzz_data = data;
+    fuzz_size = size;
+
+    if(0 == setjmp(*buf)) {
+        (*test->fuzz)(data, size);
+    }
+
+    fuzz_data = NULL;
+    return summary.failure_records > start_failures;
+}
+
+// Apply 1..4 random mutations in place, data has room for max_len bytes
+size_t fuzz_mutate(CTestRandom* rnd, unsigned char* data, size_t size, size_t max_len, const CTestCorpus* corpus) {
+    static const unsigned char interesting[] = {0, 1, 0x7F, 0x80, 0xFF, 0x20, '0', 'A'};
+    unsigned int n = 1 + (unsigned int)CTest_random_below(rnd, 4);
+    size_t pos, len;
+
+    while(n--) {
+        switch(CTest_random_below(rnd, 7)) {
+        case 0: // Flip a bit
+            if(size > 0) {
+                data[CTest_random_below(rnd, size)] ^= (unsigned char)(1 << CTest_random_below(rnd, 8));
+            }
+
+            break;
+
+        case 1: // Random byte
+            if(size > 0) {
+                data[CTest_random_below(rnd, size)] = (unsigned char)CTest_random_next(rnd);
+            }
+
+            break;
+
+        case 2: // Interesting byte
+            if(size > 0) {
+                data[CTest_random_below(rnd, size)] = interesting[CTest_random_below(rnd, sizeof(interesting))];
+            }
+
+            break;
+
+        case 3: // Small arithmetic
+            if(size > 0) {
+                pos = CTest_random_below(rnd, size);
+                data[pos] = (unsigned char)(data[pos] + 1 + CTest_random_below(rnd, 16) - 8);
+            }
+
+            break;
+
+        case 4: // Insert bytes
+            if(size < max_len) {
+                pos = CTest_random_below(rnd, size + 1);
+                len = 1 + CTest_random_below(rnd, (max_len - size < 8) ? max_len - size : 8);
+                memmove(data + pos + len, data + pos, size - pos);
+
+                for(size_t i = 0; i < len; i++) {
+                    data[pos + i] = (unsigned char)CTest_random_next(rnd);
+                }
+
+                size += len;
+            }
+
+            break;
+
+        case 5: // Erase bytes
+            if(size > 0) {
+                pos = CTest_random_below(rnd, size);
+                len = 1 + CTest_random_below(rnd, size - pos);
+                memmove(data + pos, data + pos + len, size - pos - len);
+                size -= len;
+            }
+
+            break;
+
+        default: // Splice a piece of another corpus input
+            if(corpus->count > 0) {
+                const CTestFuzzInput* other = &corpus->inputs[CTest_random_below(rnd, corpus->count)];
+
+                if(other->size > 0) {
+                    size_t from = CTest_random_below(rnd, other->size);
+                    pos = CTest_random_below(rnd, size + 1);
+                    len = 1 + CTest_random_below(rnd, other->size - from);
+
+                    if(pos + len > max_len) {
+                        len = max_len - pos;
+                    }
+
+                    memcpy(data + pos, other->data + from, len);
+
+                    if(pos + len > size) {
+                        size = pos + len;
+                    }
+                }
+            }
+
+            break;
+        }
+    }
+
+    return size;
+}
+
+// Replay the corpus and, in --fuzz mode, mutate it while coverage grows
+void run_fuzz(CTestCase* test, jmp_buf* buf) {
+    CTestCorpus corpus = {NULL, 0, 0, NULL};
+    CTestRandom rnd;
+    unsigned char* input;
+    unsigned long runs = 0;
+    time_t started = time(NULL);
+    size_t i, size;
+    char* saved;
+    char* msg;
+#ifndef WIN32
+    struct sigaction action, saved_actions[5];
+    static const int signals[5] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+#endif
+
+    corpus.dir = fuzz_target_dir(cur_suite, test);
+#ifndef WIN32
+    corpus_load(&corpus, options.fuzz_max_len);
+#endif
+
+    // Regression: every saved input must pass
+    for(i = 0; i < corpus.count; i++) {
+        if(fuzz_execute(test, buf, corpus.inputs[i].data, corpus.inputs[i].size)) {
+            msg = CT_asprintf("Corpus input %s failed", corpus.inputs[i].path);
+            add_failure(&failure_list, CUF_AssertFailed, 0, msg, "CTest Fuzz", cur_suite, test);
+            free(msg);
+            corpus_free(&corpus);
+            return;
+        }
+
+        cov_merge();
+    }
+
+    if(!options.fuzz) {
+        corpus_free(&corpus);
+        return;
+    }
+
+#ifndef WIN32
+    mkdir(options.corpus, 0755);
+    mkdir(corpus.dir, 0755);
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = fuzz_crash_handler;
+
+    for(i = 0; i < 5; i++) {
+        sigaction(signals[i], &action, &saved_actions[i]);
+    }
+
+#endif
+
+    fuzz_dir = corpus.dir;
+    rnd.state = options.seed ^ hash_bytes(CTEST_HASH_INIT, test->name, strlen(test->name));
+    input = (unsigned char*)malloc(options.fuzz_max_len + 1);
+
+    if(0 == corpus.count) {
+        corpus_add(&corpus, (const unsigned char*)"", 0);
+    }
+
+    while((0 == options.fuzz_runs || runs < options.fuzz_runs) &&
+            (0 != options.fuzz_runs || (unsigned long)(time(NULL) - started) < options.fuzz_seconds)) {
+        const CTestFuzzInput* parent = &corpus.inputs[CTest_random_below(&rnd, corpus.count)];
+
+        memcpy(input, parent->data, parent->size);
+        size = fuzz_mutate(&rnd, input, parent->size, options.fuzz_max_len, &corpus);
+        runs++;
+
+        if(fuzz_execute(test, buf, input, size)) {
+            // Keep the failing input as a reproducible regression case
+            saved = fuzz_save_input(corpus.dir, "failure-", input, size);
+            msg = CT_asprintf("Fuzz input failed after %lu runs, saved to %s", runs, (NULL != saved) ? saved : "(not saved)");
+            add_failure(&failure_list, CUF_AssertFailed, 0, msg, "CTest Fuzz", cur_suite, test);
+            free(msg);
+            free(saved);
+            break;
+        }
+
+        if(cov_merge() > 0) {
+            corpus_add(&corpus, input, size);
+            free(fuzz_save_input(corpus.dir, "", input, size));
+        }
+    }
+
+    fuzz_dir = NULL;
+    free(input);
+
+#ifndef WIN32
+
+    for(i = 0; i < 5; i++) {
+        sigaction(signals[i], &saved_actions[i], NULL);
+    }
+
+#endif
+    xprintf("(%lu runs, corpus %lu) ", runs, (unsigned long)corpus.count);
+    corpus_free(&corpus);
+}
+
+// Runs every row of a table test as a separate case
+void run_table_cases(CTestCase* test, jmp_buf* buf) {
+    CTestRowFunc row_test = (CTestRowFunc)test->test;
+    const char* row = (const char*)test->rows;
+    unsigned int start_failures;
+    size_t i;
+
+    assert(NULL != row_test);
+
+    for(i = 0; i < test->row_count; i++, row += test->row_size) {
+        start_failures = summary.failure_records;
+        cur_row = (long)i;
+
+        if(0 == setjmp(*buf)) {
+            (*row_test)(row);
+        }
+
+        summary.tests_run++;
+
+        if(summary.failure_records > start_failures) {
+            summary.tests_failed++;
+        }
+    }
+
+    cur_row = -1;
+}
+
+// == Progress ==
+// --progress redraws one status line at most every 100 ms, failures are printed in full.
+// Durations are kept in options.timings between runs and estimate the remaining time.
+
+#define CTEST_PROGRESS_PERIOD_NS 100000000ULL
+
+typedef struct CTestProgress {
+    unsigned int    total;          // Tests selected for the run
+    unsigned int    done;
+    unsigned int    failed;
+    uint64_t        start_ns;
+    uint64_t        draw_ns;        // Last redraw
+    uint64_t*       history;        // Duration of each test in previous runs, 0 - unknown
+    uint64_t*       duration;       // Duration of each test in this run, NULL - progress is off
+    uint64_t        history_left;   // Previous duration of the tests not run yet
+    uint64_t        history_done;   // Previous duration of the tests run
+    unsigned int    unknown_left;   // Tests not run yet without history
+} CTestProgress;
+
+CTestProgress progress = {0, 0, 0, 0, 0, NULL, NULL, 0, 0, 0};
+
+void progress_load() {
+    FILE* f = fopen(options.timings, "r");
+    char line[4096];
+
+    if(NULL == f) {
+        return;
+    }
+
+    // "suite<TAB>test<TAB>nanoseconds" lines
+    while(NULL != fgets(line, sizeof(line), f)) {
+        char* test_name = strchr(line, '\t');
+        char* ns = (NULL != test_name) ? strchr(test_name + 1, '\t') : NULL;
+        CTestSuite* suite;
+        CTestCase* test;
+
+        if(NULL == ns) {
+            continue;
+        }
+
+        *test_name++ = '\0';
+        *ns++ = '\0';
+        suite = find_suite(line);
+        test = (NULL != suite) ? find_test(suite, test_name) : NULL;
+
+        if(NULL != test) {
+            progress.history[test->index] = (uint64_t)strtoull(ns, NULL, 10);
+        }
+    }
+
+    fclose(f);
+}
+
+void progress_save() {
+    FILE* f = fopen(options.timings, "w");
+    unsigned int i;
+
+    if(NULL == f) {
+        return;
+    }
+
+    for(i = 0; i < registry.tests; i++) {
+        uint64_t ns = (0 != progress.duration[i]) ? progress.duration[i] : progress.history[i];
+
+        if(0 != ns) {
+            fprintf(f, "%s\t%s\t%llu\n", registry.suite_handle[registry.test_suite[i]]->name, registry.test_name[i], (unsigned long long)ns);
+        }
+    }
+
+    fclose(f);
+}
+
+void progress_start() {
+    unsigned int i;
+
+    if(!options.progress) {
+        return;
+    }
+
+    progress.history = (uint64_t*)calloc(registry.tests + 1, sizeof(uint64_t));
+    progress.duration = (uint64_t*)calloc(registry.tests + 1, sizeof(uint64_t));
+
+    if(NULL == progress.history || NULL == progress.duration) {
+        error("Memory allocation failed");
+    }
+
+    progress_load();
+    progress.total = progress.done = progress.failed = 0;
+    progress.history_left = progress.history_done = 0;
+    progress.unknown_left = 0;
+
+    for(i = 0; i < registry.tests; i++) {
+        if(registry.test_active[i] && registry.test_handle[i]->active && registry.suite_handle[registry.test_suite[i]]->active) {
+            progress.total++;
+            progress.history_left += progress.history[i];
+            progress.unknown_left += (0 == progress.history[i]);
+        }
+    }
+
+    progress.start_ns = CTest_time_ns();
+    progress.draw_ns = 0;
+}
+
+void progress_draw(uint64_t now) {
+    uint64_t elapsed = now - progress.start_ns;
+    double rate = (0 != elapsed) ? (double)progress.done * 1e9 / (double)elapsed : 0.0;
+    double eta;
+    char line[128];
+
+    // Previous durations scaled by the speed of this run, the average for tests without history
+    if(0 != progress.history_done) {
+        eta = (double)progress.history_left * (double)elapsed / (double)progress.history_done;
+    } else {
+        eta = (double)progress.history_left;
+    }
+
+    if(0 != progress.done) {
+        eta += (double)progress.unknown_left * (double)elapsed / (double)progress.done;
+    }
+
+    snprintf(line, sizeof(line), "[%u/%u] %u failed | %.0f tests/s | ETA %.1fs",
+             progress.done, progress.total, progress.failed, rate, eta / 1e9);
+    // The status line is not logged to CONSOLE.TXT
+    printf("\r%-72s", line);
+    fflush(stdout);
+    progress.draw_ns = now;
+}
+
+void progress_clear() {
+    printf("\r%72s\r", "");
+}
+
+void progress_test_done(const CTestCase* test, int failed, uint64_t duration) {
+    uint64_t now = CTest_time_ns();
+
+    progress.done++;
+    progress.failed += failed;
+    progress.duration[test->index] = (0 != duration) ? duration : 1;
+
+    if(0 != progress.history[test->index]) {
+        progress.history_left -= progress.history[test->index];
+        progress.history_done += progress.history[test->index];
+    } else if(0 != progress.unknown_left) {
+        progress.unknown_left--;
+    }
+
+    if(failed || now - progress.draw_ns >= CTEST_PROGRESS_PERIOD_NS) {
+        progress_draw(now);
+    }
+}
+
+void progress_end() {
+    if(NULL == progress.duration) {
+        return;
+    }
+
+    progress_draw(CTest_time_ns());
+    printf("\n");
+    progress_save();
+
+    free(progress.history);
+    free(progress.duration);
+    progress.history = NULL;
+    progress.duration = NULL;
+}
+
+// == Fixtures ==
+// Suites may run setup/teardown around each test and hand every test an instance of
+// a pooled fixture: created on demand (once per concurrent user), reset between tests.
+
+CTestFixture* fixture_pools = NULL;     // Fixtures that own instances
+CTEST_THREAD_LOCAL void* cur_fixture = NULL; // Instance of the running test
+#ifndef WIN32
+pthread_mutex_t fixture_lock = PTHREAD_MUTEX_INITIALIZER;
+#define FIXTURE_LOCK() pthread_mutex_lock(&fixture_lock)
+#define FIXTURE_UNLOCK() pthread_mutex_unlock(&fixture_lock)
+#else
+#define FIXTURE_LOCK()
+#define FIXTURE_UNLOCK()
+#endif
+
+void* fixture_acquire(CTestFixture* fixture) {
+    void* data = NULL;
+
+    FIXTURE_LOCK();
+
+    if(!fixture->registered) {
+        fixture->registered = 1;
+        fixture->next_pool = fixture_pools;
+        fixture_pools = fixture;
+    }
+
+    if(0 != fixture->idle_count) {
+        data = fixture->idle[--fixture->idle_count];
+    }
+
+    FIXTURE_UNLOCK();
+
+    if(NULL != data) {
+        if(NULL != fixture->reset) {
+            (*fixture->reset)(data);
+            return data;
+        }
+
+        // Without reset an instance is rebuilt
+        (*fixture->destroy)(data);
+
+        FIXTURE_LOCK();
+        fixture->created--;
+        FIXTURE_UNLOCK();
+    }
+
+    data = (*fixture->create)();
+
+    if(NULL != data) {
+        FIXTURE_LOCK();
+        fixture->created++;
+        FIXTURE_UNLOCK();
+    }
+
+    return data;
+}
+
+void fixture_release(CTestFixture* fixture, void* data) {
+    FIXTURE_LOCK();
+
+    if(fixture->idle_count == fixture->idle_capacity) {
+        fixture->idle_capacity = (0 != fixture->idle_capacity) ? fixture->idle_capacity * 2 : 4;
+        fixture->idle = (void**)grow_array(fixture->idle, fixture->idle_capacity, sizeof(void*));
+    }
+
+    fixture->idle[fixture->idle_count++] = data;
+    FIXTURE_UNLOCK();
+}
+
+// Destroy the pooled instances, at registry cleanup
+void fixture_pools_free() {
+    CTestFixture* fixture;
+    CTestFixture* next;
+
+    for(fixture = fixture_pools; NULL != fixture; fixture = next) {
+        next = fixture->next_pool;
+
+        while(0 != fixture->idle_count) {
+            (*fixture->destroy)(fixture->idle[--fixture->idle_count]);
+        }
+
+        free(fixture->idle);
+        fixture->idle = NULL;
+        fixture->idle_capacity = 0;
+        fixture->created = 0;
+        fixture->registered = 0;
+        fixture->next_pool = NULL;
+    }
+
+    fixture_pools = NULL;
+}
+
+void fixture_end(CTestSuite* suite) {
+    if(NULL != suite->teardown) {
+        (*suite->teardown)();
+    }
+
+    if(NULL != cur_fixture) {
+        fixture_release(suite->fixture, cur_fixture);
+        cur_fixture = NULL;
+    }
+}
+
+// Acquire the fixture and run setup, a fatal assertion in setup jumps back to buf and skips the test.
+// Return: 0 - the test can run, -1 - the fixture or setup failed (recorded, teardown ran after setup)
+int fixture_begin(CTestSuite* suite, CTestCase* test, jmp_buf* buf) {
+    cur_fixture = NULL;
+
+    if(NULL != suite->fixture) {
+        cur_fixture = fixture_acquire(suite->fixture);
+
+        if(NULL == cur_fixture) {
+            append_failure(CUF_FixtureFailed, 0, "Fixture creation failed - Test Skipped", 0, "CTest System", suite, cur_test, 0);
+            return -1;
+        }
+    }
+
+    if(NULL != suite->setup) {
+        test->jumpBuf = buf;
+
+        if(0 != setjmp(*buf)) {
+            test->jumpBuf = NULL;
+            fixture_end(suite);
+            return -1;
+        }
+
+        (*suite->setup)();
+        test->jumpBuf = NULL;
+    }
+
+    return 0;
+}
+
+void* CTest_fixture() {
+    return cur_fixture;
+}
+
+void CTest_set_fixture(CTestSuite* suite, CTestFixture* fixture) {
+    assert(!test_is_running);
+    assert(NULL != suite);
+    assert(NULL == fixture || (NULL != fixture->create && NULL != fixture->destroy));
+
+    suite->fixture = fixture;
+}
+
+// == Shared data ==
+// Read-only data built once per run. On Linux it lives in a sealed memfd: processes forked or
+// re-executed by the runner inherit the descriptor (named by CTEST_SHARED_<name>=fd:size) and
+// map the same physical pages instead of building their own copy.
+
+CTestShared* shared_regions = NULL;
+
+#ifdef __linux__
+#define CTEST_SHARED_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
+char* shared_env_name(const char* name) {
+    char* env = CT_asprintf("CTEST_SHARED_%s", name);
+    char* c;
+
+    for(c = env; '\0' != *c; c++) {
+        if(!isalnum((unsigned char) * c)) {
+            *c = '_';
+        }
+    }
+
+    return env;
+}
+
+// memfd inherited from the parent process, -1 if there is none
+int shared_inherited(const char* env, size_t size) {
+    const char* value = getenv(env);
+    struct stat st;
+    unsigned long long fd_size;
+    int fd;
+
+    if(NULL == value || 2 != sscanf(value, "%d:%llu", &fd, &fd_size) || fd_size != size) {
+        return -1;
+    }
+
+    if(0 != fstat(fd, &st) || (size_t)st.st_size != size || CTEST_SHARED_SEALS != (fcntl(fd, F_GET_SEALS) & CTEST_SHARED_SEALS)) {
+        return -1;
+    }
+
+    return fd;
+}
+
+// Build into a new memfd and seal it. Return: fd, -1 on error
+int shared_build(const char* name, size_t size, CTestSharedBuild build, void* context) {
+    void* data;
+    int fd = memfd_create(name, MFD_ALLOW_SEALING); // Not CLOEXEC: children inherit it
+
+    if(fd < 0) {
+        return -1;
+    }
+
+    if(0 != ftruncate(fd, (off_t)size) || MAP_FAILED == (data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))) {
+        close(fd);
+        return -1;
+    }
+
+    if(0 != (*build)(data, size, context)) {
+        munmap(data, size);
+        close(fd);
+        return -1;
+    }
+
+    // F_SEAL_WRITE needs the writable mapping gone
+    munmap(data, size);
+
+    if(0 != fcntl(fd, F_ADD_SEALS, CTEST_SHARED_SEALS)) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+#endif
+
+const CTestShared* CTest_shared(const char* name, size_t size, CTestSharedBuild build, void* context) {
+    CTestShared* shared;
+    void* data = NULL;
+    int fd = -1;
+
+    assert(NULL != name);
+    assert(NULL != build);
+
+    for(shared = shared_regions; NULL != shared; shared = shared->next) {
+        if(0 == strcmp(shared->name, name)) {
+            return (shared->size == size) ? shared : NULL;
+        }
+    }
+
+    if(0 == size) {
+        return NULL;
+    }
+
+#ifdef __linux__
+    {
+        char* env = shared_env_name(name);
+
+        fd = shared_inherited(env, size);
+
+        if(fd < 0) {
+            fd = shared_build(name, size, build, context);
+
+            if(fd >= 0) {
+                char* value = CT_asprintf("%d:%llu", fd, (unsigned long long)size);
+                setenv(env, value, 1);
+                free(value);
+            }
+        }
+
+        free(env);
+
+        if(fd >= 0) {
+            data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+            if(MAP_FAILED == data) {
+                data = NULL;
+            }
+        }
+    }
+#endif
+
+    if(NULL == data) {
+        // Private copy in each process
+        data = calloc(1, size);
+
+        if(NULL == data || 0 != (*build)(data, size, context)) {
+            free(data);
+
+            if(fd >= 0) {
+                close(fd);
+            }
+
+            return NULL;
+        }
+
+        if(fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    shared = (CTestShared*)malloc(sizeof(CTestShared));
+
+    if(NULL == shared) {
+        error("Memory allocation failed");
+    }
+
+    shared->name = CT_asprintf("%s", name);
+    shared->data = data;
+    shared->size = size;
+    shared->fd = fd;
+    shared->next = shared_regions;
+    shared_regions = shared;
+
+    return shared;
+}
+
+// Unmap everything, at registry cleanup
+void shared_free() {
+    CTestShared* shared;
+    CTestShared* next;
+
+    for(shared = shared_regions; NULL != shared; shared = next) {
+        next = shared->next;
+
+#ifdef __linux__
+        if(shared->fd >= 0) {
+            char* env = shared_env_name(shared->name);
+
+            munmap((void*)shared->data, shared->size);
+            close(shared->fd);
+            unsetenv(env);
+            free(env);
+        } else
+#endif
+        {
+            free((void*)shared->data);
+        }
+
+        free((char*)shared->name);
+        free(shared);
+    }
+
+    shared_regions = NULL;
+}
+
+// TestStart / TestEnd events for --event-fd
+void emit_test_event(CTestEventType type, CTestCase* test, CTestStatus status, uint64_t asserts, uint64_t asserts_failed, uint64_t duration_ns) {
+    CTestEvent event;
+
+    emit_failures();
+
+    memset(&event, 0, sizeof(event));
+    event.type = type;
+    event.suite = cur_suite->index;
+    event.test = test->index;
+    event.suite_name = cur_suite->name;
+    event.name = test->name;
+    event.status = (uint32_t)status;
+    event.asserts = asserts;
+    event.asserts_failed = asserts_failed;
+    event.duration_ns = duration_ns;
+    emit_event(&event);
+}
+
+// == Result cache ==
+// A passed deterministic test leaves <cache_dir>/<key> holding its assertion count. The key hashes the
+// test binary, the suite/test name and the contents of the declared input files, so a later run of
+// the same binary replays the pass instead of running the test.
+
+typedef struct CTestCache {
+    int             enabled;
+    uint64_t        binary;         // Hash of the test binary
+    unsigned int    hits, misses, stored;
+} CTestCache;
+
+CTestCache cache = {0, 0, 0, 0, 0};
+
+CTestCase* CTest_set_deterministic(CTestCase* test, const char* const* inputs) {
+    assert(NULL != test);
+
+    test->flags |= CTEST_DETERMINISTIC;
+    test->inputs = inputs;
+    return test;
+}
+
+// Add the file contents to *hash. Return: 0 - OK, -1 - cannot be read (*hash unchanged)
+int hash_file(uint64_t* hash, const char* path) {
+    unsigned char data[65536];
+    size_t size;
+    FILE* f = fopen(path, "rb");
+
+    if(NULL == f) {
+        return -1;
+    }
+
+    while(0 != (size = fread(data, 1, sizeof(data), f))) {
+        *hash = hash_bytes(*hash, data, size);
+    }
+
+    fclose(f);
+    return 0;
+}
+
+void cache_start() {
+    int found = 0;
+
+    memset(&cache, 0, sizeof(cache));
+
+    if(NULL == options.cache_dir || options.no_cache) {
+        return;
+    }
+
+    cache.binary = 0xCBF29CE484222325ULL;
+#ifdef __linux__
+    found = (0 == hash_file(&cache.binary, "/proc/self/exe"));
+#endif
+
+    if(!found && NULL != options.argv) {
+        found = (0 == hash_file(&cache.binary, options.argv[0]));
+    }
+
+    if(!found) {
+        xprintf("\nWARNING - Cannot read the binary, result cache disabled.");
+        return;
+    }
+
+#ifndef WIN32
+    mkdir(options.cache_dir, 0755);
+#endif
+    cache.enabled = 1;
+}
+
+// Plain tests only; 0 - not cacheable
+uint64_t cache_key(const CTestCase* test) {
+    uint64_t key;
+    const char* const* input;
+
+    if(!cache.enabled || 0 == (test->flags & CTEST_DETERMINISTIC) || NULL == test->test || NULL != test->rows ||
+            NULL != test->property || NULL != test->fuzz || NULL != test->stress) {
+        return 0;
+    }
+
+    key = hash_bytes(cache.binary, cur_suite->name, strlen(cur_suite->name) + 1);
+    key = hash_bytes(key, test->name, strlen(test->name) + 1);
+
+    for(input = test->inputs; NULL != input && NULL != *input; input++) {
+        key = hash_bytes(key, *input, strlen(*input) + 1);
+
+        // A missing input file is part of the key as well
+        if(0 != hash_file(&key, *input)) {
+            key = hash_bytes(key, "missing", 8);
+        }
+    }
+
+    return (0 != key) ? key : 1;
+}
+
+char* cache_path(uint64_t key) {
+    return CT_asprintf("%s/%016llx", options.cache_dir, (unsigned long long)key);
+}
+
+// Replay a cached pass of the running test: 1 - replayed
+int cache_replay(uint64_t key) {
+    char* path = cache_path(key);
+    char* name = CT_asprintf("%s/%s", cur_suite->name, cur_test->name);
+    size_t size = strlen(name) + 3; // '\n', NUL and one more byte to see a longer stored name
+    char* stored = (char*)malloc(size);
+    FILE* f = fopen(path, "r");
+    unsigned long long asserts = 0;
+    int found = (NULL != f) && (NULL != stored) && (1 == fscanf(f, "%llu\t", &asserts)) && (NULL != fgets(stored, (int)size, f));
+
+    // The entry must be the one of this test, not of another with a colliding key
+    if(found) {
+        stored[strcspn(stored, "\n")] = '\0';
+        found = (0 == strcmp(stored, name));
+    }
+
+    if(NULL != f) {
+        fclose(f);
+    }
+
+    free(stored);
+    free(name);
+    free(path);
+
+    REPORT_LOCK();
+    cache.hits += found;
+    cache.misses += !found;
+    REPORT_UNLOCK();
+
+    if(found) {
+        summary.asserts += asserts;
+    }
+
+    return found;
+}
+
+void cache_store(uint64_t key, uint64_t asserts) {
+    char* path = cache_path(key);
+    FILE* f = fopen(path, "w");
+
+    if(NULL != f) {
+        fprintf(f, "%llu\t%s/%s\n", (unsigned long long)asserts, cur_suite->name, cur_test->name);
+        fclose(f);
+
+        REPORT_LOCK();
+        cache.stored++;
+        REPORT_UNLOCK();
+    }
+
+    free(path);
+}
+
+// == Run journal ==
+// --journal appends the outcome of every completed test to a memory mapped file: the protocol frames
+// of its failures, then its CTE_TestEnd. The committed length in the header moves past a test only
+// when all its frames are written, so a killed run leaves whole records. --resume loads them into
+// the summary and the failure list, skips the recorded tests and goes on appending.
+
+#define CTEST_JOURNAL_MAGIC "CTJ1"
+#define CTEST_JOURNAL_CHUNK (1024 * 1024)
+
+typedef struct CTestJournalHeader {
+    char            magic[4];
+    uint32_t        complete;       // The run has finished
+    uint32_t        suites, tests;
+    uint64_t        fingerprint;    // Hash of the suite/test names in registry order
+    uint64_t        length;         // Committed bytes, header included
+} CTestJournalHeader;
+
+typedef struct CTestJournal {
+    int             fd;
+    unsigned char*  map;
+    size_t          size;           // Mapped bytes
+    unsigned int    resumed;        // Tests loaded by --resume
+    unsigned int    recorded;       // Tests appended by this run
+} CTestJournal;
+
+CTestJournal journal = {-1, NULL, 0, 0, 0};
+
+#ifndef WIN32
+uint64_t journal_fingerprint() {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    unsigned int i;
+
+    for(i = 0; i < registry.tests; i++) {
+        const char* suite_name = registry.suite_handle[registry.test_suite[i]]->name;
+
+        hash = hash_bytes(hash, suite_name, strlen(suite_name) + 1);
+        hash = hash_bytes(hash, registry.test_name[i], strlen(registry.test_name[i]) + 1);
+    }
+
+    return hash;
+}
+
+// Extend the journal file to size bytes. Its blocks are allocated up front: a store to a sparse
+// page which the full disk cannot back raises SIGBUS. Return: 0 - OK
+int journal_reserve(size_t size) {
+#ifdef __linux__
+    int res = posix_fallocate(journal.fd, 0, (off_t)size);
+
+    if(EINVAL != res && EOPNOTSUPP != res) {
+        return (0 == res) ? 0 : -1;
+    }
+
+    // The file system does not allocate ahead
+#endif
+    return ftruncate(journal.fd, (off_t)size);
+}
+
+// (Re)map the first size bytes of the journal file, extending it.
+// Return: 0 - OK, -1 - the file cannot grow (the old mapping stays) or be mapped
+int journal_map(size_t size) {
+    void* map;
+
+    if(0 != journal_reserve(size)) {
+        return -1;
+    }
+
+    if(NULL != journal.map) {
+        munmap(journal.map, journal.size);
+        journal.map = NULL;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, journal.fd, 0);
+
+    if(MAP_FAILED == map) {
+        return -1;
+    }
+
+    journal.map = (unsigned char*)map;
+    journal.size = size;
+    return 0;
+}
+
+// Stop journaling, the file is cut to the committed records
+void journal_close() {
+    size_t length = 0;
+
+    if(NULL != journal.map) {
+        length = (size_t)((CTestJournalHeader*)journal.map)->length;
+        msync(journal.map, journal.size, MS_SYNC);
+        munmap(journal.map, journal.size);
+        journal.map = NULL;
+    }
+
+    if(journal.fd >= 0) {
+        if(0 != length && 0 != ftruncate(journal.fd, (off_t)length)) {
+            xprintf("\nWARNING - Cannot truncate journal '%s'.", options.journal);
+        }
+
+        close(journal.fd);
+        journal.fd = -1;
+    }
+}
+
+void journal_event(const CTestEvent* event, void* context) {
+    CTestReplay* replay = (CTestReplay*)context;
+
+    if(event->test >= registry.tests || event->suite >= registry.suites) {
+        return;
+    }
+
+    switch(event->type) {
+    case CTE_Failure:
+        replay_failure(event, registry.suite_handle[event->suite], registry.test_handle[event->test]);
+        replay_row(replay, event);
+        break;
+
+    case CTE_TestEnd:
+        replay_test_end(replay, event);
+        journal.resumed++;
+
+        // A suite whose selected tests are all recorded is not run again, but counted as run
+        if(registry.test_active[event->test]) {
+            registry.test_active[event->test] = 0;
+
+            if(0 == --registry.suite_active[event->suite]) {
+                summary.suites_run++;
+                suite_done(registry.suite_handle[event->suite]);
+            }
+        }
+
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Open options.journal after select_tests(): loaded with --resume, new otherwise
+void journal_start() {
+    CTestJournalHeader* header;
+    CTestReplay replay = {0, -1};
+    CTestDecoder decoder;
+    struct stat st;
+    uint64_t fingerprint;
+    int fresh = 1;
+
+    journal.resumed = journal.recorded = 0;
+
+    if(NULL == options.journal) {
+        return;
+    }
+
+    journal.fd = open(options.journal, O_RDWR | O_CREAT, 0644);
+
+    if(journal.fd < 0 || 0 != fstat(journal.fd, &st) ||
+            0 != journal_map(((size_t)st.st_size / CTEST_JOURNAL_CHUNK + 1) * CTEST_JOURNAL_CHUNK)) {
+        xprintf("\nWARNING - Cannot open journal '%s', the run is not recorded.", options.journal);
+        journal_close();
+        return;
+    }
+
+    header = (CTestJournalHeader*)journal.map;
+    fingerprint = journal_fingerprint();
+
+    if(options.resume && (size_t)st.st_size >= sizeof(CTestJournalHeader) && 0 == memcmp(header->magic, CTEST_JOURNAL_MAGIC, 4)) {
+        if(header->fingerprint != fingerprint || header->tests != registry.tests || header->suites != registry.suites) {
+            xprintf("\nWARNING - Journal '%s' was written by other tests, starting a new run.", options.journal);
+        } else if(header->complete) {
+            xprintf("\nJournal '%s' holds a complete run, starting a new run.", options.journal);
+        } else if(header->length < sizeof(CTestJournalHeader) || header->length > (uint64_t)st.st_size) {
+            xprintf("\nWARNING - Journal '%s' is damaged, starting a new run.", options.journal);
+        } else {
+            fresh = 0;
+        }
+    }
+
+    if(fresh) {
+        memset(header, 0, sizeof(CTestJournalHeader));
+        memcpy(header->magic, CTEST_JOURNAL_MAGIC, 4);
+        header->suites = registry.suites;
+        header->tests = registry.tests;
+        header->fingerprint = fingerprint;
+        header->length = sizeof(CTestJournalHeader);
+        return;
+    }
+
+    // Frames are decoded in place from the mapping
+    CTest_decoder_init(&decoder);
+
+    if(0 != CTest_decoder_feed(&decoder, journal.map + sizeof(CTestJournalHeader), (size_t)header->length - sizeof(CTestJournalHeader),
+                               journal_event, &replay)) {
+        xprintf("\nWARNING - Journal '%s' is damaged, resumed %u tests before the damage.", options.journal, journal.resumed);
+    }
+
+    CTest_decoder_free(&decoder);
+    xprintf("\nResumed %u tests from journal '%s'.", journal.resumed, options.journal);
+}
+
+// Encode event at pos, growing the mapping. Return: position after the frame, 0 on error
+size_t journal_append(const CTestEvent* event, size_t pos) {
+    size_t size = CTest_encode_event(event, journal.map + pos, journal.size - pos);
+
+    if(pos + size > journal.size) {
+        if(0 != journal_map(journal.size + size + CTEST_JOURNAL_CHUNK)) {
+            return 0;
+        }
+
+        CTest_encode_event(event, journal.map + pos, journal.size - pos);
+    }
+
+    return pos + size;
+}
+
+// Record a completed test; failures - its 1st failure, NULL if it passed
+void journal_test(CTestCase* test, const CTest_FailureRecord* failures, CTestStatus status, uint64_t asserts,
+                  uint64_t asserts_failed, uint64_t duration_ns) {
+    CTestEvent event;
+    size_t pos;
+
+    REPORT_LOCK();
+
+    if(NULL == journal.map) {
+        REPORT_UNLOCK();
+        return;
+    }
+
+    pos = (size_t)((CTestJournalHeader*)journal.map)->length;
+
+    for(; NULL != failures && 0 != pos; failures = failures->next) {
+        CTest_failure_event(failures, &event);
+        pos = journal_append(&event, pos);
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.type = CTE_TestEnd;
+    event.suite = registry.test_suite[test->index];
+    event.test = test->index;
+    event.status = (uint32_t)status;
+    event.asserts = asserts;
+    event.asserts_failed = asserts_failed;
+    event.duration_ns = duration_ns;
+
+    if(0 != pos) {
+        pos = journal_append(&event, pos);
+    }
+
+    if(0 != pos) {
+        // Commit: the test is complete in the journal
+        ((CTestJournalHeader*)journal.map)->length = pos;
+        journal.recorded++;
+    } else {
+        xprintf("\nWARNING - Cannot extend journal '%s', the rest of the run is not recorded.", options.journal);
+        journal_close();
+    }
+
+    REPORT_UNLOCK();
+}
+
+// The run has finished: a later --resume starts a new one
+void journal_end() {
+    if(NULL != journal.map) {
+        ((CTestJournalHeader*)journal.map)->complete = 1;
+    }
+
+    journal_close();
+}
+#endif
+
+// == Listeners ==
+
+void all_tests_complete_report();
+
+// Suite header before the first test line of the suite
+void console_suite_header(const CTestSuite* suite) {
+    if(NULL == progress.duration && running_suite != suite) {
+        assert(NULL != suite->name);
+        xprintf("\n--== %s ==--", suite->name);
+        running_suite = (CTestSuite*)suite;
+    }
+}
+
+void console_run_end(void* context) {
+    (void)context;
+    all_tests_complete_report();
+}
+
+void console_suite_start(const CTestSuite* suite, void* context) {
+    (void)context;
+    console_suite_header(suite);
+}
+
+void console_test_start(const CTestSuite* suite, const CTestCase* test, void* context) {
+    (void)context;
+
+    if(NULL == progress.duration && !pool_thread) {
+        console_suite_header(suite);
+        xprintf("\n  * %s.. ", test->name);
+    }
+}
+
+void console_test_end(const CTestSuite* suite, const CTestCase* test, const CTest_FailureRecord* failures,
+                      uint64_t duration_ns, void* context) {
+    CTest_FailureRecord* failure = (CTest_FailureRecord*)failures;
+
+    (void)context;
+
+    if(NULL == progress.duration && pool_thread) {
+        // One block per test, tests of the pool finish in any order
+        REPORT_LOCK();
+        xprintf("\n  * %s.. ", test->name);
+        basic_test_complete_message_handler(test, suite, failure);
+        REPORT_UNLOCK();
+    } else if(NULL == progress.duration) {
+        basic_test_complete_message_handler(test, suite, failure);
+    } else {
+        REPORT_LOCK();
+
+        if(NULL != failure) {
+            // Failures are printed in full above the status line
+            progress_clear();
+            xprintf("  * %s/%s.. ", suite->name, test->name);
+            basic_test_complete_message_handler(test, suite, failure);
+            xprintf("\n");
+        }
+
+        progress_test_done(test, NULL != failure, duration_ns);
+        REPORT_UNLOCK();
+    }
+}
+
+const CTestListener CTest_console_listener = {NULL, console_run_end, console_suite_start, NULL,
+                                              console_test_start, console_test_end, NULL, NULL
+                                             };
+
+const CTestListener* listeners[CTEST_MAX_LISTENERS] = {&CTest_console_listener};
+unsigned int listener_count = 1;
+
+int CTest_add_listener(const CTestListener* listener) {
+    assert(!test_is_running);
+    assert(NULL != listener);
+
+    if(listener_count >= CTEST_MAX_LISTENERS) {
+        return 1;
+    }
+
+    listeners[listener_count++] = listener;
+    return 0;
+}
+
+void CTest_remove_listener(const CTestListener* listener) {
+    unsigned int i, k = 0;
+
+    assert(!test_is_running);
+
+    for(i = 0; i < listener_count; i++) {
+        if(listeners[i] != listener) {
+            listeners[k++] = listeners[i];
+        }
+    }
+
+    listener_count = k;
+}
+
+void notify_run_start() {
+    unsigned int i;
+
+    for(i = 0; i < listener_count; i++) {
+        if(NULL != listeners[i]->run_start) {
+            listeners[i]->run_start(listeners[i]->context);
+        }
+    }
+}
+
+void notify_run_end() {
+    unsigned int i;
+
+    for(i = 0; i < listener_count; i++) {
+        if(NULL != listeners[i]->run_end) {
+            listeners[i]->run_end(listeners[i]->context);
+        }
+    }
+}
+
+void notify_suite_start(const CTestSuite* suite) {
+    unsigned int i;
+
+    for(i = 0; i < listener_count; i++) {
+        if(NULL != listeners[i]->suite_start) {
+            listeners[i]->suite_start(suite, listeners[i]->context);
+        }
+    }
+}
+
+void notify_suite_end(const CTestSuite* suite) {
+    unsigned int i;
+
+    for(i = 0; i < listener_count; i++) {
+        if(NULL != listeners[i]->suite_end) {
+            listeners[i]->suite_end(suite, listeners[i]->context);
+        }
+    }
+}
+
+void notify_test_start(const CTestSuite* suite, const CTestCase* test) {
+    unsigned int i;
+
+    for(i = 0; i < listener_count; i++) {
+        if(NULL != listeners[i]->test_start) {
+            listeners[i]->test_start(suite, test, listeners[i]->context);
+        }
+    }
+}
+
+// Failures of the test are reported one by one first
+void notify_test_end(const CTestSuite* suite, const CTestCase* test, const CTest_FailureRecord* failures, uint64_t duration_ns) {
+    const CTest_FailureRecord* failure;
+    unsigned int i;
+
+    for(i = 0; i < listener_count; i++) {
+        if(NULL != listeners[i]->test_failure) {
+            for(failure = failures; NULL != failure; failure = failure->next) {
+                listeners[i]->test_failure(failure, listeners[i]->context);
+            }
+        }
+
+        if(NULL != listeners[i]->test_end) {
+            listeners[i]->test_end(suite, test, failures, duration_ns, listeners[i]->context);
+        }
+    }
+}
+
+// == Resource limits ==
+// A test with limits (or every test with --isolate/--limit-*) runs in a forked child under setrlimit().
+// The child streams its failures and assertion counts back as protocol events; wait4() gives its usage.
+
+CTestCase* CTest_set_limits(CTestCase* test, uint64_t address_space, uint64_t cpu_seconds, uint64_t open_files) {
+    assert(NULL != test);
+
+    if(NULL == test->limits) {
+        test->limits = (CTestLimits*)block_alloc(&registry.nodes, sizeof(CTestLimits), CTEST_NODE_BLOCK);
+    }
+
+    test->limits->address_space = address_space;
+    test->limits->cpu_seconds = cpu_seconds;
+    test->limits->open_files = open_files;
+    return test;
+}
+
+// Effective limits: own ones over the defaults
+void test_limits(const CTestCase* test, CTestLimits* limits) {
+    *limits = options.limits;
+
+    if(NULL != test->limits) {
+        if(0 != test->limits->address_space) {
+            limits->address_space = test->limits->address_space;
+        }
+
+        if(0 != test->limits->cpu_seconds) {
+            limits->cpu_seconds = test->limits->cpu_seconds;
+        }
+
+        if(0 != test->limits->open_files) {
+            limits->open_files = test->limits->open_files;
+        }
+    }
+}
+
+// Table, property and fuzz tests always run in process
+int test_isolated(const CTestCase* test) {
+#ifndef WIN32
+    return (options.isolate || NULL != test->limits || 0 != options.limits.address_space || 0 != options.limits.cpu_seconds ||
+            0 != options.limits.open_files) && NULL != test->test && NULL == test->rows && NULL == test->property && NULL == test->fuzz &&
+           NULL == test->stress;
+#else
+    (void)test;
+    return 0;
+#endif
+}
+
+#ifndef WIN32
+typedef struct CTestIsolated {
+    CTestCase*      test;
+    int             done;           // CTE_TestEnd received
+} CTestIsolated;
+
+// Event of the child, failures are recreated in the parent
+void isolated_event(const CTestEvent* event, void* context) {
+    CTestIsolated* run = (CTestIsolated*)context;
+
+    switch(event->type) {
+    case CTE_Failure:
+        replay_failure(event, cur_suite, run->test);
+        limit_violations += (CUF_LimitExceeded == event->failure_type);
+        break;
+
+    case CTE_TestEnd:
+        summary.asserts += event->asserts;
+        summary.asserts_failed += event->asserts_failed;
+        run->done = 1;
+        break;
+
+    default:
+        break;
+    }
+}
+
+void set_limit(int resource, uint64_t soft, uint64_t hard) {
+    struct rlimit limit;
+
+    limit.rlim_cur = (rlim_t)soft;
+    limit.rlim_max = (rlim_t)hard;
+    setrlimit(resource, &limit);
+}
+
+// Child side: run the test body under the limits and stream the results to fd
+void isolated_child(CTestCase* test, const CTestLimits* limits, int fd) {
+    uint64_t start_asserts = summary.asserts, start_asserts_failed = summary.asserts_failed;
+    jmp_buf buf;
+
+    options.event_fd = fd;
+    listener_count = 0;             // The parent reports
+    last_emitted_failure = last_failure;
+
+    if(0 != limits->address_space) {
+        set_limit(RLIMIT_AS, limits->address_space, limits->address_space);
+    }
+
+    if(0 != limits->cpu_seconds) {
+        // SIGXCPU at the soft limit, SIGKILL a second later
+        set_limit(RLIMIT_CPU, limits->cpu_seconds, limits->cpu_seconds + 1);
+    }
+
+    if(0 != limits->open_files) {
+        set_limit(RLIMIT_NOFILE, limits->open_files, limits->open_files);
+    }
+
+    test->jumpBuf = &buf;
+
+    if(0 == setjmp(buf)) {
+        (*test->test)();
+    }
+
+    test->jumpBuf = NULL;
+    fold_passed_asserts();
+
+    // Best effort: the last descriptor allowed by the limit is still open. A test which closed its
+    // descriptors before returning, or which dup2()ed one to that number, is not told apart.
+    if(0 != limits->open_files && limits->open_files <= INT_MAX && -1 != fcntl((int)limits->open_files - 1, F_GETFD)) {
+        char* msg = CT_asprintf("Open files limit of %llu reached", (unsigned long long)limits->open_files);
+        append_failure(CUF_LimitExceeded, 0, msg, CTEST_COPY_MESSAGE, "CTest System", cur_suite, test, 0);
+        free(msg);
+    }
+
+    emit_failures();
+    emit_test_event(CTE_TestEnd, test, CTS_Passed, summary.asserts - start_asserts, summary.asserts_failed - start_asserts_failed, 0);
+    fflush(stdout);
+    _exit(0);
+}
+
+void record_usage(const CTestCase* test, const struct rusage* usage) {
+    CTestUsage* item;
+
+    if(usage_count == usage_capacity) {
+        usage_capacity = (0 == usage_capacity) ? 64 : usage_capacity * 2;
+        usages = (CTestUsage*)grow_array(usages, usage_capacity, sizeof(CTestUsage));
+    }
+
+    item = &usages[usage_count++];
+    item->test = test->index;
+    item->max_rss = usage->ru_maxrss;
+    item->user_us = (uint64_t)usage->ru_utime.tv_sec * 1000000 + (uint64_t)usage->ru_utime.tv_usec;
+    item->sys_us = (uint64_t)usage->ru_stime.tv_sec * 1000000 + (uint64_t)usage->ru_stime.tv_usec;
+    item->minor_faults = usage->ru_minflt;
+    item->major_faults = usage->ru_majflt;
+    item->voluntary_switches = usage->ru_nvcsw;
+    item->involuntary_switches = usage->ru_nivcsw;
+}
+
+// A crash under an address space limit is blamed on the limit when the peak resident size of
+// the child came within a quarter of it: the signal most likely followed a failed allocation
+// (a NULL dereference, an abort on out of memory, the kernel OOM killer)
+int near_address_limit(const CTestLimits* limits, int sig, const struct rusage* usage) {
+    uint64_t rss = (uint64_t)usage->ru_maxrss * 1024;
+
+    if(0 == limits->address_space || (SIGSEGV != sig && SIGBUS != sig && SIGABRT != sig && SIGKILL != sig)) {
+        return 0;
+    }
+
+    return rss >= limits->address_space - limits->address_space / 4;
+}
+
+// Run the body of test in a child process under its limits
+void run_isolated(CTestCase* test) {
+    CTestIsolated run = {test, 0};
+    CTestDecoder decoder;
+    CTestLimits limits;
+    struct rusage usage;
+    unsigned char data[4096];
+    CTest_FailureType type = CUF_TestCrashed;
+    char* msg = NULL;
+    int fds[2], status = 0;
+    ssize_t size;
+    pid_t pid;
+
+    test_limits(test, &limits);
+
+    if(0 != pipe(fds)) {
+        error("Cannot create a pipe for an isolated test");
+    }
+
+    fflush(stdout);
+    pid = fork();
+
+    if(pid < 0) {
+        error("Cannot fork an isolated test");
+    }
+
+    if(0 == pid) {
+        close(fds[0]);
+        isolated_child(test, &limits, fds[1]);
+    }
+
+    close(fds[1]);
+    CTest_decoder_init(&decoder);
+
+    while(0 != (size = read(fds[0], data, sizeof(data)))) {
+        if(size < 0) {
+            if(EINTR == errno) {
+                continue;
+            }
+
+            break;
+        }
+
+        CTest_decoder_feed(&decoder, data, (size_t)size, isolated_event, &run);
+    }
+
+    close(fds[0]);
+    CTest_decoder_free(&decoder);
+    memset(&usage, 0, sizeof(usage));
+
+    while(wait4(pid, &status, 0, &usage) < 0 && EINTR == errno) {
+    }
+
+    record_usage(test, &usage);
+
+    if(WIFSIGNALED(status)) {
+        int sig = WTERMSIG(status);
+        uint64_t cpu = (uint64_t)usage.ru_utime.tv_sec + (uint64_t)usage.ru_stime.tv_sec;
+
+        if(0 != limits.cpu_seconds && (SIGXCPU == sig || (SIGKILL == sig && cpu >= limits.cpu_seconds))) {
+            type = CUF_LimitExceeded;
+            msg = CT_asprintf("CPU time limit of %llu s exceeded", (unsigned long long)limits.cpu_seconds);
+        } else if(near_address_limit(&limits, sig, &usage)) {
+            type = CUF_LimitExceeded;
+            msg = CT_asprintf("Killed by signal %d, address space limit of %llu MB", sig,
+                              (unsigned long long)(limits.address_space / 1048576));
+        } else {
+            msg = CT_asprintf("Test process killed by signal %d", sig);
+        }
+    } else if(!run.done || 0 != WEXITSTATUS(status)) {
+        msg = CT_asprintf("Test process exited with status %d", WEXITSTATUS(status));
+    }
+
+    if(NULL != msg) {
+        limit_violations += (CUF_LimitExceeded == type);
+        append_failure(type, 0, msg, CTEST_COPY_MESSAGE, "CTest System", cur_suite, test, 0);
+        free(msg);
+    }
+}
+#endif
+
+void run_stress(CTestCase* test);
+
+// Test durations are measured for their readers only: the progress line, --journal, --event-fd
+// and the test_end of listeners other than the console one
+int durations_needed() {
+    unsigned int i;
+
+#ifndef WIN32
+    if(NULL != journal.map) {
+        return 1;
+    }
+#endif
+
+    if(NULL != progress.duration || options.event_fd >= 0) {
+        return 1;
+    }
+
+    for(i = 0; i < listener_count; i++) {
+        if(&CTest_console_listener != listeners[i] && NULL != listeners[i]->test_end) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void run_single_test(CTestCase* test) {
+    volatile unsigned int start_failures;
+    uint64_t start_asserts = summary.asserts, start_asserts_failed = summary.asserts_failed;
+    unsigned int start_tests_failed = summary.tests_failed;
+    volatile uint64_t start_ns = 0;
+    uint64_t duration_ns, key = 0;
+    int timed = durations_needed();
+    /* keep track of the last failure BEFORE running the test */
+    CTest_FailureRecord* pLastFailure = last_failure;
+    jmp_buf buf;
+
+    assert(NULL != cur_suite);
+    assert(0 != cur_suite->active);
+    assert(NULL != test);
+
+    start_failures = summary.failure_records;
+
+    cur_test = test;
+
+    // Before test
+    assert(NULL != cur_suite);
+    assert(NULL != cur_test);
+    assert(NULL != cur_test->name);
+
+    notify_test_start(cur_suite, cur_test);
+
+    if(options.event_fd >= 0) {
+        emit_test_event(CTE_TestStart, test, CTS_Passed, 0, 0, 0);
+    }
+
+    if(timed) {
+        start_ns = CTest_time_ns();
+    }
+
+    if(0 != test->active) {
+        key = cache_key(test);
+    }
+
+    /* run test if it is active */
+    if(0 != key && 0 != cache_replay(key)) {
+        summary.tests_run++;
+        key = 0;                    // Nothing to store
+    } else if(0 != test->active && 0 != fixture_begin(cur_suite, test, &buf)) {
+        summary.tests_run++; // The fixture or setup failure is the test failure
+    } else if(0 != test->active) {
+
+        /* set jmp_buf and run test */
+        test->jumpBuf = &buf;
+
+        if(NULL != test->rows) {
+            run_table_cases(test, &buf);
+        } else if(NULL != test->property) {
+            run_property(test);
+            summary.tests_run++;
+        } else if(NULL != test->fuzz) {
+            run_fuzz(test, &buf);
+            summary.tests_run++;
+        } else if(NULL != test->stress) {
+            run_stress(test);
+            summary.tests_run++;
+#ifndef WIN32
+        } else if(test_isolated(test)) {
+            run_isolated(test);
+            summary.tests_run++;
+#endif
+        } else {
+            if(0 == setjmp(buf)) {
+                if(NULL != test->test) {
+                    (*test->test)();
+                }
+            }
+
+            summary.tests_run++;
+        }
+
+        // Fatal assertions in teardown only record the failure
+        test->jumpBuf = NULL;
+        fixture_end(cur_suite);
+    } else {
+        summary.tests_inactive++;
+
+        append_failure(CUF_TestInactive, 0, "Test inactive", 0, "CTest System", cur_suite, cur_test, 0);
+    }
+
+    fold_passed_asserts();
+
+    // if additional failures have occurred..
+    if(summary.failure_records > start_failures) {
+        if(NULL == test->rows) {
+            summary.tests_failed++; // table cases are counted one by one
+        }
+
+        if(NULL != pLastFailure) {
+            pLastFailure = pLastFailure->next;  /* was a previous failure, so go to next one */
+        } else {
+            pLastFailure = failure_list;       /* no previous failure - go to 1st one */
+        }
+    } else {
+        pLastFailure = NULL;                   /* no additional failure - set to NULL */
+    }
+
+    registry.test_failed[test->index] = summary.tests_failed - start_tests_failed;
+    duration_ns = timed ? CTest_time_ns() - start_ns : 0;
+
+    if(0 != key && NULL == pLastFailure) {
+        cache_store(key, summary.asserts - start_asserts);
+    }
+
+#ifndef WIN32
+    if(0 != test->active) {
+        journal_test(test, pLastFailure, (NULL != pLastFailure) ? CTS_Failed : CTS_Passed, summary.asserts - start_asserts,
+                     summary.asserts_failed - start_asserts_failed, duration_ns);
+    }
+#endif
+
+    if(options.event_fd >= 0) {
+        CTestStatus status = (0 == test->active) ? CTS_Inactive : ((NULL != pLastFailure) ? CTS_Failed : CTS_Passed);
+        emit_test_event(CTE_TestEnd, test, status, summary.asserts - start_asserts,
+                        summary.asserts_failed - start_asserts_failed, duration_ns);
+    }
+
+    notify_test_end(cur_suite, cur_test, pLastFailure, duration_ns);
+
+    test->jumpBuf = NULL;
+    cur_test = NULL;
+}
+
+// Runs all tests in a specified suite
+// == Test pool ==
+// --workers: reentrant tests of a suite are split between the deques of the worker threads.
+// A worker takes tests from the back of its own deque and steals from the front of the others.
+
+// Test can run on the pool
+int pool_eligible(const CTestCase* test) {
+    return options.workers > 1 && 0 != (test->flags & CTEST_REENTRANT) && 0 == (test->flags & CTEST_ASYNC) && 0 != test->active && registry.test_active[test->index] &&
+           NULL == test->rows && NULL == test->property && NULL == test->fuzz && NULL == test->stress && NULL != test->test && !test_isolated(test);
+}
+
+CTestCase* CTest_set_reentrant(CTestCase* test) {
+    assert(NULL != test);
+
+    test->flags |= CTEST_REENTRANT;
+    return test;
+}
+
+// Results of the tests run concurrently with others are kept apart and merged when each test is done
+typedef struct CTestResults {
+    CTestRunSummary*      summary;
+    CTest_FailureRecord** failure_list;
+    CTest_FailureRecord** last_failure;
+    CTest_FailureRecord** last_emitted;
+} CTestResults;
+
+// Move the results of from to the end of to and clear from
+void merge_results(const CTestResults* to, const CTestResults* from) {
+    CTestRunSummary* main = to->summary;
+    CTestRunSummary* part = from->summary;
+
+    // Passes counted by the calling thread (a pool worker, a STRESS thread) go with its summary
+    fold_passed_asserts();
+    main->tests_run += part->tests_run;
+    main->tests_failed += part->tests_failed;
+    main->tests_inactive += part->tests_inactive;
+    main->asserts += part->asserts;
+    main->asserts_failed += part->asserts_failed;
+    main->failure_records += part->failure_records;
+
+    if(NULL != *from->failure_list) {
+        CTest_FailureRecord* tail = *to->last_failure;
+
+        // Failures of the part were streamed already
+        if(*to->last_emitted == tail) {
+            *to->last_emitted = *from->last_failure;
+        }
+
+        (*from->failure_list)->prev = tail;
+
+        if(NULL != tail) {
+            tail->next = *from->failure_list;
+        } else {
+            *to->failure_list = *from->failure_list;
+        }
+
+        *to->last_failure = *from->last_failure;
+    }
+
+    memset(part, 0, sizeof(CTestRunSummary));
+    *from->failure_list = NULL;
+    *from->last_failure = NULL;
+    *from->last_emitted = NULL;
+}
+
+#ifndef WIN32
+typedef struct CTestDeque {
+    pthread_mutex_t lock;
+    unsigned int    head;           // Tests [head, tail) of the batch are left
+    unsigned int    tail;
+} CTestDeque;
+
+typedef struct CTestPool {
+    CTestSuite*     suite;
+    CTestCase**     tests;
+    unsigned int    workers;
+    CTestDeque*     deques;
+    CTestResults    main;           // Results of the main thread
+} CTestPool;
+
+typedef struct CTestPoolWorker {
+    CTestPool*      pool;
+    unsigned int    id;
+} CTestPoolWorker;
+
+// Next test for worker id, NULL - all taken
+CTestCase* pool_take(CTestPool* pool, unsigned int id) {
+    CTestCase* test = NULL;
+    CTestDeque* deque;
+    unsigned int i;
+
+    for(i = 0; i < pool->workers && NULL == test; i++) {
+        deque = &pool->deques[(id + i) % pool->workers];
+        pthread_mutex_lock(&deque->lock);
+
+        if(deque->head < deque->tail) {
+            test = (0 == i) ? pool->tests[--deque->tail] : pool->tests[deque->head++];
+        }
+
+        pthread_mutex_unlock(&deque->lock);
+    }
+
+    return test;
+}
+
+// Move the results of the worker thread to the main thread
+void pool_merge(CTestPool* pool) {
+    CTestResults worker = {&summary, &failure_list, &last_failure, &last_emitted_failure};
+
+    REPORT_LOCK();
+    merge_results(&pool->main, &worker);
+    REPORT_UNLOCK();
+}
+
+void* pool_worker(void* arg) {
+    CTestPoolWorker* worker = (CTestPoolWorker*)arg;
+    CTestPool* pool = worker->pool;
+    CTestCase* test;
+
+    pool_thread = 1;
+
+    while(NULL != (test = pool_take(pool, worker->id))) {
+        cur_suite = pool->suite;
+        run_single_test(test);
+        pool_merge(pool);
+    }
+
+    cur_suite = NULL;
+    return NULL;
+}
+
+// Run tests[0..count) of the initialized suite on options.workers threads
+void pool_run(CTestSuite* suite, CTestCase** tests, unsigned int count) {
+    CTestPool pool;
+    CTestPoolWorker* workers;
+    pthread_t* threads;
+    unsigned int i, started = 0, first = 0;
+    CTestCase* test;
+
+    pool.suite = suite;
+    pool.tests = tests;
+    pool.workers = (options.workers < count) ? options.workers : count;
+    pool.deques = (CTestDeque*)calloc(pool.workers, sizeof(CTestDeque));
+    pool.main.summary = &summary;
+    pool.main.failure_list = &failure_list;
+    pool.main.last_failure = &last_failure;
+    pool.main.last_emitted = &last_emitted_failure;
+    workers = (CTestPoolWorker*)calloc(pool.workers, sizeof(CTestPoolWorker));
+    threads = (pthread_t*)calloc(pool.workers, sizeof(pthread_t));
+
+    if(NULL == pool.deques || NULL == workers || NULL == threads) {
+        error("Memory allocation failed");
+    }
+
+    for(i = 0; i < pool.workers; i++) {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.deques[i].head = first;
+        first += count / pool.workers + (i < count % pool.workers);
+        pool.deques[i].tail = first;
+    }
+
+    // Tests with results queued in the main thread are streamed before the workers start
+    emit_failures();
+    SET_CONCURRENT(1);
+
+    for(i = 0; i < pool.workers; i++) {
+        workers[i].pool = &pool;
+        workers[i].id = i;
+
+        if(0 == pthread_create(&threads[started], NULL, pool_worker, &workers[i])) {
+            started++;
+        }
+    }
+
+    for(i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    SET_CONCURRENT(0);
+
+    // Left when threads could not be started
+    while(NULL != (test = pool_take(&pool, 0))) {
+        cur_suite = suite;
+        run_single_test(test);
+    }
+
+    for(i = 0; i < pool.workers; i++) {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+    }
+
+    cur_suite = suite;
+    free(pool.deques);
+    free(workers);
+    free(threads);
+}
+#endif
+
+// == Stress tests ==
+// STRESS() runs body on N threads pinned to CPUs. Each round the threads meet at a spin barrier and
+// then call body iterations times, so they hit the code at the same instant. Rounds repeat for
+// --stress-ms; a failed assertion ends the run after its round. --stress-sweep repeats the run
+// for 1, 2, 4... N threads for a scaling curve.
+
+typedef struct CTestStress {
+    CTestStressFunc body;
+    unsigned int    threads;        // 0 - one per CPU the process may run on
+    unsigned long   iterations;     // Calls of body per thread and round
+} CTestStress;
+
+// One run of a stress test, listed in the run results
+typedef struct CTestStressResult {
+    unsigned int    test;
+    unsigned int    threads;
+    unsigned long   rounds;
+    unsigned int    unpinned;       // Threads the scheduler placed, pinning them failed
+    double          rate;           // Operations per second of all threads
+    double*         thread_rate;    // Operations per second of each thread while it ran body
+    unsigned int*   thread_failed;  // Failed assertions of each thread
+} CTestStressResult;
+
+CTestStressResult* stresses = NULL;
+unsigned int stress_count = 0;
+
+CTestStressResult* stress_result(CTestCase* test, unsigned int threads) {
+    CTestStressResult* result;
+
+    REPORT_LOCK();
+    stresses = (CTestStressResult*)grow_array(stresses, stress_count + 1, sizeof(CTestStressResult));
+    result = &stresses[stress_count++];
+    memset(result, 0, sizeof(CTestStressResult));
+    result->test = test->index;
+    result->threads = threads;
+    result->thread_rate = (double*)calloc(threads, sizeof(double));
+    result->thread_failed = (unsigned int*)calloc(threads, sizeof(unsigned int));
+    REPORT_UNLOCK();
+
+    if(NULL == result->thread_rate || NULL == result->thread_failed) {
+        error("Memory allocation failed");
+    }
+
+    return result;
+}
+
+void stress_clear() {
+    unsigned int i;
+
+    for(i = 0; i < stress_count; i++) {
+        free(stresses[i].thread_rate);
+        free(stresses[i].thread_failed);
+    }
+
+    free(stresses);
+    stresses = NULL;
+    stress_count = 0;
+}
+
+#ifndef WIN32
+typedef struct CTestSpinBarrier {
+    unsigned int    count;
+    unsigned int    waiting;
+    unsigned int    generation;
+    int             stop_next;      // Requested by a thread of this generation
+    int             stop;           // Decision of the last released generation
+} CTestSpinBarrier;
+
+// Wait for all threads. The stop requests of the generation are decided by its last thread,
+// so every thread leaves the same barrier. Return: nonzero - a thread requested to stop
+int spin_barrier_wait(CTestSpinBarrier* barrier, int stop) {
+    unsigned int generation = __atomic_load_n(&barrier->generation, __ATOMIC_ACQUIRE);
+    unsigned int spins = 0;
+
+    if(stop) {
+        __atomic_store_n(&barrier->stop_next, 1, __ATOMIC_RELAXED);
+    }
+
+    if(__atomic_add_fetch(&barrier->waiting, 1, __ATOMIC_ACQ_REL) == barrier->count) {
+        barrier->stop = barrier->stop_next;
+        barrier->stop_next = 0;
+        __atomic_store_n(&barrier->waiting, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&barrier->generation, generation + 1, __ATOMIC_RELEASE);
+        return barrier->stop;
+    }
+
+    while(__atomic_load_n(&barrier->generation, __ATOMIC_ACQUIRE) == generation) {
+        // Threads sharing a CPU must not spin against each other for a whole time slice
+        if(0 == (++spins & 1023)) {
+            sched_yield();
+        }
+    }
+
+    return barrier->stop;
+}
+
+// CPUs the process may run on, the affinity mask may be narrower than the online CPUs (taskset, cgroups).
+// allowed (Linux) receives the mask, it stays empty when it is unknown. Return: number of CPUs, at least 1
+unsigned int stress_cpus(void* allowed) {
+    long online;
+#ifdef __linux__
+    cpu_set_t* set = (cpu_set_t*)allowed;
+
+    CPU_ZERO(set);
+
+    if(0 == sched_getaffinity(0, sizeof(cpu_set_t), set) && CPU_COUNT(set) > 0) {
+        return (unsigned int)CPU_COUNT(set);
+    }
+
+    CPU_ZERO(set);
+#else
+    (void)allowed;
+#endif
+    online = sysconf(_SC_NPROCESSORS_ONLN);
+    return (online > 0) ? (unsigned int)online : 1;
+}
+
+typedef struct CTestStressRun {
+    CTestCase*      test;
+    CTestSuite*     suite;
+    CTestSpinBarrier barrier;
+    int             go;             // All threads are started, barrier.count is final
+    uint64_t        deadline;
+#ifdef __linux__
+    cpu_set_t       allowed;        // See stress_cpus()
+#endif
+    unsigned int    cpus;
+    CTestResults    main;           // Results of the test
+} CTestStressRun;
+
+typedef struct CTestStressThread {
+    CTestStressRun* run;
+    unsigned int    id;
+    int             pinned;
+    unsigned long   ops;
+    unsigned long   rounds;
+    uint64_t        busy_ns;
+    unsigned int    failed;
+} CTestStressThread;
+
+void* stress_thread(void* arg) {
+    CTestStressThread* self = (CTestStressThread*)arg;
+    CTestStressRun* run = self->run;
+    const CTestStress* stress = run->test->stress;
+    CTestResults results = {&summary, &failure_list, &last_failure, &last_emitted_failure};
+    CTestCase own = *run->test;     // Jump buffer of this thread for fatal assertions
+    CTest_FailureRecord* failure;
+    unsigned long i;
+    uint64_t start;
+    int stop = 0;
+    jmp_buf buf;
+#ifdef __linux__
+    unsigned int nth = self->id % run->cpus;
+    cpu_set_t cpus;
+    int cpu;
+
+    // Thread id runs on the id-th allowed CPU, round robin
+    CPU_ZERO(&cpus);
+
+    for(cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if(CPU_ISSET(cpu, &run->allowed) && 0 == nth--) {
+            CPU_SET(cpu, &cpus);
+            break;
+        }
+    }
+
+    self->pinned = CPU_COUNT(&cpus) > 0 && 0 == pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#endif
+
+    pool_thread = 1;
+    cur_suite = run->suite;
+    cur_test = &own;
+    own.jumpBuf = &buf;
+
+    while(!__atomic_load_n(&run->go, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+
+    while(!spin_barrier_wait(&run->barrier, stop)) {
+        start = CTest_time_ns();
+
+        if(0 == setjmp(buf)) {
+            for(i = 0; i < stress->iterations; i++) {
+                stress->body(self->id, i);
+            }
+
+            self->ops += stress->iterations;
+        }
+
+        self->busy_ns += CTest_time_ns() - start;
+        self->rounds++;
+
+        stop = 0 != summary.failure_records || (0 == self->id && CTest_time_ns() >= run->deadline);
+    }
+
+    self->failed = summary.asserts_failed;
+
+    for(failure = failure_list; NULL != failure; failure = failure->next) {
+        failure->test = run->test;
+    }
+
+    REPORT_LOCK();
+    merge_results(&run->main, &results);
+    REPORT_UNLOCK();
+
+    cur_test = NULL;
+    cur_suite = NULL;
+    return NULL;
+}
+
+// Run the test on threads threads until --stress-ms is over or an assertion fails
+void stress_run(CTestCase* test, unsigned int threads) {
+    CTestStressRun run;
+    CTestStressThread* states = (CTestStressThread*)calloc(threads, sizeof(CTestStressThread));
+    pthread_t* handles = (pthread_t*)calloc(threads, sizeof(pthread_t));
+    CTestStressResult* result;
+    unsigned int i, started = 0;
+    unsigned long ops = 0;
+    uint64_t start;
+
+    if(NULL == states || NULL == handles) {
+        error("Memory allocation failed");
+    }
+
+    memset(&run, 0, sizeof(run));
+    SET_CONCURRENT(1);
+    run.test = test;
+    run.suite = cur_suite;
+#ifdef __linux__
+    run.cpus = stress_cpus(&run.allowed);
+#else
+    run.cpus = stress_cpus(NULL);
+#endif
+    run.main.summary = &summary;
+    run.main.failure_list = &failure_list;
+    run.main.last_failure = &last_failure;
+    run.main.last_emitted = &last_emitted_failure;
+
+    for(i = 0; i < threads; i++) {
+        states[started].run = &run;
+        states[started].id = started;
+
+        if(0 == pthread_create(&handles[started], NULL, stress_thread, &states[started])) {
+            started++;
+        }
+    }
+
+    if(0 == started) {
+        SET_CONCURRENT(0);
+        append_failure(CUF_AssertFailed, 0, "Stress threads could not be started", 0, "CTest System", cur_suite, test, 0);
+        free(states);
+        free(handles);
+        return;
+    }
+
+    start = CTest_time_ns();
+    run.barrier.count = started;
+    run.deadline = start + (uint64_t)options.stress_ms * 1000000ULL;
+    __atomic_store_n(&run.go, 1, __ATOMIC_RELEASE);
+
+    for(i = 0; i < started; i++) {
+        pthread_join(handles[i], NULL);
+    }
+
+    SET_CONCURRENT(0);
+    result = stress_result(test, started);
+    result->rounds = states[0].rounds;
+
+    for(i = 0; i < started; i++) {
+        ops += states[i].ops;
+        result->thread_rate[i] = (0 != states[i].busy_ns) ? (double)states[i].ops * 1e9 / (double)states[i].busy_ns : 0.0;
+        result->thread_failed[i] = states[i].failed;
+        result->unpinned += !states[i].pinned;
+    }
+
+    result->rate = (double)ops * 1e9 / (double)(CTest_time_ns() - start);
+
+    free(states);
+    free(handles);
+}
+#endif
+
+void run_stress(CTestCase* test) {
+    const CTestStress* stress = test->stress;
+#ifndef WIN32
+    unsigned int start_failures = summary.failure_records;
+#ifdef __linux__
+    cpu_set_t allowed;
+    unsigned int most = (0 != stress->threads) ? stress->threads : stress_cpus(&allowed);
+#else
+    unsigned int most = (0 != stress->threads) ? stress->threads : stress_cpus(NULL);
+#endif
+    unsigned int threads = options.stress_sweep ? 1 : most;
+
+    for(;;) {
+        stress_run(test, threads);
+
+        // A failure ends the sweep, the curve after it would measure a broken structure
+        if(threads >= most || summary.failure_records != start_failures) {
+            break;
+        }
+
+        threads = (2 * threads < most) ? 2 * threads : most;
+    }
+#else
+    // No threads: one round on the calling thread
+    unsigned long i;
+
+    if(0 == setjmp(*test->jumpBuf)) {
+        for(i = 0; i < stress->iterations; i++) {
+            stress->body(0, i);
+        }
+    }
+#endif
+}
+
+// Operations per second of the stress runs, several lines per test with --stress-sweep
+char* stress_section(char* report) {
+    char* line;
+    unsigned int i, k;
+    double single = 0.0;
+
+    line = CT_asprintf("%s\n\nStress tests:\n  %7s %8s %14s %14s %14s %7s", (NULL != report) ? report : "",
+                       "threads", "rounds", "ops/s", "thread min", "thread max", "scaling");
+    free(report);
+    report = line;
+
+    for(i = 0; i < stress_count; i++) {
+        const CTestStressResult* result = &stresses[i];
+        double low = result->thread_rate[0], high = result->thread_rate[0];
+        unsigned int failed = 0;
+        char scaling[16] = "-";
+
+        for(k = 0; k < result->threads; k++) {
+            low = (result->thread_rate[k] < low) ? result->thread_rate[k] : low;
+            high = (result->thread_rate[k] > high) ? result->thread_rate[k] : high;
+            failed += result->thread_failed[k];
+        }
+
+        // Speedup over the single thread run of the same sweep
+        if(1 == result->threads) {
+            single = result->rate;
+        } else if(0 != i && stresses[i - 1].test != result->test) {
+            single = 0.0;
+        }
+
+        if(0.0 != single) {
+            snprintf(scaling, sizeof(scaling), "%.2f", result->rate / single);
+        }
+
+        line = CT_asprintf("%s\n  %7u %8lu %14.0f %14.0f %14.0f %7s  %s/%s", report, result->threads, result->rounds, result->rate,
+                           low, high, scaling, registry.suite_handle[registry.test_suite[result->test]]->name, registry.test_name[result->test]);
+        free(report);
+        report = line;
+
+        if(0 != result->unpinned) {
+            line = CT_asprintf("%s\n          %u threads could not be pinned to a CPU", report, result->unpinned);
+            free(report);
+            report = line;
+        }
+
+        if(0 != failed) {
+            line = CT_asprintf("%s\n          failed assertions by thread:", report);
+            free(report);
+            report = line;
+
+            for(k = 0; k < result->threads; k++) {
+                line = CT_asprintf("%s %u", report, result->thread_failed[k]);
+                free(report);
+                report = line;
+            }
+        }
+    }
+
+    return report;
+}
+
+// Tests of the list from first on which are eligible, stopping at the first test of another suite
+// (NULL list - the tests of the suite). Caller must call free(tests)
+CTestCase** collect_tests(CTestSuite* suite, const unsigned int* plan, unsigned int plan_size, int (*eligible)(const CTestCase*),
+                          unsigned int* count) {
+    CTestCase** tests = (CTestCase**)malloc((suite->number_of_tests + 1) * sizeof(CTestCase*));
+    CTestCase* test;
+    unsigned int k;
+
+    if(NULL == tests) {
+        error("Memory allocation failed");
+    }
+
+    *count = 0;
+
+    if(NULL == plan) {
+        for(test = suite->test; NULL != test; test = test->next) {
+            if(eligible(test)) {
+                tests[(*count)++] = test;
+            }
+        }
+    } else {
+        for(k = 0; k < plan_size && registry.test_suite[plan[k]] == suite->index; k++) {
+            test = registry.test_handle[plan[k]];
+
+            if(eligible(test)) {
+                tests[(*count)++] = test;
+            }
+        }
+    }
+
+    return tests;
+}
+
+// == Async tests ==
+// TEST_ASYNC tests of a suite run together on the main thread, each on its own stack (ucontext).
+// CTest_await_fd() switches back to an epoll scheduler until the descriptor is ready or the timeout ends.
+// The runner state of a task (cur_test, summary, failures...) is swapped in and out with it, so its
+// assertions are attributed to it; its results are merged when it is done.
+
+CTestCase* CTest_set_async(CTestCase* test) {
+    assert(NULL != test);
+
+    test->flags |= CTEST_ASYNC;
+    return test;
+}
+
+// Test can run as an async task
+int async_eligible(const CTestCase* test) {
+#ifdef __linux__
+    return 0 != (test->flags & CTEST_ASYNC) && 0 != test->active && registry.test_active[test->index] && NULL == test->rows &&
+           NULL == test->property && NULL == test->fuzz && NULL == test->stress && NULL != test->test && !test_isolated(test);
+#else
+    (void)test;
+    return 0;
+#endif
+}
+
+#ifdef __linux__
+#define CTEST_ASYNC_STACK (256 * 1024)
+
+typedef enum CTestTaskStatus {
+    CTK_Ready,
+    CTK_Waiting,
+    CTK_Done
+} CTestTaskStatus;
+
+// Runner state of the thread, swapped with the running task
+typedef struct CTestTaskState {
+    CTestSuite*     suite;
+    CTestCase*      test;
+    long            row;
+    CTestRunSummary summary;
+    CTest_FailureRecord* failure_list, *last_failure, *last_emitted;
+    uint64_t        asserts_passed;
+    void*           fixture;
+    int             concurrent;
+} CTestTaskState;
+
+typedef struct CTestTask {
+    ucontext_t      context;
+    void*           stack;
+    CTestCase*      test;
+    CTestTaskStatus status;
+    CTestTaskState  state;
+    int             fd;             // Duplicate of the awaited descriptor registered with epoll, -1 - none
+    uint64_t        deadline_ns;    // 0 - none
+    int             events;         // Ready CTEST_READ/CTEST_WRITE, 0 - timeout
+} CTestTask;
+
+typedef struct CTestScheduler {
+    ucontext_t      context;
+    int             epoll_fd;
+    CTestTask*      running;
+} CTestScheduler;
+
+CTestScheduler* scheduler = NULL;   // Set while async tests run
+
+void task_state_save(CTestTaskState* state) {
+    state->suite = cur_suite;
+    state->test = cur_test;
+    state->row = cur_row;
+    state->summary = summary;
+    state->failure_list = failure_list;
+    state->last_failure = last_failure;
+    state->last_emitted = last_emitted_failure;
+    state->asserts_passed = CTest_asserts_passed;
+    state->fixture = cur_fixture;
+    state->concurrent = pool_thread;
+}
+
+void task_state_load(const CTestTaskState* state) {
+    cur_suite = state->suite;
+    cur_test = state->test;
+    cur_row = state->row;
+    summary = state->summary;
+    failure_list = state->failure_list;
+    last_failure = state->last_failure;
+    last_emitted_failure = state->last_emitted;
+    CTest_asserts_passed = state->asserts_passed;
+    cur_fixture = state->fixture;
+    pool_thread = state->concurrent;
+}
+
+void task_entry(void) {
+    CTestTask* task = scheduler->running;
+
+    run_single_test(task->test);
+    task->status = CTK_Done;
+    // Returns to the scheduler through uc_link
+}
+
+// Switch to task until it waits or is done
+void task_resume(CTestTask* task) {
+    CTestTaskState main;
+
+    task_state_save(&main);
+    task_state_load(&task->state);
+    scheduler->running = task;
+    swapcontext(&scheduler->context, &task->context);
+    scheduler->running = NULL;
+    task_state_save(&task->state);
+    task_state_load(&main);
+}
+
+void task_unwatch(CTestTask* task) {
+    if(task->fd >= 0) {
+        // Closing alone keeps the registration while the original descriptor is open
+        epoll_ctl(scheduler->epoll_fd, EPOLL_CTL_DEL, task->fd, NULL);
+        close(task->fd);
+        task->fd = -1;
+    }
+}
+
+// Run tests[0..count) of the initialized suite as tasks of one scheduler
+void async_run(CTestSuite* suite, CTestCase** tests, unsigned int count) {
+    CTestScheduler sched;
+    CTestTask* tasks = (CTestTask*)calloc(count, sizeof(CTestTask));
+    CTestResults main = {&summary, &failure_list, &last_failure, &last_emitted_failure};
+    CTestResults part;
+    struct epoll_event events[64];
+    size_t guard = (size_t)sysconf(_SC_PAGESIZE);
+    unsigned int i, alive = count;
+    uint64_t now, next;
+    int n, timeout;
+
+    memset(&sched, 0, sizeof(sched));
+    sched.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if(NULL == tasks || sched.epoll_fd < 0) {
+        error("Cannot start the async test scheduler");
+    }
+
+    // Tests with results queued in the main thread are streamed before the tasks start
+    emit_failures();
+    scheduler = &sched;
+
+    for(i = 0; i < count; i++) {
+        CTestTask* task = &tasks[i];
+
+        task->test = tests[i];
+        task->fd = -1;
+        task->status = CTK_Ready;
+        task->state.suite = suite;
+        task->state.row = -1;
+        task->state.concurrent = 1;
+        // The stack grows down onto a PROT_NONE guard page: an overflow faults instead of overwriting other memory
+        task->stack = mmap(NULL, guard + CTEST_ASYNC_STACK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if(MAP_FAILED == task->stack || 0 != mprotect(task->stack, guard, PROT_NONE) || 0 != getcontext(&task->context)) {
+            error("Cannot create an async test stack");
+        }
+
+        task->context.uc_stack.ss_sp = (char*)task->stack + guard;
+        task->context.uc_stack.ss_size = CTEST_ASYNC_STACK;
+        task->context.uc_link = &sched.context;
+        makecontext(&task->context, task_entry, 0);
+    }
+
+    while(0 != alive) {
+        for(i = 0; i < count; i++) {
+            CTestTask* task = &tasks[i];
+
+            if(CTK_Ready != task->status) {
+                continue;
+            }
+
+            task_resume(task);
+
+            if(CTK_Done == task->status) {
+                part.summary = &task->state.summary;
+                part.failure_list = &task->state.failure_list;
+                part.last_failure = &task->state.last_failure;
+                part.last_emitted = &task->state.last_emitted;
+                merge_results(&main, &part);
+                munmap(task->stack, guard + CTEST_ASYNC_STACK);
+                alive--;
+            }
+        }
+
+        if(0 == alive) {
+            break;
+        }
+
+        // Wait for the first descriptor or deadline
+        now = CTest_time_ns();
+        next = 0;
+
+        for(i = 0; i < count; i++) {
+            if(CTK_Waiting == tasks[i].status && 0 != tasks[i].deadline_ns && (0 == next || tasks[i].deadline_ns < next)) {
+                next = tasks[i].deadline_ns;
+            }
+        }
+
+        timeout = (0 == next) ? -1 : (next <= now) ? 0 : (int)((next - now + 999999) / 1000000);
+        n = epoll_wait(sched.epoll_fd, events, sizeof(events) / sizeof(events[0]), timeout);
+
+        for(i = 0; n > 0 && i < (unsigned int)n; i++) {
+            CTestTask* task = (CTestTask*)events[i].data.ptr;
+
+            task->events = ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) ? CTEST_READ : 0) |
+                           ((events[i].events & (EPOLLOUT | EPOLLERR)) ? CTEST_WRITE : 0);
+            task->status = CTK_Ready;
+            task_unwatch(task);
+        }
+
+        now = CTest_time_ns();
+
+        for(i = 0; i < count; i++) {
+            CTestTask* task = &tasks[i];
+
+            if(CTK_Waiting == task->status && 0 != task->deadline_ns && task->deadline_ns <= now) {
+                task_unwatch(task);
+                task->events = 0;
+                task->status = CTK_Ready;
+            }
+        }
+    }
+
+    scheduler = NULL;
+    close(sched.epoll_fd);
+    free(tasks);
+    cur_suite = suite;
+}
+#endif
+
+int CTest_await_fd(int fd, int events, int timeout_ms) {
+#ifdef __linux__
+    if(NULL != scheduler && NULL != scheduler->running) {
+        CTestTask* task = scheduler->running;
+        struct epoll_event event;
+
+        task->fd = -1;
+        task->events = 0;
+        task->deadline_ns = (timeout_ms >= 0) ? CTest_time_ns() + (uint64_t)timeout_ms * 1000000 : 0;
+
+        if(fd >= 0) {
+            memset(&event, 0, sizeof(event));
+            event.events = ((events & CTEST_READ) ? EPOLLIN : 0) | ((events & CTEST_WRITE) ? EPOLLOUT : 0);
+            event.data.ptr = task;
+            // Each task registers its own duplicate, so that several tasks may wait on one descriptor
+            task->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+
+            if(task->fd < 0 || 0 != epoll_ctl(scheduler->epoll_fd, EPOLL_CTL_ADD, task->fd, &event)) {
+                task_unwatch(task);
+                return -1;
+            }
+        }
+
+        task->status = CTK_Waiting;
+        swapcontext(&task->context, &scheduler->context);
+        return task->events;
+    }
+#endif
+#ifndef WIN32
+    {
+        struct pollfd item;
+        int res;
+
+        item.fd = fd;
+        item.events = (short)(((events & CTEST_READ) ? POLLIN : 0) | ((events & CTEST_WRITE) ? POLLOUT : 0));
+        item.revents = 0;
+        res = poll(&item, (fd >= 0) ? 1 : 0, timeout_ms);
+
+        if(res <= 0) {
+            return res;
+        }
+
+        return ((item.revents & (POLLIN | POLLHUP | POLLERR)) ? CTEST_READ : 0) | ((item.revents & (POLLOUT | POLLERR)) ? CTEST_WRITE : 0);
+    }
+#else
+    (void)fd;
+    Sleep((timeout_ms > 0) ? (DWORD)timeout_ms : 0);
+    return events;
+#endif
+}
+
+void CTest_sleep_ms(int ms) {
+    CTest_await_fd(-1, 0, ms);
+}
+
+int runs_concurrently(const CTestCase* test) {
+    return pool_eligible(test) || async_eligible(test);
+}
+
+// Run the pool and async tests of the list (see collect_tests()). Return: number of tests run
+unsigned int run_concurrent_tests(CTestSuite* suite, const unsigned int* plan, unsigned int plan_size) {
+    CTestCase** tests;
+    unsigned int count = 0, total = 0;
+
+#ifndef WIN32
+    if(options.workers > 1) {
+        tests = collect_tests(suite, plan, plan_size, pool_eligible, &count);
+
+        if(0 != count) {
+            pool_run(suite, tests, count);
+        }
+
+        free(tests);
+        total += count;
+    }
+#endif
+#ifdef __linux__
+    tests = collect_tests(suite, plan, plan_size, async_eligible, &count);
+
+    if(0 != count) {
+        async_run(suite, tests, count);
+    }
+
+    free(tests);
+    total += count;
+#endif
+    (void)tests;
+    return total;
+}
+
+// Suite not run because dependency failed or was skipped
+void skip_suite(CTestSuite* suite, const CTestSuite* dependency) {
+    CTestCase* test;
+    char* msg = CT_asprintf("Suite skipped, dependency '%s' %s", dependency->name,
+                            (CTEST_SUITE_SKIPPED == registry.suite_failed[dependency->index]) ? "was skipped" : "failed");
+
+    xprintf("\nWARNING - Suite '%s' skipped, dependency '%s' did not pass.", suite->name, dependency->name);
+
+    registry.suite_failed[suite->index] = CTEST_SUITE_SKIPPED;
+    summary.suites_skipped++;
+
+    for(test = suite->test; NULL != test; test = test->next) {
+        summary.tests_skipped += (0 != test->active && registry.test_active[test->index]);
+    }
+
+    append_failure(CUF_DependencyFailed, 0, msg, CTEST_COPY_MESSAGE, "CTest System", suite, NULL, 0);
+    free(msg);
+}
+
+void run_single_suite(CTestSuite* suite) {
+    CTestCase* test = NULL;
+    unsigned int nStartFailures;
+
+    /* keep track of the last failure BEFORE running the test */
+    CTest_FailureRecord* pLastFailure = last_failure;
+
+    assert(NULL != suite);
+
+    nStartFailures = summary.failure_records;
+
+    cur_test = NULL;
+    cur_suite = suite;
+
+    /* suites without tests selected by --filter/--shard are not run at all */
+    if(suite->active && (0 == registry.suite_active[suite->index]) && (0 != suite->number_of_tests)) {
+        cur_suite = NULL;
+        return;
+    }
+
+    /* run suite if it's active */
+    if(suite->active) {
+
+        /* run the suite initialization function, if any */
+        if((NULL != suite->initialize) && (0 != (*suite->initialize)())) {
+            /* init function had an error - call handler, if any */
+            assert(NULL != suite);
+            assert(NULL != suite->name);
+            xprintf("\nWARNING - Suite initialization failed for '%s'.", suite->name);
+
+            summary.suites_failed++;
+            append_failure(CUF_SuiteInitFailed, 0, "Suite Initialization failed - Suite Skipped", 0, "CTest System", suite, NULL, 0);
+
+            // Dependents are skipped through suite_blocker(), the other suites still run
+            registry.suite_failed[suite->index] = CTEST_SUITE_FAILED;
+            suite_done(suite);
+        } else { /* reach here if no suite initialization, or if it succeeded */
+            notify_suite_start(suite);
+            run_concurrent_tests(suite, NULL, 0);
+            test = suite->test;
+
+            while(NULL != test) {
+                if(0 != test->active) {
+                    if(registry.test_active[test->index] && !runs_concurrently(test)) {
+                        run_single_test(test);
+                    }
+                } else {
+                    summary.tests_inactive++;
+                    append_failure(CUF_TestInactive, 0, "Test inactive", 0, "CTest System", suite, test, 0);
+                }
+
+                test = test->next;
+            }
+
+            summary.suites_run++;
+
+            /* call the suite cleanup function, if any */
+            if((NULL != suite->cleanup) && (0 != (*suite->cleanup)())) {
+                assert(NULL != suite);
+                assert(NULL != suite->name);
+                xprintf("\nWARNING - Suite cleanup failed for '%s'.", suite->name);
+
+                summary.suites_failed++;
+                registry.suite_failed[suite->index] = CTEST_SUITE_FAILED;
+                append_failure(CUF_SuiteCleanupFailed, 0, "Suite cleanup failed.", 0, "CTest System", suite, NULL, 0);
+            }
+
+            suite_done(suite);
+            notify_suite_end(suite);
+        }
+    } else { /* otherwise record inactive suite and failure if appropriate */
+        summary.suites_inactive++;
+
+        append_failure(CUF_SuiteInactive, 0, "Suite inactive", 0, "CTest System", suite, NULL, 0);
+    }
+
+    //if additional failures have occurred..
+    if(summary.failure_records > nStartFailures) {
+        if(NULL != pLastFailure) {
+            pLastFailure = pLastFailure->next;  /* was a previous failure, so go to next one */
+        } else {
+            pLastFailure = failure_list;       /* no previous failure - go to 1st one */
+        }
+    } else {
+        pLastFailure = NULL;                   /* no additional failure - set to NULL */
+    }
+
+    cur_suite = NULL;
+}
+
+// Run the suites in dependency order, dependents of a failed suite are skipped
+void run_suites() {
+    unsigned int* order = suite_order(NULL, 0);
+    CTestSuite* suite;
+    CTestSuite* blocker;
+    unsigned int k;
+
+    for(k = 0; k < registry.suites; k++) {
+        suite = registry.suite_handle[order[k]];
+        blocker = suite_blocker(suite);
+
+        if(NULL != blocker && suite->active && (0 != registry.suite_active[suite->index] || 0 == suite->number_of_tests)) {
+            skip_suite(suite, blocker);
+        } else {
+            run_single_suite(suite);
+        }
+    }
+
+    free(order);
+}
+
+void cleanup_failure_list() {
+    CTest_FailureRecord* cur = NULL;
+    CTest_FailureRecord* next = NULL;
+
+    cur = failure_list;
+
+    while(NULL != cur) {
+        // Message and payload live in the same allocation
+        next = cur->next;
+        free(cur);
+        cur = next;
+    }
+
+    failure_list = NULL;
+}
+
+void clear_previous_results() {
+    summary.suites_run = 0;
+    summary.suites_failed = 0;
+    summary.suites_inactive = 0;
+    summary.tests_run = 0;
+    summary.tests_failed = 0;
+    summary.tests_inactive = 0;
+    summary.asserts = 0;
+    summary.asserts_failed = 0;
+    summary.failure_records = 0;
+    summary.elapsed_time = 0.0;
+    CTest_asserts_passed = 0;
+
+    if(NULL != failure_list) {
+        cleanup_failure_list(failure_list);
+    }
+
+    last_failure = NULL;
+    last_emitted_failure = NULL;
+
+    summary.tests_quarantined = 0;
+    free(usages);
+    usages = NULL;
+    usage_count = usage_capacity = 0;
+    limit_violations = 0;
+    free(reruns);
+    reruns = NULL;
+    rerun_count = 0;
+    free(bisects);
+    bisects = NULL;
+    bisect_count = 0;
+
+    if(NULL != registry.test_failed) {
+        memset(registry.test_failed, 0, registry.tests * sizeof(unsigned int));
+    }
+
+    summary.suites_skipped = 0;
+    summary.tests_skipped = 0;
+    histogram_clear();
+    stress_clear();
+
+    if(NULL != registry.suite_failed) {
+        memset(registry.suite_failed, 0, registry.suites);
+    }
+}
+
+size_t number_width(uint64_t number) {
+    char buf[33];
+
+    snprintf(buf, 33, "%llu", (unsigned long long)number);
+    buf[32] = '\0';
+    return strlen(buf);
+}
+
+// Report sections of the runner modes, defined below
+char* report_sections();
+
+char* CU_get_run_results_string() {
+    int width[9];
+    size_t len;
+    char* result;
+    char* extra;
+
+    width[0] = (int)strlen("Run Summary:");
+    width[1] = max_int(5, 6, strlen("Type"), strlen("suites"), strlen("tests"), strlen("asserts")) + 1;
+    width[2] = max_int(5, 6, strlen("Total"), number_width(registry.number_of_suites), number_width(registry.number_of_tests), number_width(summary.asserts)) + 1;
+    width[3] = max_int(5, 6, strlen("Ran"), number_width(summary.suites_run), number_width(summary.tests_run), number_width(summary.asserts)) + 1;
+    width[4] = max_int(5, 6, strlen("Passed"), strlen("n/a"), number_width(summary.tests_run - summary.tests_failed), number_width(summary.asserts - summary.asserts_failed)) + 1;
+    width[5] = max_int(5, 6, strlen("Failed"), number_width(summary.suites_failed), number_width(summary.tests_failed), number_width(summary.asserts_failed)) + 1;
+    width[6] = max_int(5, 6, strlen("Inactive"), number_width(summary.suites_inactive), number_width(summary.tests_inactive), strlen("n/a")) + 1;
+
+    width[7] = (int)strlen("Elapsed time = ");
+    width[8] = (int)strlen(" seconds");
+
+    len = 13 + 4 * (size_t)(width[0] + width[1] + width[2] + width[3] + width[4] + width[5] + width[6]) + width[7] + width[8] + 1 + 2;
+    result = (char*)malloc(len);
+
+    if(NULL != result) {
+        snprintf(result, len, "\n%*s%*s%*s%*s%*s%*s%*s\n"   /* if you change this, be sure  */
+                 "%*s%*s%*u%*u%*s%*u%*u\n"   /* to change the calculation of */
+                 "%*s%*s%*u%*u%*u%*u%*u\n"   /* len above!                   */
+                 "%*s%*s%*llu%*llu%*llu%*llu%*s\n\n"
+                 "%*s%8.3f%*s",
+                 width[0], "Run Summary:",
+                 width[1], "Type",
+                 width[2], "Total",
+                 width[3], "Ran",
+                 width[4], "Passed",
+                 width[5], "Failed",
+                 width[6], "Inactive",
+                 width[0], " ",
+                 width[1], "suites",
+                 width[2], registry.number_of_suites,
+                 width[3], summary.suites_run,
+                 width[4], "n/a",
+                 width[5], summary.suites_failed,
+                 width[6], summary.suites_inactive,
+                 width[0], " ",
                  width[1], "tests",
                  width[2], registry.number_of_tests,
                  width[3], summary.tests_run,
@@ -729,75 +5899,2294 @@ char* CU_get_run_results_string() {
                  width[6], summary.tests_inactive,
                  width[0], " ",
                  width[1], "asserts",
-                 width[2], summary.asserts,
-                 width[3], summary.asserts,
-                 width[4], summary.asserts - summary.asserts_failed,
-                 width[5], summary.asserts_failed,
+                 width[2], (unsigned long long)summary.asserts,
+                 width[3], (unsigned long long)summary.asserts,
+                 width[4], (unsigned long long)(summary.asserts - summary.asserts_failed),
+                 width[5], (unsigned long long)summary.asserts_failed,
                  width[6], "n/a",
                  width[7], "Elapsed time = ", get_elapsed_time(),  /* makes sure time is updated */
                  width[8], " seconds"
                 );
         result[len - 1] = '\0';
+
+        extra = report_sections();
+
+        if(NULL != extra) {
+            char* joined = CT_asprintf("%s%s", result, extra);
+            free(result);
+            free(extra);
+            result = joined;
+        }
+    }
+
+    return result;
+}
+
+void all_tests_complete_report() {
+    printf("\n\n");
+
+    char* summary_string;
+    summary_string = CU_get_run_results_string();
+
+    if(NULL != summary_string) {
+        xprintf("%s", summary_string);
+        free(summary_string);
+    } else {
+        xprintf("An error occurred printing the run results.");
+    }
+
+    printf("\n");
+}
+
+// Suite initialization of a run plan segment. Return: 0 - OK, -1 - the initialization failed (recorded,
+// the suite is marked failed for suite_blocker())
+int open_plan_suite(CTestSuite* suite) {
+    cur_test = NULL;
+    cur_suite = suite;
+
+    if((NULL != suite->initialize) && (0 != (*suite->initialize)())) {
+        xprintf("\nWARNING - Suite initialization failed for '%s'.", suite->name);
+
+        summary.suites_failed++;
+        append_failure(CUF_SuiteInitFailed, 0, "Suite Initialization failed - Suite Skipped", 0, "CTest System", suite, NULL, 0);
+        registry.suite_failed[suite->index] = CTEST_SUITE_FAILED;
+        suite_done(suite);
+        return -1;
+    }
+
+    notify_suite_start(suite);
+    return 0;
+}
+
+void close_plan_suite(CTestSuite* suite) {
+    cur_test = NULL;
+    cur_suite = suite;
+
+    if((NULL != suite->cleanup) && (0 != (*suite->cleanup)())) {
+        xprintf("\nWARNING - Suite cleanup failed for '%s'.", suite->name);
+
+        summary.suites_failed++;
+        registry.suite_failed[suite->index] = CTEST_SUITE_FAILED;
+        append_failure(CUF_SuiteCleanupFailed, 0, "Suite cleanup failed.", 0, "CTest System", suite, NULL, 0);
+    }
+
+    suite_done(suite);
+    notify_suite_end(suite);
+    cur_suite = NULL;
+}
+
+#define PLAN_COUNTED 1                  // Suite counted as run
+#define PLAN_INIT_FAILED 2              // Suite initialization failed, its later segments are dropped
+
+// Run registry.plan. A suite is initialized again whenever the plan returns to it,
+// but is counted as run once. A segment of a suite whose dependency did not pass is skipped,
+// the segments of a suite whose initialization failed are dropped.
+void run_plan() {
+    CTestSuite* suite;
+    CTestSuite* open = NULL;
+    CTestSuite* blocker;
+    CTestCase* test;
+    unsigned char* counted = (unsigned char*)calloc(registry.suites + 1, 1);
+    unsigned int k;
+
+    if(NULL == counted) {
+        error("Memory allocation failed");
+    }
+
+    // Suites without planned tests keep their usual handling
+    for(suite = registry.suite; suite; suite = suite->next) {
+        if(0 == suite->active || 0 == suite->number_of_tests) {
+            run_single_suite(suite);
+        }
+    }
+
+    for(k = 0; k < registry.plan_size; k++) {
+        test = registry.test_handle[registry.plan[k]];
+        suite = registry.suite_handle[registry.test_suite[test->index]];
+
+        if(suite != open) {
+            if(NULL != open) {
+                close_plan_suite(open);
+                open = NULL;
+            }
+
+            blocker = suite_blocker(suite);
+
+            if(NULL != blocker || PLAN_INIT_FAILED == counted[suite->index] || 0 != open_plan_suite(suite)) {
+                if(NULL != blocker) {
+                    skip_suite(suite, blocker);
+                } else {
+                    counted[suite->index] = PLAN_INIT_FAILED;
+                    cur_suite = NULL;
+                }
+
+                while(k + 1 < registry.plan_size && registry.test_suite[registry.plan[k + 1]] == suite->index) {
+                    k++;
+                }
+
+                continue;
+            }
+
+            open = suite;
+            run_concurrent_tests(suite, registry.plan + k, registry.plan_size - k);
+
+            if(0 == counted[suite->index]) {
+                counted[suite->index] = PLAN_COUNTED;
+                summary.suites_run++;
+            }
+        }
+
+        cur_suite = suite;
+
+        if(runs_concurrently(test)) {
+            // Ran with the segment
+        } else if(0 != test->active) {
+            run_single_test(test);
+        } else {
+            summary.tests_inactive++;
+            append_failure(CUF_TestInactive, 0, "Test inactive", 0, "CTest System", suite, test, 0);
+        }
+    }
+
+    if(NULL != open) {
+        close_plan_suite(open);
+    }
+
+    free(counted);
+}
+
+// List of owned strings
+typedef struct CTestNameList {
+    char**          items;
+    unsigned int    count;
+    unsigned int    capacity;
+} CTestNameList;
+
+int name_list_has(const CTestNameList* list, const char* name) {
+    unsigned int i;
+
+    for(i = 0; i < list->count; i++) {
+        if(0 == strcmp(list->items[i], name)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void name_list_add(CTestNameList* list, const char* name) {
+    if(list->count == list->capacity) {
+        list->capacity = (0 != list->capacity) ? list->capacity * 2 : 16;
+        list->items = (char**)grow_array(list->items, list->capacity, sizeof(char*));
+    }
+
+    list->items[list->count++] = CT_asprintf("%s", name);
+}
+
+void name_list_clear(CTestNameList* list) {
+    unsigned int i;
+
+    for(i = 0; i < list->count; i++) {
+        free(list->items[i]);
+    }
+
+    list->count = 0;
+}
+
+#ifndef WIN32
+// == Child processes ==
+// Runner modes re-execute the binary with the same command line and read its --event-fd stream.
+
+int self_exe(char* path, size_t size) {
+#ifdef __linux__
+    ssize_t len = readlink("/proc/self/exe", path, size - 1);
+
+    if(len > 0) {
+        path[len] = '\0';
+        return 0;
+    }
+#endif
+
+    if(NULL == options.argv || NULL == options.argv[0] || strlen(options.argv[0]) >= size) {
+        return -1;
+    }
+
+    strcpy(path, options.argv[0]);
+    return 0;
+}
+
+// Options that control the parent run are not passed to children
+int parent_option(const char* arg) {
+    static const char* prefixes[] = {"--watch", "--event-fd=", "--run-order=", "--run-index=", "--rerun-failures=", "--bisect-order",
+                                     "--journal", "--resume", "--coordinator=", "--local-workers=", "--batch=", "--worker=",
+                                     "--histograms="};
+    unsigned int i;
+
+    for(i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+        if(0 == strncmp(arg, prefixes[i], strlen(prefixes[i]))) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Start the binary with extra arguments, stdout discarded.
+// Return: pid and the read end of its event stream in *events (NULL - no stream), -1 on error
+pid_t spawn_self(const char* exe, char** extra, unsigned int extra_count, int* events) {
+    char fd_arg[32];
+    char** argv;
+    unsigned int i;
+    int fds[2] = {-1, -1}, argc = 0;
+    pid_t pid;
+
+    if(NULL != events && 0 != pipe(fds)) {
+        return -1;
+    }
+
+    argv = (char**)calloc((size_t)options.argc + extra_count + 2, sizeof(char*));
+
+    if(NULL == argv) {
+        error("Memory allocation failed");
+    }
+
+    snprintf(fd_arg, sizeof(fd_arg), "--event-fd=%d", fds[1]);
+    argv[argc++] = (char*)exe;
+
+    for(i = 1; i < (unsigned int)options.argc; i++) {
+        if(!parent_option(options.argv[i])) {
+            argv[argc++] = options.argv[i];
+        }
+    }
+
+    for(i = 0; i < extra_count; i++) {
+        argv[argc++] = extra[i];
+    }
+
+    if(NULL != events) {
+        argv[argc++] = fd_arg;
+    }
+
+    fflush(stdout);
+    pid = fork();
+
+    if(0 == pid) {
+        // Console output of the child is replaced by the parent report
+        int null_fd = open("/dev/null", O_WRONLY);
+
+        if(NULL != events) {
+            close(fds[0]);
+        }
+
+        if(null_fd >= 0) {
+            dup2(null_fd, STDOUT_FILENO);
+            close(null_fd);
+        }
+
+        execv(exe, argv);
+        _exit(127);
+    }
+
+    free(argv);
+
+    if(NULL == events) {
+        return pid;
+    }
+
+    close(fds[1]);
+
+    if(pid < 0) {
+        close(fds[0]);
+        return -1;
+    }
+
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    *events = fds[0];
+    return pid;
+}
+#endif
+
+#ifdef __linux__
+// == Watch mode ==
+// The supervisor re-executes the binary with --event-fd and --run-order,
+// prints results from the event stream and waits for inotify events.
+
+typedef struct CTestWatch {
+    int             wd;
+    char*           dir;
+    char*           only;           // Watched file name in dir, NULL - any file
+} CTestWatch;
+
+typedef struct CTestWatchRun {
+    CTestNameList   failed;         // "suite\ttest" of failed tests
+    CTestNameList   changed;        // Paths changed since the last run
+    CTestNameList   report;         // Failures of the running test
+    char*           test;           // Running test, "suite\ttest"
+    char*           suite;          // Suite of the last printed header
+    int             run_end;
+} CTestWatchRun;
+
+void watch_event(const CTestEvent* event, void* context) {
+    CTestWatchRun* run = (CTestWatchRun*)context;
+    unsigned int i;
+
+    switch(event->type) {
+    case CTE_TestStart:
+        if(NULL == run->suite || 0 != strcmp(run->suite, event->suite_name)) {
+            free(run->suite);
+            run->suite = CT_asprintf("%s", event->suite_name);
+            printf("\n--== %s ==--", event->suite_name);
+        }
+
+        free(run->test);
+        run->test = CT_asprintf("%s\t%s", event->suite_name, event->name);
+        printf("\n  * %s.. ", event->name);
+        break;
+
+    case CTE_Failure: {
+        CTest_FailureRecord record;
+        char* text;
+
+        memset(&record, 0, sizeof(record));
+        record.message = event->message;
+        record.payload = (CTest_PayloadType)event->payload;
+        record.actual = event->actual;
+        record.expected = event->expected;
+        record.actual_str = event->actual_str;
+        record.expected_str = event->expected_str;
+        record.actual_len = (NULL != event->actual_str) ? strlen(event->actual_str) : 0;
+        record.expected_len = (NULL != event->expected_str) ? strlen(event->expected_str) : 0;
+
+        text = CTest_format_failure(&record);
+
+        if(CTEST_NO_TEST == event->test) {
+            printf("\n  %s:%u  - %s", (NULL != event->file) ? event->file : "", event->line, text);
+        } else {
+            char* line = CT_asprintf("%s:%u  - %s", (NULL != event->file) ? event->file : "", event->line, text);
+            name_list_add(&run->report, line);
+            free(line);
+        }
+
+        free(text);
+        break;
+    }
+
+    case CTE_TestEnd:
+        if(CTS_Passed == event->status) {
+            printf("OK");
+        } else {
+            printf("FAIL");
+
+            for(i = 0; i < run->report.count; i++) {
+                printf("\n    %u. %s", i + 1, run->report.items[i]);
+            }
+
+            if(CTS_Failed == event->status && NULL != run->test) {
+                name_list_add(&run->failed, run->test);
+            }
+        }
+
+        name_list_clear(&run->report);
+        free(run->test);
+        run->test = NULL;
+        break;
+
+    case CTE_RunEnd:
+        printf("\n\nRun: %llu tests, %llu failed, %llu asserts, %llu failed asserts, %.3f sec\n",
+               (unsigned long long)event->count[3], (unsigned long long)event->count[4],
+               (unsigned long long)event->asserts, (unsigned long long)event->asserts_failed,
+               (double)event->duration_ns / 1e9);
+        run->run_end = 1;
+        break;
+
+    default:
+        break;
+    }
+
+    fflush(stdout);
+}
+
+// Execute the binary once, streaming its results
+void watch_run_child(const char* exe, CTestWatchRun* run) {
+    char order[] = "/tmp/ctest-order-XXXXXX";
+    char order_arg[64];
+    char* extra[1];
+    unsigned char buf[4096];
+    CTestDecoder decoder;
+    ssize_t size;
+    unsigned int i;
+    int events = -1, status = 0, bad = 0;
+    int order_fd = mkstemp(order);
+    FILE* f = (order_fd >= 0) ? fdopen(order_fd, "w") : NULL;
+    pid_t pid;
+
+    if(NULL != f) {
+        for(i = 0; i < run->failed.count; i++) {
+            fprintf(f, "F\t%s\n", run->failed.items[i]);
+        }
+
+        for(i = 0; i < run->changed.count; i++) {
+            fprintf(f, "C\t%s\n", run->changed.items[i]);
+        }
+
+        fclose(f);
+    }
+
+    name_list_clear(&run->failed);
+    name_list_clear(&run->changed);
+    run->run_end = 0;
+    free(run->suite);
+    run->suite = NULL;
+
+    snprintf(order_arg, sizeof(order_arg), "--run-order=%s", order);
+    extra[0] = order_arg;
+
+    printf("\n[watch] running %s\n", exe);
+    fflush(stdout);
+    pid = spawn_self(exe, extra, 1, &events);
+    CTest_decoder_init(&decoder);
+
+    while(pid > 0) {
+        size = read(events, buf, sizeof(buf));
+
+        if(size < 0 && EINTR == errno) {
+            continue;
+        }
+
+        if(size <= 0) {
+            break;
+        }
+
+        if(!bad && 0 != CTest_decoder_feed(&decoder, buf, (size_t)size, watch_event, run)) {
+            printf("\n[watch] malformed event stream");
+            bad = 1;
+        }
+    }
+
+    CTest_decoder_free(&decoder);
+
+    if(pid > 0) {
+        close(events);
+        waitpid(pid, &status, 0);
+    }
+
+    if(NULL != run->test) {
+        // Died inside a test: report it and run it first next time
+        if(WIFSIGNALED(status)) {
+            printf("CRASH (signal %d)", WTERMSIG(status));
+        } else {
+            printf("CRASH (exit %d)", WEXITSTATUS(status));
+        }
+
+        name_list_add(&run->failed, run->test);
+        name_list_clear(&run->report);
+        free(run->test);
+        run->test = NULL;
+    }
+
+    if(!run->run_end) {
+        printf("\n[watch] run did not complete (%s %d)\n", WIFSIGNALED(status) ? "signal" : "exit",
+               WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+    }
+
+    fflush(stdout);
+    unlink(order);
+}
+
+void watch_add(CTestWatch** watches, unsigned int* count, int fd, const char* path) {
+    struct stat st;
+    CTestWatch* w;
+    char* dir;
+    char* only = NULL;
+    char* slash;
+
+    if(0 != stat(path, &st)) {
+        printf("[watch] cannot watch %s\n", path);
+        return;
+    }
+
+    dir = CT_asprintf("%s", path);
+
+    if(!S_ISDIR(st.st_mode)) {
+        // Files are watched through their directory: editors and linkers replace them
+        slash = strrchr(dir, '/');
+
+        if(NULL == slash) {
+            only = dir;
+            dir = CT_asprintf(".");
+        } else {
+            only = CT_asprintf("%s", slash + 1);
+            *slash = '\0';
+
+            if('\0' == dir[0]) {
+                strcpy(dir, "/");
+            }
+        }
+    }
+
+    *watches = (CTestWatch*)grow_array(*watches, *count + 1, sizeof(CTestWatch));
+    w = &(*watches)[*count];
+    w->wd = inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+    w->dir = dir;
+    w->only = only;
+
+    if(w->wd < 0) {
+        printf("[watch] cannot watch %s\n", path);
+        free(dir);
+        free(only);
+        return;
+    }
+
+    (*count)++;
+}
+
+// Block until something changes, then collect changes until 200 ms of quiet
+void watch_wait(int fd, CTestWatch* watches, unsigned int count, CTestNameList* changed) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd p;
+    const struct inotify_event* event;
+    ssize_t size;
+    unsigned int i;
+    int res, got = 0;
+    char* pos;
+
+    p.fd = fd;
+    p.events = POLLIN;
+
+    for(;;) {
+        res = poll(&p, 1, got ? 200 : -1);
+
+        if(res < 0 && EINTR == errno) {
+            continue;
+        }
+
+        if(res <= 0) {
+            return;
+        }
+
+        size = read(fd, buf, sizeof(buf));
+
+        if(size <= 0) {
+            continue;
+        }
+
+        for(pos = buf; pos < buf + size; pos += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event*)pos;
+
+            // Hidden and backup files of editors are ignored
+            if(0 == event->len || '.' == event->name[0] || '~' == event->name[strlen(event->name) - 1]) {
+                continue;
+            }
+
+            for(i = 0; i < count; i++) {
+                if(watches[i].wd == event->wd && (NULL == watches[i].only || 0 == strcmp(watches[i].only, event->name))) {
+                    char* path = CT_asprintf("%s/%s", watches[i].dir, event->name);
+
+                    if(!name_list_has(changed, path)) {
+                        name_list_add(changed, path);
+                    }
+
+                    free(path);
+                    got = 1;
+                }
+            }
+        }
+    }
+}
+
+// --watch: never returns
+void watch_tests() {
+    char exe[4096];
+    CTestWatchRun run;
+    CTestWatch* watches = NULL;
+    unsigned int count = 0;
+    int fd = inotify_init1(IN_CLOEXEC);
+
+    // Resolved once: after a rebuild /proc/self/exe names the deleted binary
+    if(0 != self_exe(exe, sizeof(exe)) || fd < 0) {
+        error("--watch: cannot locate the binary or initialize inotify");
+    }
+    memset(&run, 0, sizeof(run));
+
+    watch_add(&watches, &count, fd, exe);
+
+    if(NULL != options.watch_paths) {
+        char* paths = CT_asprintf("%s", options.watch_paths);
+        char* path;
+
+        for(path = strtok(paths, ":"); NULL != path; path = strtok(NULL, ":")) {
+            watch_add(&watches, &count, fd, path);
+        }
+
+        free(paths);
+    }
+
+    for(;;) {
+        watch_run_child(exe, &run);
+        printf("[watch] waiting for changes (%u failed first next run)\n", run.failed.count);
+        fflush(stdout);
+        watch_wait(fd, watches, count, &run.changed);
+    }
+}
+#endif
+
+// == Reruns and quarantine ==
+
+// "suite/test" of a test index, caller must free
+char* test_full_name(unsigned int test) {
+    return CT_asprintf("%s/%s", registry.suite_handle[registry.test_suite[test]]->name, registry.test_name[test]);
+}
+
+// Record the failed tests of the run, failures of quarantined tests are moved out of tests_failed
+void collect_failed_tests() {
+    CTestNameList patterns = {NULL, 0, 0};
+    char line[4096];
+    unsigned int i, j;
+    FILE* f;
+
+    if(NULL != options.quarantine) {
+        f = fopen(options.quarantine, "r");
+
+        if(NULL == f) {
+            xprintf("\nWARNING - Cannot read quarantine file '%s'.", options.quarantine);
+        } else {
+            while(NULL != fgets(line, sizeof(line), f)) {
+                line[strcspn(line, "\r\n")] = '\0';
+
+                if('\0' != line[0] && '#' != line[0]) {
+                    name_list_add(&patterns, line);
+                }
+            }
+
+            fclose(f);
+        }
+    }
+
+    for(i = 0; i < registry.tests; i++) {
+        CTestRerun* rerun;
+
+        if(0 == registry.test_failed[i]) {
+            continue;
+        }
+
+        reruns = (CTestRerun*)grow_array(reruns, rerun_count + 1, sizeof(CTestRerun));
+        rerun = &reruns[rerun_count++];
+        memset(rerun, 0, sizeof(CTestRerun));
+        rerun->test = i;
+
+        if(0 != patterns.count) {
+            char* full = test_full_name(i);
+
+            for(j = 0; j < patterns.count && !rerun->quarantined; j++) {
+                rerun->quarantined = glob_match(patterns.items[j], full);
+            }
+
+            free(full);
+        }
+
+        if(rerun->quarantined) {
+            summary.tests_failed -= registry.test_failed[i];
+            summary.tests_quarantined += registry.test_failed[i];
+        }
+    }
+
+    name_list_clear(&patterns);
+    free(patterns.items);
+}
+
+#ifndef WIN32
+typedef struct CTestRerunChild {
+    pid_t           pid;            // 0 - free slot
+    int             events;
+    unsigned int    rerun;          // Index in reruns
+    int             passed;
+    CTestDecoder    decoder;
+} CTestRerunChild;
+
+void rerun_event(const CTestEvent* event, void* context) {
+    if(CTE_TestEnd == event->type) {
+        ((CTestRerunChild*)context)->passed = (CTS_Passed == event->status);
+    }
+}
+
+// --rerun-failures: every failed test runs options.rerun times alone in a fresh process,
+// up to options.jobs processes at once
+void rerun_failures() {
+    char exe[4096];
+    char index_arg[32];
+    char* extra[1] = {index_arg};
+    unsigned char buf[4096];
+    unsigned int total = rerun_count * options.rerun, next = 0, done = 0, k;
+    CTestRerunChild* children;
+    struct pollfd* polls;
+    ssize_t size;
+    int status;
+
+    if(0 == total) {
+        return;
+    }
+
+    if(0 != self_exe(exe, sizeof(exe))) {
+        xprintf("\nWARNING - Cannot locate the binary, failed tests are not rerun.");
+        return;
+    }
+
+    children = (CTestRerunChild*)calloc(options.jobs, sizeof(CTestRerunChild));
+    polls = (struct pollfd*)calloc(options.jobs, sizeof(struct pollfd));
+
+    if(NULL == children || NULL == polls) {
+        error("Memory allocation failed");
+    }
+
+    while(done < total) {
+        for(k = 0; k < options.jobs && next < total; k++) {
+            CTestRerunChild* child = &children[k];
+
+            if(0 != child->pid) {
+                continue;
+            }
+
+            child->rerun = next++ / options.rerun;
+            child->passed = 0;
+            snprintf(index_arg, sizeof(index_arg), "--run-index=%u", reruns[child->rerun].test);
+            child->pid = spawn_self(exe, extra, 1, &child->events);
+
+            if(child->pid <= 0) {
+                child->pid = 0;
+                reruns[child->rerun].runs++;
+                done++;
+                continue;
+            }
+
+            CTest_decoder_init(&child->decoder);
+        }
+
+        for(k = 0; k < options.jobs; k++) {
+            polls[k].fd = (0 != children[k].pid) ? children[k].events : -1;
+            polls[k].events = POLLIN;
+            polls[k].revents = 0;
+        }
+
+        if(poll(polls, options.jobs, -1) < 0) {
+            continue; // EINTR
+        }
+
+        for(k = 0; k < options.jobs; k++) {
+            CTestRerunChild* child = &children[k];
+
+            if(0 == child->pid || 0 == polls[k].revents) {
+                continue;
+            }
+
+            size = read(child->events, buf, sizeof(buf));
+
+            if(size < 0 && EINTR == errno) {
+                continue;
+            }
+
+            if(size > 0) {
+                CTest_decoder_feed(&child->decoder, buf, (size_t)size, rerun_event, child);
+                continue;
+            }
+
+            // End of stream: the rerun is over
+            close(child->events);
+            waitpid(child->pid, &status, 0);
+            CTest_decoder_free(&child->decoder);
+
+            reruns[child->rerun].runs++;
+            reruns[child->rerun].passed += child->passed ? 1 : 0;
+            child->pid = 0;
+            done++;
+        }
+    }
+
+    free(children);
+    free(polls);
+}
+
+// Running state of the last test of a --bisect-order child
+typedef struct CTestPlanChild {
+    unsigned int    target;
+    int             started;
+    int             ended;
+    int             passed;
+} CTestPlanChild;
+
+void plan_child_event(const CTestEvent* event, void* context) {
+    CTestPlanChild* child = (CTestPlanChild*)context;
+
+    if(event->test != child->target) {
+        return;
+    }
+
+    if(CTE_TestStart == event->type) {
+        child->started = 1;
+    } else if(CTE_TestEnd == event->type) {
+        child->ended = 1;
+        child->passed = (CTS_Passed == event->status);
+    }
+}
+
+// Run tests[0..count) and then target in a new process.
+// Return: 1 - target failed or crashed, 0 - passed or did not run
+int plan_child_fails(const char* exe, const unsigned int* tests, unsigned int count, unsigned int target) {
+    char order[] = "/tmp/ctest-order-XXXXXX";
+    char order_arg[64];
+    char* extra[1] = {order_arg};
+    unsigned char buf[4096];
+    CTestPlanChild child = {target, 0, 0, 0};
+    CTestDecoder decoder;
+    ssize_t size;
+    unsigned int i;
+    int events = -1, status = 0;
+    int fd = mkstemp(order);
+    FILE* f = (fd >= 0) ? fdopen(fd, "w") : NULL;
+    pid_t pid;
+
+    if(NULL == f) {
+        return 0;
+    }
+
+    for(i = 0; i < count; i++) {
+        fprintf(f, "I\t%u\n", tests[i]);
+    }
+
+    fprintf(f, "I\t%u\n", target);
+    fclose(f);
+
+    snprintf(order_arg, sizeof(order_arg), "--run-order=%s", order);
+    pid = spawn_self(exe, extra, 1, &events);
+    CTest_decoder_init(&decoder);
+
+    while(pid > 0) {
+        size = read(events, buf, sizeof(buf));
+
+        if(size < 0 && EINTR == errno) {
+            continue;
+        }
+
+        if(size <= 0) {
+            break;
+        }
+
+        CTest_decoder_feed(&decoder, buf, (size_t)size, plan_child_event, &child);
+    }
+
+    CTest_decoder_free(&decoder);
+
+    if(pid > 0) {
+        close(events);
+        waitpid(pid, &status, 0);
+    }
+
+    unlink(order);
+    return child.started && !(child.ended && child.passed);
+}
+
+// --bisect-order: for each failed test of the run that passes alone, halve the tests
+// preceding it in the plan while the failure still reproduces
+void bisect_order() {
+    char exe[4096];
+    unsigned int* candidates;
+    unsigned int k, n, half;
+    CTestBisect* bisect;
+
+    if(0 != self_exe(exe, sizeof(exe))) {
+        xprintf("\nWARNING - Cannot locate the binary, order is not bisected.");
+        return;
+    }
+
+    candidates = (unsigned int*)malloc((registry.plan_size + 1) * sizeof(unsigned int));
+
+    if(NULL == candidates) {
+        error("Memory allocation failed");
+    }
+
+    for(k = 0; k < registry.plan_size; k++) {
+        unsigned int test = registry.plan[k];
+
+        if(0 == registry.test_failed[test]) {
+            continue;
+        }
+
+        bisects = (CTestBisect*)grow_array(bisects, bisect_count + 1, sizeof(CTestBisect));
+        bisect = &bisects[bisect_count++];
+        memset(bisect, 0, sizeof(CTestBisect));
+        bisect->test = test;
+
+        if(plan_child_fails(exe, NULL, 0, test)) {
+            bisect->state = CTB_FailsAlone;
+            continue;
+        }
+
+        n = k;
+        memcpy(candidates, registry.plan, n * sizeof(unsigned int));
+
+        if(!plan_child_fails(exe, candidates, n, test)) {
+            bisect->state = CTB_NotReproduced;
+            continue;
+        }
+
+        while(n > 1) {
+            half = n / 2;
+
+            if(plan_child_fails(exe, candidates, half, test)) {
+                n = half;
+            } else if(plan_child_fails(exe, candidates + half, n - half, test)) {
+                memmove(candidates, candidates + half, (n - half) * sizeof(unsigned int));
+                n -= half;
+            } else {
+                break; // Needs tests from both halves
+            }
+        }
+
+        bisect->state = (1 == n) ? CTB_Polluter : CTB_Combination;
+        bisect->polluter = candidates[0];
+        bisect->count = n;
+    }
+
+    free(candidates);
+}
+#endif
+
+// == Distributed run ==
+// --coordinator=ADDR serves the selected tests as a work queue on a Unix ("unix:PATH") or TCP
+// ("HOST:PORT") socket. --worker=ADDR processes connect to it, pull batches of tests of one suite,
+// run them like run_plan() does and stream their protocol events back. Coordinator to worker:
+// u32 count, then count u32 test indices; count 0 ends the worker. The tests in flight on a worker
+// that dies go back to the queue; after CTEST_WORKER_ATTEMPTS deaths a test fails with CUF_TestCrashed.
+// A suite is handed out once every suite it depends on has all its results, so independent suites
+// run concurrently on different workers.
+
+#define CTEST_WORKER_ATTEMPTS 3
+#define CTEST_MAX_BATCH 64
+
+typedef struct CTestCoordinator {
+    unsigned int*   queue;          // Tests in hand out order, requeued ones are put back before next
+    unsigned int    queue_size;
+    unsigned int    next;           // First test not handed out
+    unsigned int    remaining;      // Tests without a result
+    unsigned char*  attempts;       // Worker deaths while running each test
+    unsigned char*  counted;        // Suite counted as run
+    unsigned int*   suite_left;     // Queued tests of each suite without a result
+    unsigned int    connected;      // Workers connected now
+    unsigned int    workers, batches, requeued;
+} CTestCoordinator;
+
+CTestCoordinator coordinator = {NULL, 0, 0, 0, NULL, NULL, NULL, 0, 0, 0, 0};
+
+#ifndef WIN32
+// Test of a batch sent to a worker
+typedef struct CTestRemoteTest {
+    unsigned int    test;
+    int             started;
+    CTest_FailureRecord* failures;  // Held until the test ends, dropped if the worker dies
+    CTest_FailureRecord* last;
+    unsigned int    failure_count;
+    CTestReplay     replay;
+} CTestRemoteTest;
+
+typedef struct CTestRemote {
+    int             fd;             // -1 - free slot
+    int             ready;          // RunStart of the same registry received
+    int             rejected;
+    CTestDecoder    decoder;
+    CTestRemoteTest batch[CTEST_MAX_BATCH];
+    unsigned int    batch_size;     // Tests of the batch without a result
+} CTestRemote;
+
+int write_full(int fd, const void* data, size_t size) {
+    const unsigned char* pos = (const unsigned char*)data;
+    ssize_t res;
+
+    while(0 != size) {
+        res = write(fd, pos, size);
+
+        if(res < 0 && EINTR == errno) {
+            continue;
+        }
+
+        if(res <= 0) {
+            return -1;
+        }
+
+        pos += res;
+        size -= (size_t)res;
+    }
+
+    return 0;
+}
+
+int read_full(int fd, void* data, size_t size) {
+    unsigned char* pos = (unsigned char*)data;
+    ssize_t res;
+
+    while(0 != size) {
+        res = read(fd, pos, size);
+
+        if(res < 0 && EINTR == errno) {
+            continue;
+        }
+
+        if(res <= 0) {
+            return -1;
+        }
+
+        pos += res;
+        size -= (size_t)res;
+    }
+
+    return 0;
+}
+
+// Resolve "unix:PATH" or "HOST:PORT" (empty HOST - any address to listen on, loopback to connect to).
+// Return: 0 - OK
+int net_address(const char* addr, int server, struct sockaddr_storage* sa, socklen_t* len) {
+    struct addrinfo hints;
+    struct addrinfo* res = NULL;
+    const char* colon = strrchr(addr, ':');
+    char host[256];
+
+    memset(sa, 0, sizeof(struct sockaddr_storage));
+
+    if(0 == strncmp(addr, "unix:", 5)) {
+        struct sockaddr_un* un = (struct sockaddr_un*)sa;
+
+        if(strlen(addr + 5) >= sizeof(un->sun_path)) {
+            return -1;
+        }
+
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, addr + 5);
+        *len = sizeof(struct sockaddr_un);
+        return 0;
+    }
+
+    if(NULL == colon || (size_t)(colon - addr) >= sizeof(host)) {
+        return -1;
+    }
+
+    memcpy(host, addr, (size_t)(colon - addr));
+    host[colon - addr] = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = server ? AI_PASSIVE : 0;
+
+    if(0 != getaddrinfo(('\0' != host[0]) ? host : NULL, colon + 1, &hints, &res) || NULL == res) {
+        return -1;
+    }
+
+    memcpy(sa, res->ai_addr, res->ai_addrlen);
+    *len = (socklen_t)res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+// Listening (server) or connected socket for addr, -1 on error
+int net_open(const char* addr, int server) {
+    struct sockaddr_storage sa;
+    socklen_t len;
+    int fd, one = 1;
+
+    if(0 != net_address(addr, server, &sa, &len)) {
+        return -1;
+    }
+
+    fd = socket(sa.ss_family, SOCK_STREAM, 0);
+
+    if(fd < 0) {
+        return -1;
+    }
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if(server) {
+        if(AF_UNIX == sa.ss_family) {
+            unlink(((struct sockaddr_un*)&sa)->sun_path);
+        } else {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+
+        if(0 != bind(fd, (struct sockaddr*)&sa, len) || 0 != listen(fd, 64)) {
+            close(fd);
+            return -1;
+        }
+    } else if(0 != connect(fd, (struct sockaddr*)&sa, len)) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Result of a test is complete, failures (NULL - passed) are the tail of failure_list
+void coordinator_result(CTestSuite* suite, CTestCase* test, const CTest_FailureRecord* failures, CTestStatus status,
+                        uint64_t asserts, uint64_t asserts_failed, uint64_t duration_ns) {
+    if(0 == coordinator.counted[suite->index]) {
+        coordinator.counted[suite->index] = 1;
+        summary.suites_run++;
+    }
+
+    cur_suite = suite;
+    notify_test_start(suite, test);
+    notify_test_end(suite, test, failures, duration_ns);
+    journal_test(test, failures, status, asserts, asserts_failed, duration_ns);
+    cur_suite = NULL;
+
+    coordinator.remaining--;
+
+    if(0 == --coordinator.suite_left[suite->index]) {
+        suite_done(suite);
+    }
+}
+
+// Test not run because the initialization of its suite failed on the worker, not counted like in a local run
+void coordinator_skipped(CTestSuite* suite) {
+    coordinator.remaining--;
+
+    if(0 == --coordinator.suite_left[suite->index]) {
+        suite_done(suite);
+    }
+}
+
+// Test without a result from the workers
+void coordinator_crashed(unsigned int index, const char* message) {
+    CTestCase* test = registry.test_handle[index];
+    CTestSuite* suite = registry.suite_handle[registry.test_suite[index]];
+    CTest_FailureRecord* failure = append_failure(CUF_TestCrashed, 0, message, CTEST_COPY_MESSAGE, "CTest System", suite, test, 0);
+
+    summary.tests_run++;
+    summary.tests_failed++;
+    registry.test_failed[index]++;
+    coordinator_result(suite, test, failure, CTS_Failed, 0, 0, 0);
+}
+
+void coordinator_add(CTestCase* test) {
+    if(0 == test->active) {
+        summary.tests_inactive++;
+        append_failure(CUF_TestInactive, 0, "Test inactive", 0, "CTest System", registry.suite_handle[registry.test_suite[test->index]], test, 0);
+    } else {
+        coordinator.queue[coordinator.queue_size++] = test->index;
+    }
+}
+
+// Suite may be handed out: every suite it depends on has all its results
+int coordinator_ready(unsigned int suite) {
+    unsigned int k;
+
+    for(k = registry.dependency_start[suite]; k < registry.dependency_start[suite + 1]; k++) {
+        if(0 != coordinator.suite_left[registry.dependency_list[k]]) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Drop the queued tests of a suite whose dependency did not pass
+void coordinator_skip(unsigned int suite, const CTestSuite* dependency) {
+    unsigned int k, kept = coordinator.next;
+
+    skip_suite(registry.suite_handle[suite], dependency);
+
+    for(k = coordinator.next; k < coordinator.queue_size; k++) {
+        if(registry.test_suite[coordinator.queue[k]] != suite) {
+            coordinator.queue[kept++] = coordinator.queue[k];
+        }
+    }
+
+    coordinator.remaining -= coordinator.queue_size - kept;
+    coordinator.queue_size = kept;
+    coordinator.suite_left[suite] = 0;
+}
+
+// Take the next batch for remote: tests of the first ready suite in the queue, moved to its front.
+// Return: number of tests
+unsigned int coordinator_take(CTestRemote* remote) {
+    unsigned int limit = options.batch, count = 0, suite = 0, pos, end;
+    CTestSuite* blocker;
+
+    if(0 == limit) {
+        // Batches shrink as the queue drains, so the tail is spread over the workers
+        limit = (coordinator.queue_size - coordinator.next) / (4 * ((0 != coordinator.connected) ? coordinator.connected : 1));
+    }
+
+    limit = (limit < 1) ? 1 : ((limit > CTEST_MAX_BATCH) ? CTEST_MAX_BATCH : limit);
+
+    for(pos = coordinator.next; pos < coordinator.queue_size; pos++) {
+        suite = registry.test_suite[coordinator.queue[pos]];
+        blocker = suite_blocker(registry.suite_handle[suite]);
+
+        if(NULL != blocker) {
+            coordinator_skip(suite, blocker);
+            pos--;
+        } else if(coordinator_ready(suite)) {
+            break;
+        }
+    }
+
+    if(pos >= coordinator.queue_size) {
+        return 0;
+    }
+
+    for(end = pos; end < coordinator.queue_size && end - pos < limit && registry.test_suite[coordinator.queue[end]] == suite; end++) {
+        CTestRemoteTest* item = &remote->batch[count++];
+
+        memset(item, 0, sizeof(CTestRemoteTest));
+        item->test = coordinator.queue[end];
+        item->replay.last_row = -1;
+    }
+
+    // Waiting tests keep their order behind the batch
+    memmove(coordinator.queue + coordinator.next + count, coordinator.queue + coordinator.next, (pos - coordinator.next) * sizeof(unsigned int));
+
+    for(end = 0; end < count; end++) {
+        coordinator.queue[coordinator.next++] = remote->batch[end].test;
+    }
+
+    remote->batch_size = count;
+    return count;
+}
+
+// Send the next batch to an idle worker, the empty one when the run is complete. Return: 0 - OK
+int coordinator_send(CTestRemote* remote) {
+    unsigned char buf[4 * (CTEST_MAX_BATCH + 1)];
+    CTestWriter w;
+    unsigned int count = 0, k;
+
+    if(0 != coordinator.remaining) {
+        count = coordinator_take(remote);
+
+        if(0 == count) {
+            return 0;               // Nothing to hand out now, tests may come back from other workers
+        }
+
+        coordinator.batches++;
+    }
+
+    w.pos = buf;
+    w.end = buf + sizeof(buf);
+    w.size = 0;
+    put_u32(&w, count);
+
+    for(k = 0; k < count; k++) {
+        put_u32(&w, remote->batch[k].test);
+    }
+
+    return write_full(remote->fd, buf, w.size);
+}
+
+void remote_event(const CTestEvent* event, void* context) {
+    CTestRemote* remote = (CTestRemote*)context;
+    CTestRemoteTest* item = NULL;
+    CTest_FailureRecord* list = failure_list;
+    CTest_FailureRecord* tail = last_failure;
+    CTestSuite* suite;
+    CTestCase* test;
+    unsigned int k;
+
+    if(CTE_RunStart == event->type) {
+        remote->ready = (event->count[0] == registry.number_of_suites && event->count[1] == registry.number_of_tests);
+        remote->rejected = !remote->ready;
+        return;
+    }
+
+    if(event->suite >= registry.suites) {
+        return;
+    }
+
+    suite = registry.suite_handle[event->suite];
+
+    if(CTE_Failure == event->type && CTEST_NO_TEST == event->test) {
+        // Suite initialization or cleanup, runs for every batch of the suite but fails it once
+        if(0 == registry.suite_failed[suite->index]) {
+            replay_failure(event, suite, NULL);
+            summary.suites_failed += (CUF_SuiteInitFailed == event->failure_type || CUF_SuiteCleanupFailed == event->failure_type);
+            registry.suite_failed[suite->index] = CTEST_SUITE_FAILED;
+        }
+
+        return;
+    }
+
+    for(k = 0; k < remote->batch_size && NULL == item; k++) {
+        if(remote->batch[k].test == event->test) {
+            item = &remote->batch[k];
+        }
+    }
+
+    if(NULL == item) {
+        return;                     // Not in flight on this worker
+    }
+
+    test = registry.test_handle[item->test];
+
+    switch(event->type) {
+    case CTE_TestStart:
+        item->started = 1;
+        break;
+
+    case CTE_Failure:
+        // Tests of a worker with --workers interleave: failures wait in the list of their test
+        failure_list = item->failures;
+        last_failure = item->last;
+
+        if(NULL != replay_failure(event, suite, test)) {
+            item->failure_count++;
+        }
+
+        item->failures = failure_list;
+        item->last = last_failure;
+        failure_list = list;
+        last_failure = tail;
+        replay_row(&item->replay, event);
+        break;
+
+    case CTE_TestEnd:
+        if(NULL != item->failures) {
+            item->failures->prev = last_failure;
+
+            if(NULL != last_failure) {
+                last_failure->next = item->failures;
+            } else {
+                failure_list = item->failures;
+            }
+
+            last_failure = item->last;
+        }
+
+        if(CTS_Skipped == event->status) {
+            coordinator_skipped(suite);
+            *item = remote->batch[--remote->batch_size];
+            break;
+        }
+
+        replay_test_end(&item->replay, event);
+        coordinator_result(suite, test, item->failures, (CTestStatus)event->status, event->asserts,
+                           event->asserts_failed, event->duration_ns);
+        *item = remote->batch[--remote->batch_size];
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Connection of a worker ended: its tests without a result go back to the queue
+void remote_lost(CTestRemote* remote) {
+    int started = 0;
+    unsigned int k;
+
+    for(k = 0; k < remote->batch_size; k++) {
+        started |= remote->batch[k].started;
+    }
+
+    for(k = remote->batch_size; k-- > 0;) {
+        CTestRemoteTest* item = &remote->batch[k];
+        CTest_FailureRecord* next;
+
+        while(NULL != item->failures) {
+            next = item->failures->next;
+            free(item->failures);
+            item->failures = next;
+        }
+
+        summary.failure_records -= item->failure_count;
+
+        // Running tests are to blame, the whole batch if none had started (suite initialization)
+        coordinator.attempts[item->test] += (item->started || !started);
+
+        if(coordinator.attempts[item->test] >= CTEST_WORKER_ATTEMPTS) {
+            char* msg = CT_asprintf("Worker process died %u times running the test", (unsigned int)coordinator.attempts[item->test]);
+            coordinator_crashed(item->test, msg);
+            free(msg);
+        } else {
+            coordinator.queue[--coordinator.next] = item->test;
+            coordinator.requeued++;
+        }
+    }
+
+    remote->batch_size = 0;
+    close(remote->fd);
+    remote->fd = -1;
+    CTest_decoder_free(&remote->decoder);
+    coordinator.connected--;
+}
+
+// Serve the selected tests to --worker processes until every one has a result
+void coordinator_run(int planned) {
+    char exe[4096];
+    char* worker_arg = CT_asprintf("--worker=%s", options.coordinator);
+    char* extra[1] = {worker_arg};
+    unsigned char data[65536];
+    CTestRemote* remotes = NULL;
+    struct pollfd* polls = NULL;
+    pid_t* locals;
+    unsigned int* order;
+    CTestSuite* suite;
+    CTestCase* test;
+    void (*old_pipe)(int);
+    unsigned int capacity = 0, polled, spawned = 0, spawn_limit, alive, k;
+    int listen_fd, fd, status;
+    ssize_t size;
+
+    listen_fd = net_open(options.coordinator, 1);
+
+    if(listen_fd < 0) {
+        error("Cannot listen on the --coordinator address");
+    }
+
+    free(coordinator.queue);
+    free(coordinator.attempts);
+    free(coordinator.counted);
+    free(coordinator.suite_left);
+    memset(&coordinator, 0, sizeof(coordinator));
+    coordinator.queue = (unsigned int*)malloc((registry.tests + 1) * sizeof(unsigned int));
+    coordinator.attempts = (unsigned char*)calloc(registry.tests + 1, 1);
+    coordinator.counted = (unsigned char*)calloc(registry.suites + 1, 1);
+    coordinator.suite_left = (unsigned int*)calloc(registry.suites + 1, sizeof(unsigned int));
+    locals = (pid_t*)calloc(options.local_workers + 1, sizeof(pid_t));
+
+    if(NULL == coordinator.queue || NULL == coordinator.attempts || NULL == coordinator.counted || NULL == coordinator.suite_left || NULL == locals) {
+        error("Memory allocation failed");
+    }
+
+    // Suites without tests to hand out keep their usual handling
+    for(suite = registry.suite; suite; suite = suite->next) {
+        if(0 == suite->active || 0 == suite->number_of_tests) {
+            run_single_suite(suite);
+        }
+    }
+
+    if(planned) {
+        for(k = 0; k < registry.plan_size; k++) {
+            coordinator_add(registry.test_handle[registry.plan[k]]);
+        }
+    } else {
+        order = suite_order(NULL, 0);
+
+        for(k = 0; k < registry.suites; k++) {
+            suite = registry.suite_handle[order[k]];
+
+            if(0 == suite->active || 0 == registry.suite_active[suite->index]) {
+                continue;
+            }
+
+            for(test = suite->test; NULL != test; test = test->next) {
+                if(0 == test->active || registry.test_active[test->index]) {
+                    coordinator_add(test);
+                }
+            }
+        }
+
+        free(order);
+    }
+
+    for(k = 0; k < coordinator.queue_size; k++) {
+        coordinator.suite_left[registry.test_suite[coordinator.queue[k]]]++;
+    }
+
+    coordinator.remaining = coordinator.queue_size;
+    spawn_limit = options.local_workers + CTEST_WORKER_ATTEMPTS * coordinator.queue_size;
+
+    if(0 != options.local_workers && 0 != self_exe(exe, sizeof(exe))) {
+        xprintf("\nWARNING - Cannot locate the binary, no local workers are started.");
+        spawn_limit = 0;
+    }
+
+    old_pipe = signal(SIGPIPE, SIG_IGN); // A worker may go away while a batch is written
+
+    while(0 != coordinator.remaining) {
+        // Local workers are replaced while tests are left to hand out
+        for(k = 0, alive = 0; k < options.local_workers; k++) {
+            if(0 != locals[k] && 0 != waitpid(locals[k], &status, WNOHANG)) {
+                locals[k] = 0;
+            }
+
+            if(0 == locals[k] && spawned < spawn_limit && coordinator.next < coordinator.queue_size) {
+                locals[k] = spawn_self(exe, extra, 1, NULL);
+                locals[k] = (locals[k] > 0) ? locals[k] : 0;
+                spawned++;
+            }
+
+            alive += (0 != locals[k]);
+        }
+
+        if(0 != options.local_workers && 0 == alive && 0 == coordinator.connected && spawned >= spawn_limit) {
+            while(coordinator.next < coordinator.queue_size) {
+                coordinator_crashed(coordinator.queue[coordinator.next++], "No worker left to run the test");
+            }
+
+            break;
+        }
+
+        polls = (struct pollfd*)grow_array(polls, capacity + 1, sizeof(struct pollfd));
+        polls[0].fd = listen_fd;
+        polls[0].events = POLLIN;
+        polls[0].revents = 0;
+
+        for(k = 0; k < capacity; k++) {
+            polls[k + 1].fd = remotes[k].fd;
+            polls[k + 1].events = POLLIN;
+            polls[k + 1].revents = 0;
+        }
+
+        if(poll(polls, capacity + 1, 100) < 0) {
+            continue; // EINTR
+        }
+
+        polled = capacity;
+
+        if(0 != (polls[0].revents & POLLIN) && (fd = accept(listen_fd, NULL, NULL)) >= 0) {
+            int one = 1;
+
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Fails harmlessly on Unix sockets
+
+            for(k = 0; k < capacity && remotes[k].fd >= 0; k++) {
+            }
+
+            if(k == capacity) {
+                remotes = (CTestRemote*)grow_array(remotes, ++capacity, sizeof(CTestRemote));
+            }
+
+            memset(&remotes[k], 0, sizeof(CTestRemote));
+            remotes[k].fd = fd;
+            CTest_decoder_init(&remotes[k].decoder);
+            coordinator.connected++;
+            coordinator.workers++;
+        }
+
+        for(k = 0; k < polled; k++) {
+            CTestRemote* remote = &remotes[k];
+
+            if(remote->fd < 0 || remote->fd != polls[k + 1].fd || 0 == polls[k + 1].revents) {
+                continue;
+            }
+
+            size = read(remote->fd, data, sizeof(data));
+
+            if(size < 0 && EINTR == errno) {
+                continue;
+            }
+
+            if(size > 0 && 0 == CTest_decoder_feed(&remote->decoder, data, (size_t)size, remote_event, remote) && !remote->rejected) {
+                continue;
+            }
+
+            if(remote->rejected) {
+                xprintf("\nWARNING - Worker with other registered tests rejected.");
+            }
+
+            remote_lost(remote);
+        }
+
+        for(k = 0; k < capacity; k++) {
+            if(remotes[k].fd >= 0 && remotes[k].ready && 0 == remotes[k].batch_size && 0 != coordinator_send(&remotes[k])) {
+                remote_lost(&remotes[k]);
+            }
+        }
+    }
+
+    // The empty batch ends the workers
+    for(k = 0; k < capacity; k++) {
+        if(remotes[k].fd >= 0) {
+            if(remotes[k].ready) {
+                coordinator_send(&remotes[k]);
+            }
+
+            close(remotes[k].fd);
+            CTest_decoder_free(&remotes[k].decoder);
+        }
+    }
+
+    close(listen_fd);
+
+    if(0 == strncmp(options.coordinator, "unix:", 5)) {
+        unlink(options.coordinator + 5);
+    }
+
+    for(k = 0; k < options.local_workers; k++) {
+        if(0 != locals[k]) {
+            kill(locals[k], SIGTERM); // Still connecting, the others are done
+            waitpid(locals[k], &status, 0);
+        }
+    }
+
+    signal(SIGPIPE, old_pipe);
+    coordinator.connected = 0;
+    free(remotes);
+    free(polls);
+    free(locals);
+    free(worker_arg);
+}
+
+// Connect to --worker, the coordinator may not listen yet. Return: socket, -1 on error
+int worker_connect() {
+    int fd, tries;
+
+    for(tries = 0; tries < 100; tries++) {
+        fd = net_open(options.worker, 0);
+
+        if(fd >= 0) {
+            int one = 1;
+
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Fails harmlessly on Unix sockets
+            return fd;
+        }
+
+        CTest_sleep_ms(100);
+    }
+
+    return -1;
+}
+
+// Run the batches of the coordinator (events go to options.event_fd) until the empty one
+void worker_run() {
+    unsigned char data[4 * CTEST_MAX_BATCH];
+    unsigned int batch[CTEST_MAX_BATCH];
+    unsigned char* counted = (unsigned char*)calloc(registry.suites + 1, 1);
+    CTestReader r;
+    CTestSuite* suite;
+    CTestCase* test;
+    unsigned int count, k;
+    int opened;
+
+    if(NULL == counted) {
+        error("Memory allocation failed");
+    }
+
+    memset(registry.test_active, 0, registry.tests);
+
+    for(k = 0; k < registry.suites; k++) {
+        registry.suite_active[k] = 0;
+    }
+
+    while(options.event_fd >= 0 && 0 == read_full(options.event_fd, data, 4)) {
+        r.pos = data;
+        r.end = data + 4;
+        r.error = 0;
+        count = get_u32(&r);
+
+        if(0 == count || count > CTEST_MAX_BATCH || 0 != read_full(options.event_fd, data, 4 * count)) {
+            break;
+        }
+
+        r.pos = data;
+        r.end = data + 4 * count;
+
+        for(k = 0; k < count; k++) {
+            batch[k] = get_u32(&r);
+
+            if(batch[k] >= registry.tests || registry.test_suite[batch[k]] != registry.test_suite[batch[0]]) {
+                error("Malformed batch from the coordinator");
+            }
+
+            registry.test_active[batch[k]] = 1;
+        }
+
+        suite = registry.suite_handle[registry.test_suite[batch[0]]];
+        registry.suite_active[suite->index] = count;
+
+        opened = (0 == open_plan_suite(suite));
+
+        if(!opened) {
+            // The coordinator gets the failure and the batch back as skipped, other batches still run
+            for(k = 0; k < count; k++) {
+                emit_test_event(CTE_TestEnd, registry.test_handle[batch[k]], CTS_Skipped, 0, 0, 0);
+            }
+
+            cur_suite = NULL;
+        } else {
+            run_concurrent_tests(suite, batch, count);
+
+            for(k = 0; k < count; k++) {
+                test = registry.test_handle[batch[k]];
+                cur_suite = suite;
+
+                if(0 != test->active && !runs_concurrently(test)) {
+                    run_single_test(test);
+                }
+            }
+
+            close_plan_suite(suite);
+            emit_failures();        // Suite cleanup
+        }
+
+        if(opened && 0 == counted[suite->index]) {
+            counted[suite->index] = 1;
+            summary.suites_run++;
+        }
+
+        for(k = 0; k < count; k++) {
+            registry.test_active[batch[k]] = 0;
+        }
+
+        registry.suite_active[suite->index] = 0;
+    }
+
+    free(counted);
+}
+#endif
+
+// --coordinator or --worker run of the selected tests
+void run_distributed(int planned) {
+#ifndef WIN32
+    if(NULL != options.worker) {
+        worker_run();
+    } else {
+        coordinator_run(planned);
+    }
+#else
+    (void)planned;
+    error("--coordinator and --worker are not supported on this platform");
+#endif
+}
+
+const char* rerun_class(const CTestRerun* rerun) {
+    if(0 == rerun->runs) {
+        return "failed";
+    }
+
+    if(0 == rerun->passed) {
+        return "deterministic-fail";
+    }
+
+    return (rerun->passed == rerun->runs) ? "passed-on-retry" : "flaky";
+}
+
+// Extra sections of the run results, NULL if there is nothing to add
+#define CTEST_TOP_CONSUMERS 5
+
+int usage_by_rss(const void* a, const void* b) {
+    const CTestUsage* x = (const CTestUsage*)a;
+    const CTestUsage* y = (const CTestUsage*)b;
+    return (x->max_rss < y->max_rss) - (x->max_rss > y->max_rss);
+}
+
+int usage_by_cpu(const void* a, const void* b) {
+    uint64_t x = ((const CTestUsage*)a)->user_us + ((const CTestUsage*)a)->sys_us;
+    uint64_t y = ((const CTestUsage*)b)->user_us + ((const CTestUsage*)b)->sys_us;
+    return (x < y) - (x > y);
+}
+
+// Top consumers of the isolated tests, by max RSS and by CPU time
+char* usage_section(char* report) {
+    int (*orders[2])(const void*, const void*) = {usage_by_rss, usage_by_cpu};
+    const char* titles[2] = {"max RSS", "CPU time"};
+    unsigned int i, k;
+    char* line;
+
+    line = CT_asprintf("%s\n\nResource usage of %u isolated test(s), %u limit violation(s):", (NULL != report) ? report : "",
+                       usage_count, limit_violations);
+    free(report);
+    report = line;
+
+    for(k = 0; k < 2; k++) {
+        qsort(usages, usage_count, sizeof(CTestUsage), orders[k]);
+        line = CT_asprintf("%s\n  top by %s:\n  %10s %9s %9s %8s %7s %7s %7s", report, titles[k],
+                           "maxrss KB", "user ms", "sys ms", "minflt", "majflt", "vcsw", "ivcsw");
+        free(report);
+        report = line;
+
+        for(i = 0; i < usage_count && i < CTEST_TOP_CONSUMERS; i++) {
+            const CTestUsage* usage = &usages[i];
+            char* name = test_full_name(usage->test);
+
+            line = CT_asprintf("%s\n  %10ld %9.1f %9.1f %8ld %7ld %7ld %7ld  %s", report, usage->max_rss,
+                               usage->user_us / 1000.0, usage->sys_us / 1000.0, usage->minor_faults, usage->major_faults,
+                               usage->voluntary_switches, usage->involuntary_switches, name);
+            free(name);
+            free(report);
+            report = line;
+        }
+    }
+
+    return report;
+}
+
+char* report_sections() {
+    char* report = NULL;
+    char* line;
+    unsigned int i;
+
+    if(0 != rerun_count && (0 != options.rerun || 0 != summary.tests_quarantined)) {
+        report = CT_asprintf("\n\nFailed tests (%u reruns each, passed/reruns):", options.rerun);
+
+        for(i = 0; i < rerun_count; i++) {
+            const CTestRerun* rerun = &reruns[i];
+
+            char* name = test_full_name(rerun->test);
+
+            line = CT_asprintf("%s\n  %-18s %3u/%-3u %s%s", report, rerun_class(rerun), rerun->passed, rerun->runs,
+                               name, rerun->quarantined ? " [quarantined]" : "");
+            free(name);
+            free(report);
+            report = line;
+        }
+
+        if(0 != summary.tests_quarantined) {
+            line = CT_asprintf("%s\n  %u failed test(s) quarantined, not counted as failed", report, summary.tests_quarantined);
+            free(report);
+            report = line;
+        }
+    }
+
+    if(0 != summary.suites_skipped) {
+        line = CT_asprintf("%s\n\nSkipped by dependency: %u suites, %u tests", (NULL != report) ? report : "",
+                           summary.suites_skipped, summary.tests_skipped);
+        free(report);
+        report = line;
+    }
+
+    if(options.shuffle) {
+        line = CT_asprintf("%s\n\nShuffle seed: %llu (rerun with --shuffle=%llu)", (NULL != report) ? report : "",
+                           (unsigned long long)options.shuffle_seed, (unsigned long long)options.shuffle_seed);
+        free(report);
+        report = line;
+    }
+
+    if(0 != bisect_count) {
+        line = CT_asprintf("%s\n\nOrder dependence:", (NULL != report) ? report : "");
+        free(report);
+        report = line;
+
+        for(i = 0; i < bisect_count; i++) {
+            const CTestBisect* bisect = &bisects[i];
+            char* name = test_full_name(bisect->test);
+            char* polluter = test_full_name(bisect->polluter);
+
+            switch(bisect->state) {
+            case CTB_FailsAlone:
+                line = CT_asprintf("%s\n  %s fails alone", report, name);
+                break;
+
+            case CTB_Polluter:
+                line = CT_asprintf("%s\n  %s fails after %s", report, name, polluter);
+                break;
+
+            case CTB_Combination:
+                line = CT_asprintf("%s\n  %s fails after %u tests together, from %s", report, name, bisect->count, polluter);
+                break;
+
+            default:
+                line = CT_asprintf("%s\n  %s not reproduced after the preceding tests", report, name);
+                break;
+            }
+
+            free(name);
+            free(polluter);
+            free(report);
+            report = line;
+        }
+    }
+
+    if(0 != usage_count) {
+        report = usage_section(report);
+    }
+
+    if(0 != histogram_export_count) {
+        report = histogram_section(report);
+    }
+
+    if(0 != stress_count) {
+        report = stress_section(report);
+    }
+
+    if(cache.enabled) {
+        line = CT_asprintf("%s\n\nResult cache %s: %u replayed, %u run, %u stored", (NULL != report) ? report : "",
+                           options.cache_dir, cache.hits, cache.misses, cache.stored);
+        free(report);
+        report = line;
+    }
+
+    if(NULL != options.coordinator && 0 != coordinator.workers) {
+        line = CT_asprintf("%s\n\nCoordinator %s: %u workers, %u batches, %u tests requeued", (NULL != report) ? report : "",
+                           options.coordinator, coordinator.workers, coordinator.batches, coordinator.requeued);
+        free(report);
+        report = line;
+    }
+
+    if(NULL != options.journal && 0 != journal.resumed + journal.recorded) {
+        line = CT_asprintf("%s\n\nJournal %s: %u tests resumed, %u recorded", (NULL != report) ? report : "",
+                           options.journal, journal.resumed, journal.recorded);
+        free(report);
+        report = line;
+    }
+
+    return report;
+}
+
+unsigned int CU_get_number_of_tests_failed() {
+    return summary.tests_failed;
+}
+
+// == Self benchmark ==
+// Cost of the framework itself, so that changes to it can be judged against numbers
+
+#define CTEST_BENCH_FILE_A "CTEST_BENCH_A.TXT"
+#define CTEST_BENCH_FILE_B "CTEST_BENCH_B.TXT"
+#define CTEST_BENCH_NAME 12
+
+void cleanup_test_registry();
+
+void bench_report(FILE* out, const char* name, unsigned long size, unsigned long count, uint64_t ns) {
+    double per_op = (0 != count) ? (double)ns / (double)count : 0.0;
+
+    fprintf(out, "%s\t%lu\t%lu\t%llu\t%.3f\n", name, size, count, (unsigned long long)ns, per_op);
+    xprintf("  %-20s %10lu %10lu %14.1f ns/op\n", name, size, count, per_op);
+}
+
+// CTest_add_suite()/CTest_add_test() into an empty registry, 1000 tests per suite
+void bench_registry(FILE* out) {
+    static const unsigned long sizes[] = {1000, 10000, 100000, 1000000};
+    CTestRegistry saved = registry;
+    unsigned int k;
+
+    memset(&registry, 0, sizeof(registry));
+
+    for(k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        unsigned long n = sizes[k], i;
+        char* names = (char*)malloc(n * CTEST_BENCH_NAME);
+        CTestSuite* suite = NULL;
+        uint64_t start;
+
+        if(NULL == names) {
+            error("Memory allocation failed");
+        }
+
+        for(i = 0; i < n; i++) {
+            snprintf(names + i * CTEST_BENCH_NAME, CTEST_BENCH_NAME, "t%u", (unsigned int)i);
+        }
+
+        start = CTest_time_ns();
+
+        for(i = 0; i < n; i++) {
+            if(0 == i % 1000) {
+                suite = CTest_add_suite(names + i * CTEST_BENCH_NAME, NULL, NULL, __FILE__, __LINE__);
+            }
+
+            CTest_add_test(suite, names + i * CTEST_BENCH_NAME, (CTestFunc)bench_registry, __FILE__, __LINE__);
+        }
+
+        bench_report(out, "register", n, n, CTest_time_ns() - start);
+        start = CTest_time_ns();
+        cleanup_test_registry();
+        bench_report(out, "cleanup", n, n, CTest_time_ns() - start);
+        free(names);
+    }
+
+    registry = saved;
+}
+
+// Passing and failing assertions, failure recording as the failure list grows
+void bench_asserts(FILE* out) {
+    CTestRunSummary saved_summary = summary;
+    CTest_FailureRecord* saved_list = failure_list;
+    CTest_FailureRecord* saved_last = last_failure;
+    CTest_FailureRecord* saved_emitted = last_emitted_failure;
+    CTestSuite* saved_suite = cur_suite;
+    CTestCase* saved_test = cur_test;
+    uint64_t saved_passed = CTest_asserts_passed;
+    CTestSuite suite;
+    CTestCase test;
+    volatile int value = 1;
+    unsigned long i, done = 0, count = 0;
+    unsigned long steps[] = {1000, 10000, 100000};
+    unsigned int k;
+    uint64_t start;
+
+    memset(&suite, 0, sizeof(suite));
+    memset(&test, 0, sizeof(test));
+    suite.name = "self-benchmark";
+    test.name = "assert";
+    cur_suite = &suite;
+    cur_test = &test;
+    failure_list = NULL;
+    last_failure = NULL;
+
+    count = 100000000;
+    start = CTest_time_ns();
+
+    for(i = 0; i < count; i++) {
+        CU_ASSERT(value);
+    }
+
+    bench_report(out, "assert_pass_inline", 0, count, CTest_time_ns() - start);
+
+    count = 10000000;
+    start = CTest_time_ns();
+
+    for(i = 0; i < count; i++) {
+        CTest(value, "value", __FILE__, __LINE__);
+    }
+
+    bench_report(out, "assert_pass_call", 0, count, CTest_time_ns() - start);
+
+    count = 10000;
+    start = CTest_time_ns();
+
+    for(i = 0; i < count; i++) {
+        CU_ASSERT(!value);
+    }
+
+    bench_report(out, "assert_fail_inline", 0, count, CTest_time_ns() - start);
+    start = CTest_time_ns();
+
+    for(i = 0; i < count; i++) {
+        CU_ASSERT_EQUAL(value, 2);
+    }
+
+    bench_report(out, "assert_fail_int", 0, count, CTest_time_ns() - start);
+    cleanup_failure_list();
+    last_failure = NULL;
+
+    // size - length of the failure list at the end of the step
+    for(k = 0; k < sizeof(steps) / sizeof(steps[0]); k++) {
+        start = CTest_time_ns();
+
+        for(; done < steps[k]; done++) {
+            add_failure(&failure_list, CUF_AssertFailed, __LINE__, "value", __FILE__, cur_suite, cur_test);
+        }
+
+        bench_report(out, "add_failure", steps[k], steps[k] - (0 == k ? 0 : steps[k - 1]), CTest_time_ns() - start);
+    }
+
+    cleanup_failure_list();
+    summary = saved_summary;
+    failure_list = saved_list;
+    last_failure = saved_last;
+    last_emitted_failure = saved_emitted;
+    cur_suite = saved_suite;
+    cur_test = saved_test;
+    CTest_asserts_passed = saved_passed;
+}
+
+// xprintf() of one short line, console output discarded and CONSOLE.TXT restored
+void bench_xprintf(FILE* out) {
+#ifndef WIN32
+    unsigned long i, count = 2000;
+    struct stat st;
+    off_t console_size = (0 == stat("CONSOLE.TXT", &st)) ? st.st_size : -1;
+    int null_fd = open("/dev/null", O_WRONLY);
+    int saved_fd;
+    uint64_t start, ns;
+
+    if(null_fd < 0) {
+        return;
+    }
+
+    fflush(stdout);
+    saved_fd = dup(STDOUT_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    start = CTest_time_ns();
+
+    for(i = 0; i < count; i++) {
+        xprintf("  * %s.. %s\n", "suite/test", "OK");
+    }
+
+    fflush(stdout);
+    ns = CTest_time_ns() - start;
+    dup2(saved_fd, STDOUT_FILENO);
+    close(saved_fd);
+    close(null_fd);
+
+    if(console_size < 0) {
+        remove("CONSOLE.TXT");
+    } else if(0 != truncate("CONSOLE.TXT", console_size)) {
+        // Left as is
+    }
+
+    bench_report(out, "xprintf", 0, count, ns);
+#else
+    (void)out;
+#endif
+}
+
+// compare_files() of two equal files and FileToStr(), 16 MB read per size
+void bench_files(FILE* out) {
+    static const unsigned long sizes[] = {4096, 65536, 1048576, 16777216};
+    unsigned int k;
+
+    for(k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        unsigned long size = sizes[k], count = 16777216 / size, i;
+        char* data = (char*)malloc(size);
+        FILE* f;
+        uint64_t start;
+
+        if(NULL == data) {
+            error("Memory allocation failed");
+        }
+
+        for(i = 0; i < size; i++) {
+            data[i] = (63 == i % 64) ? '\n' : (char)('a' + i % 26);
+        }
+
+        f = fopen(CTEST_BENCH_FILE_A, "w");
+
+        if(NULL != f) {
+            fwrite(data, 1, size, f);
+            fclose(f);
+        }
+
+        f = fopen(CTEST_BENCH_FILE_B, "w");
+
+        if(NULL != f) {
+            fwrite(data, 1, size, f);
+            fclose(f);
+        }
+
+        free(data);
+        start = CTest_time_ns();
+
+        for(i = 0; i < count; i++) {
+            free(compare_files(CTEST_BENCH_FILE_A, CTEST_BENCH_FILE_B));
+        }
+
+        bench_report(out, "compare_files", size, count, CTest_time_ns() - start);
+        start = CTest_time_ns();
+
+        for(i = 0; i < count; i++) {
+            free(FileToStr(CTEST_BENCH_FILE_A));
+        }
+
+        bench_report(out, "FileToStr", size, count, CTest_time_ns() - start);
+    }
+
+    remove(CTEST_BENCH_FILE_A);
+    remove(CTEST_BENCH_FILE_B);
+}
+
+int CTest_self_benchmark(const char* filename) {
+    FILE* out;
+
+    assert(!test_is_running);
+    assert(NULL != filename);
+
+    out = fopen(filename, "w");
+
+    if(NULL == out) {
+        xprintf("ERROR: Cannot write \"%s\"\n", filename);
+        return 1;
     }
 
-    return result;
+    fprintf(out, "# benchmark\tsize\tcount\ttotal_ns\tns_per_op\n");
+    xprintf("\nSelf benchmark:\n  %-20s %10s %10s\n", "benchmark", "size", "count");
+    bench_registry(out);
+    bench_asserts(out);
+    bench_xprintf(out);
+    bench_files(out);
+    fclose(out);
+    xprintf("Results: %s\n", filename);
+
+    return 0;
 }
 
-void all_tests_complete_report() {
-    printf("\n\n");
+void CTest_run_all_tests() {
+    int planned;
 
-    char* summary_string;
-    summary_string = CU_get_run_results_string();
+    if(NULL != options.self_benchmark) {
+        if(0 != CTest_self_benchmark(options.self_benchmark)) {
+            error("Self benchmark failed");
+        }
 
-    if(NULL != summary_string) {
-        xprintf("%s", summary_string);
-        free(summary_string);
-    } else {
-        xprintf("An error occurred printing the run results.");
+        return;
     }
 
-    printf("\n");
-}
+#ifdef __linux__
+    if(options.watch) {
+        watch_tests();
+    }
+#endif
 
-void CTest_run_all_tests() {
-    CTestSuite* suite = NULL;
+#ifndef WIN32
+    if(NULL != options.worker) {
+        // The run is streamed to the coordinator
+        options.event_fd = worker_connect();
+
+        if(options.event_fd < 0) {
+            error("Cannot connect to the --worker address");
+        }
+
+        signal(SIGPIPE, SIG_IGN);   // emit_event() stops when the coordinator is gone
+    }
+#endif
 
     /* Clear results from the previous run */
     clear_previous_results(&failure_list);
+    select_tests();
+    dependency_index();
+#ifndef WIN32
+    journal_start();
+#endif
+    planned = prepare_plan();
+
+    if(options.shuffle) {
+        xprintf("\nShuffle seed: %llu", (unsigned long long)options.shuffle_seed);
+    }
 
     /* test run is starting - set flag */
     test_is_running = 1;
     start_time = clock();
+    cache_start();
+    emit_run_event(CTE_RunStart);
+    notify_run_start();
+    progress_start();
+
+    if(NULL != options.coordinator || NULL != options.worker) {
+        run_distributed(planned);
+    } else if(planned) {
+        run_plan();
+    } else {
+        run_suites();
+    }
 
-    for(suite = registry.suite; suite; suite = suite->next) {
-        run_single_suite(suite);
+    progress_end();
+    collect_failed_tests();
+#ifndef WIN32
+    rerun_failures();
+
+    if(options.bisect) {
+        bisect_order();
     }
 
+    journal_end();
+#endif
+    histogram_save();
+
     /* test run is complete - clear flag */
     test_is_running = 0;
     summary.elapsed_time = ((double)clock() - (double)start_time) / (double)CLOCKS_PER_SEC;
+    emit_run_event(CTE_RunEnd);
 
-    all_tests_complete_report(failure_list);
+    notify_run_end();
 }
 
 void CTest_run_suite(CTestSuite* suite) {
     /* Clear results from the previous run */
     clear_previous_results(&failure_list);
+    select_tests();
 
     assert(NULL != suite);
 
     /* test run is starting - set flag */
     test_is_running = 1;
     start_time = clock();
+    cache_start();
+    emit_run_event(CTE_RunStart);
+    notify_run_start();
 
     run_single_suite(suite);
 
     /* test run is complete - clear flag */
     test_is_running = 0;
     summary.elapsed_time = ((double)clock() - (double)start_time) / (double)CLOCKS_PER_SEC;
+    emit_run_event(CTE_RunEnd);
 
     /* run handler for overall completion, if any */
-    all_tests_complete_report(failure_list);
+    notify_run_end();
 }
 
 int strcmp_ignore_case(const char* src, const char* dest) {
@@ -813,29 +8202,16 @@ int strcmp_ignore_case(const char* src, const char* dest) {
 }
 
 CTestCase* get_test_by_name(const char* szTestName, CTestSuite* suite) {
-    CTestCase* test = NULL;
-    CTestCase* pCur = NULL;
-
     assert(NULL != suite);
     assert(NULL != szTestName);
 
-    pCur = suite->test;
-
-    while(NULL != pCur) {
-        if((NULL != pCur->name) && (!strcmp_ignore_case(pCur->name, szTestName))) {
-            test = pCur;
-            break;
-        }
-
-        pCur = pCur->next;
-    }
-
-    return test;
+    return find_test(suite, szTestName);
 }
 
 void run_test(CTestSuite* suite, CTestCase* test) {
     /* Clear results from the previous run */
     clear_previous_results(&failure_list);
+    select_tests();
 
     assert(NULL != suite);
     assert(NULL != test);
@@ -843,7 +8219,7 @@ void run_test(CTestSuite* suite, CTestCase* test) {
     if(0 == suite->active) {
         summary.suites_inactive++;
 
-        add_failure(&failure_list, CUF_SuiteInactive, 0, "Suite inactive", "CTest System", suite, NULL);
+        append_failure(CUF_SuiteInactive, 0, "Suite inactive", 0, "CTest System", suite, NULL, 0);
     } else if((NULL == test->name) || (NULL == get_test_by_name(test->name, suite))) {
         error("Test not registered in specified suite.");
         return;
@@ -851,6 +8227,9 @@ void run_test(CTestSuite* suite, CTestCase* test) {
         /* test run is starting - set flag */
         test_is_running = 1;
         start_time = clock();
+        cache_start();
+        emit_run_event(CTE_RunStart);
+        notify_run_start();
 
         cur_test = NULL;
         cur_suite = suite;
@@ -863,13 +8242,14 @@ void run_test(CTestSuite* suite, CTestCase* test) {
             xprintf("\nWARNING - Suite initialization failed for '%s'.", suite->name);
 
             summary.suites_failed++;
-            add_failure(&failure_list, CUF_SuiteInitFailed, 0, "Suite Initialization failed - Suite Skipped", "CTest System", suite, NULL);
+            append_failure(CUF_SuiteInitFailed, 0, "Suite Initialization failed - Suite Skipped", 0, "CTest System", suite, NULL, 0);
 
             error("Suite initialization function failed.");
             return;
         }
         /* reach here if no suite initialization, or if it succeeded */
         else {
+            notify_suite_start(suite);
             run_single_test(test);
 
             /* run the suite cleanup function, if any */
@@ -880,16 +8260,19 @@ void run_test(CTestSuite* suite, CTestCase* test) {
                 xprintf("\nWARNING - Suite cleanup failed for '%s'.", suite->name);
 
                 summary.suites_failed++;
-                add_failure(&failure_list, CUF_SuiteCleanupFailed, 0, "Suite cleanup failed.", "CTest System", suite, NULL);
+                append_failure(CUF_SuiteCleanupFailed, 0, "Suite cleanup failed.", 0, "CTest System", suite, NULL, 0);
             }
+
+            notify_suite_end(suite);
         }
 
         /* test run is complete - clear flag */
         test_is_running = 0;
         summary.elapsed_time = ((double)clock() - (double)start_time) / (double)CLOCKS_PER_SEC;
+        emit_run_event(CTE_RunEnd);
 
         /* run handler for overall completion, if any */
-        all_tests_complete_report(failure_list);
+        notify_run_end();
 
         cur_suite = NULL;
     }
@@ -916,11 +8299,14 @@ void basic_run_test(CTestSuite* suite, CTestCase* test) {
 static void cleanup_test(CTestCase* test) {
     assert(NULL != test);
 
-    if(NULL != test->name) {
-        free(test->name);
+    if(NULL != test->property) {
+        free(test->property);
     }
 
+    free(test->stress);
     test->name = NULL;
+    test->property = NULL;
+    test->stress = NULL;
 }
 
 void cleanup_suite(CTestSuite* suite) {
@@ -934,18 +8320,17 @@ void cleanup_suite(CTestSuite* suite) {
     while(NULL != cur) {
         next = cur->next;
 
-        cleanup_test(cur);
+        if(0 == (cur->flags & CTEST_STATIC_NODE)) {
+            cleanup_test(cur); // the node itself belongs to registry.nodes
+        } else {
+            cur->prev = cur->next = NULL;
+        }
 
-        free(cur);
         cur = next;
     }
 
-    if(NULL != suite->name) {
-        free(suite->name);
-    }
-
-    suite->name = NULL;
     suite->test = NULL;
+    suite->last = NULL;
     suite->number_of_tests = 0;
 }
 
@@ -956,10 +8341,15 @@ void cleanup_test_registry() {
     for(cur = registry.suite; NULL != cur; cur = next) {
         next = cur->next;
         cleanup_suite(cur);
-        free(cur);
+
+        if(0 != (cur->flags & CTEST_STATIC_NODE)) {
+            cur->prev = cur->next = NULL;
+        }
     }
 
     registry.suite = NULL;
+    registry.last_suite = NULL;
+    flat_clear();
     registry.number_of_suites = 0;
     registry.number_of_tests = 0;
 }
@@ -968,86 +8358,184 @@ void CTest_cleanup_registry() {
     assert(!test_is_running);
 
     cleanup_test_registry();
+    fixture_pools_free();
+    shared_free();
 
     clear_previous_results();
 }
 
+// Registration place order of static nodes, the linker does not keep it
+int static_order(const char* file_a, int line_a, const char* file_b, int line_b) {
+    int res = strcmp(file_a, file_b);
+    return (0 != res) ? res : (line_a - line_b);
+}
+
+int static_suite_order(const void* a, const void* b) {
+    const CTestSuite* x = (const CTestSuite*)a;
+    const CTestSuite* y = (const CTestSuite*)b;
+
+    return static_order(x->file, x->line, y->file, y->line);
+}
+
+int static_test_order(const void* a, const void* b) {
+    const CTestCase* x = (const CTestCase*)a;
+    const CTestCase* y = (const CTestCase*)b;
+
+    return static_order(x->file, x->line, y->file, y->line);
+}
+
+// Next pointer of a list node, it lives at next_offset in the node
+#define LIST_NEXT(node, next_offset) (*(void**)((char*)(node) + (next_offset)))
+
+// Stable merge sort of a singly linked list of count nodes (static suites or tests)
+void* sort_list(void* head, unsigned int count, size_t next_offset, int (*order)(const void*, const void*)) {
+    void* a, *b, *result = NULL;
+    void** tail;
+    unsigned int i, half = count / 2;
+
+    if(count < 2) {
+        return head;
+    }
+
+    for(a = head, i = 1; i < half; i++) {
+        a = LIST_NEXT(a, next_offset);
+    }
+
+    b = LIST_NEXT(a, next_offset);
+    LIST_NEXT(a, next_offset) = NULL;
+    a = sort_list(head, half, next_offset, order);
+    b = sort_list(b, count - half, next_offset, order);
+
+    for(tail = &result; NULL != a && NULL != b; tail = &LIST_NEXT(*tail, next_offset)) {
+        if(order(a, b) <= 0) {
+            *tail = a;
+            a = LIST_NEXT(a, next_offset);
+        } else {
+            *tail = b;
+            b = LIST_NEXT(b, next_offset);
+        }
+    }
+
+    *tail = (NULL != a) ? a : b;
+    return result;
+}
+
+#if defined(__ELF__)
+// Bounds of the descriptor sections, provided by the linker
+extern const CTestSuiteEntry __start_ctest_suites[] __attribute__((weak));
+extern const CTestSuiteEntry __stop_ctest_suites[] __attribute__((weak));
+extern const CTestCaseEntry __start_ctest_tests[] __attribute__((weak));
+extern const CTestCaseEntry __stop_ctest_tests[] __attribute__((weak));
+
+// Link static suites and tests into the registry in O(n) plus sorting. The flat arrays and
+// the lookups are sized once from the section bounds: one allocation per array, no rehash
+void link_static_registrations() {
+    const CTestSuiteEntry* se;
+    const CTestCaseEntry* te;
+    CTestSuite* suite, *prev = NULL;
+    CTestCase* test;
+    unsigned int count = 0;
+
+    assert(NULL == registry.suite);
+
+    flat_reserve_suites((unsigned int)(__stop_ctest_suites - __start_ctest_suites));
+    flat_reserve_tests((unsigned int)(__stop_ctest_tests - __start_ctest_tests));
+
+    for(se = __start_ctest_suites; se < __stop_ctest_suites; se++, count++) {
+        suite = se->suite;
+        suite->test = suite->last = NULL;
+        suite->number_of_tests = 0;
+        suite->next = registry.suite;
+        registry.suite = suite;
+    }
+
+    // Tests are pushed in front and ordered per suite below
+    for(te = __start_ctest_tests; te < __stop_ctest_tests; te++) {
+        test = te->test;
+        test->next = te->suite->test;
+        te->suite->test = test;
+        te->suite->number_of_tests++;
+        registry.number_of_tests++;
+    }
+
+    registry.suite = (CTestSuite*)sort_list(registry.suite, count, offsetof(CTestSuite, next), static_suite_order);
+    registry.number_of_suites = count;
+
+    for(suite = registry.suite; NULL != suite; prev = suite, suite = suite->next) {
+        suite->prev = prev;
+        suite->test = (CTestCase*)sort_list(suite->test, suite->number_of_tests, offsetof(CTestCase, next), static_test_order);
+        suite->last = NULL;
+        flat_add_suite(suite);
+
+        for(test = suite->test; NULL != test; test = test->next) {
+            test->prev = suite->last;
+            suite->last = test;
+            flat_add_test(suite, test);
+        }
+    }
+
+    registry.last_suite = prev;
+}
+#endif
+
 void CTest_initialize_registry() {
     assert(!test_is_running);
     CTest_cleanup_registry();
+#if defined(__ELF__)
+    link_static_registrations();
+#endif
 }
 
 CTestSuite* create_suite(const char* name, CTest_suite_function init, CTest_suite_function clean) {
-    CTestSuite* suite = (CTestSuite*)malloc(sizeof(CTestSuite));
-    assert(NULL != suite);
+    CTestSuite* suite = (CTestSuite*)block_alloc(&registry.nodes, sizeof(CTestSuite), CTEST_NODE_BLOCK);
     assert(NULL != name);
 
-    if(NULL != suite) {
-        suite->name = (char*)malloc(strlen(name) + 1);
-
-        if(NULL != suite->name) {
-            strcpy(suite->name, name);
-            suite->active = 1;
-            suite->initialize = init;
-            suite->cleanup = clean;
-            suite->test = NULL;
-            suite->next = NULL;
-            suite->prev = NULL;
-            suite->number_of_tests = 0;
-        } else {
-            free(suite);
-            suite = NULL;
-        }
-    }
+    suite->name = pool_strdup(name);
+    suite->active = 1;
+    suite->initialize = init;
+    suite->cleanup = clean;
+    suite->setup = NULL;
+    suite->teardown = NULL;
+    suite->fixture = NULL;
+    suite->test = NULL;
+    suite->last = NULL;
+    suite->file = NULL;
+    suite->line = 0;
+    suite->flags = 0;
+    suite->index = 0;
+    suite->next = NULL;
+    suite->prev = NULL;
+    suite->number_of_tests = 0;
 
     return suite;
 }
 
 void insert_suite(CTestSuite* suite) {
-    CTestSuite* cur = NULL;
-
     assert(NULL != suite);
-
-    cur = registry.suite;
-
-    assert(cur != suite);
+    assert(registry.last_suite != suite);
 
     suite->next = NULL;
     registry.number_of_suites++;
 
     // if this is the 1st suite to be added..
-    if(NULL == cur) {
+    if(NULL == registry.last_suite) {
         registry.suite = suite;
         suite->prev = NULL;
     }
     // otherwise, add it to the end of the linked list..
     else {
-        while(NULL != cur->next) {
-            cur = cur->next;
-            assert(cur != suite);
-        }
-
-        cur->next = suite;
-        suite->prev = cur;
+        registry.last_suite->next = suite;
+        suite->prev = registry.last_suite;
     }
+
+    registry.last_suite = suite;
+    flat_add_suite(suite);
 }
 
 int suite_exists(const char* suite_name) {
-    CTestSuite* suite = NULL;
-
     assert(NULL != suite_name);
 
-    suite = registry.suite;
-
-    while(NULL != suite) {
-        if((NULL != suite->name) && (!strcmp_ignore_case(suite_name, suite->name))) {
-            return 1;
-        }
-
-        suite = suite->next;
-    }
-
-    return 0;
+    return NULL != find_suite(suite_name);
 }
 
 CTestSuite* CTest_add_suite(const char* name, CTest_suite_function init, CTest_suite_function clean, const char* file, const int line) {
@@ -1067,6 +8555,9 @@ CTestSuite* CTest_add_suite(const char* name, CTest_suite_function init, CTest_s
 
         assert(NULL != ret);
 
+        ret->file = file;
+        ret->line = line;
+
         if(suite_exists(name)) {
             xprintf("WARNING: Suite with same name \"%s\" %s:%d\n", name, file, line);
         }
@@ -1077,65 +8568,107 @@ CTestSuite* CTest_add_suite(const char* name, CTest_suite_function init, CTest_s
     return ret;
 }
 
-CTestCase* create_test(const char* name, CTestFunc testFunction) {
-    CTestCase* test = (CTestCase*)malloc(sizeof(CTestCase));
-    assert(NULL != testFunction);
-    assert(NULL != name);
+CTestSuite* CTest_add_suite_with_setup_and_teardown(const char* name, CTest_suite_function init, CTest_suite_function clean,
+        CTestHookFunc setup, CTestHookFunc teardown, const char* file, const int line) {
+    CTestSuite* suite = CTest_add_suite(name, init, clean, file, line);
 
-    if(NULL == test) {
-        xprintf("Memory allocation failed\n");
-        cleanup_test_registry();
-        exit(1);
+    suite->setup = setup;
+    suite->teardown = teardown;
+
+    return suite;
+}
+
+int CTest_add_dependency(CTestSuite* suite, CTestSuite* dependency) {
+    char* cycle;
+
+    assert(!test_is_running);
+    assert(NULL != suite);
+    assert(NULL != dependency);
+
+    dependency_index();
+    cycle = dependency_path(dependency->index, suite->index);
+
+    if(NULL != cycle) {
+        xprintf("ERROR: Suite dependency cycle %s -> %s, dependency not added %s:%d\n", suite->name, cycle,
+                (NULL != suite->file) ? suite->file : "", suite->line);
+        free(cycle);
+        return -1;
     }
 
-    assert(NULL != test);
+    if(registry.dependencies == registry.dependencies_capacity) {
+        registry.dependencies_capacity = (0 == registry.dependencies_capacity) ? 16 : registry.dependencies_capacity * 2;
+        registry.dependency = (unsigned int*)grow_array(registry.dependency, 2 * registry.dependencies_capacity, sizeof(unsigned int));
+    }
 
-    if(NULL != test) {
-        test->name = (char*)malloc(strlen(name) + 1);
+    registry.dependency[2 * registry.dependencies] = suite->index;
+    registry.dependency[2 * registry.dependencies + 1] = dependency->index;
+    registry.dependencies++;
+    return 0;
+}
 
-        if(NULL != test->name) {
-            strcpy(test->name, name);
-            test->active = 1;
-            test->test = testFunction;
-            test->jumpBuf = NULL;
-            test->next = NULL;
-            test->prev = NULL;
-        } else {
-            free(test);
-            test = NULL;
-        }
+CTestSuite* CTest_add_suite_after(const char* name, CTest_suite_function init, CTest_suite_function clean, const char* file, const int line, ...) {
+    CTestSuite* suite = CTest_add_suite(name, init, clean, file, line);
+    CTestSuite* dependency;
+    va_list args;
+
+    va_start(args, line);
+
+    while(NULL != (dependency = va_arg(args, CTestSuite*))) {
+        CTest_add_dependency(suite, dependency);
     }
 
+    va_end(args);
+
+    return suite;
+}
+
+// testFunction - NULL for a STRESS test
+CTestCase* create_test(const char* name, CTestFunc testFunction) {
+    CTestCase* test = (CTestCase*)block_alloc(&registry.nodes, sizeof(CTestCase), CTEST_NODE_BLOCK);
+    assert(NULL != name);
+
+    test->name = pool_strdup(name);
+    test->active = 1;
+    test->test = testFunction;
+    test->jumpBuf = NULL;
+    test->rows = NULL;
+    test->row_size = 0;
+    test->row_count = 0;
+    test->property = NULL;
+    test->fuzz = NULL;
+    test->stress = NULL;
+    test->file = NULL;
+    test->line = 0;
+    test->flags = 0;
+    test->index = 0;
+    test->limits = NULL;
+    test->inputs = NULL;
+    test->next = NULL;
+    test->prev = NULL;
+
     return test;
 }
 
 void insert_test(CTestSuite* suite, CTestCase* test) {
-    CTestCase* pCurTest = NULL;
-
     assert(NULL != suite);
     assert(NULL != test);
     assert(NULL == test->next);
     assert(NULL == test->prev);
-
-    pCurTest = suite->test;
-
-    assert(pCurTest != test);
+    assert(suite->last != test);
 
     suite->number_of_tests++;
 
-    // if this is the 1st suite to be added..
-    if(NULL == pCurTest) {
+    // if this is the 1st test to be added..
+    if(NULL == suite->last) {
         suite->test = test;
         test->prev = NULL;
     } else {
-        while(NULL != pCurTest->next) {
-            pCurTest = pCurTest->next;
-            assert(pCurTest != test);
-        }
-
-        pCurTest->next = test;
-        test->prev = pCurTest;
+        suite->last->next = test;
+        test->prev = suite->last;
     }
+
+    suite->last = test;
+    flat_add_test(suite, test);
 }
 
 /**
@@ -1143,25 +8676,14 @@ void insert_test(CTestSuite* suite, CTestCase* test) {
  *  @return 1 if test exists in the suite, 0 otherwise.
  */
 int test_exists(CTestSuite* suite, const char* test_name) {
-    CTestCase* test = NULL;
-
     assert(NULL != suite);
     assert(NULL != test_name);
 
-    test = suite->test;
-
-    while(NULL != test) {
-        if((NULL != test->name) && (!strcmp_ignore_case(test_name, test->name))) {
-            return 1;
-        }
-
-        test = test->next;
-    }
-
-    return 0;
+    return NULL != find_test(suite, test_name);
 }
 
-CTestCase* CTest_add_test(CTestSuite* suite, const char* name, CTestFunc testFunction, const char* file, const int line) {
+// CTest_add_test() without the testFunction check, the test kinds which run something else pass NULL
+CTestCase* add_test(CTestSuite* suite, const char* name, CTestFunc testFunction, const char* file, const int line) {
     CTestCase* test = NULL;
 
     assert(!test_is_running);
@@ -1172,9 +8694,6 @@ CTestCase* CTest_add_test(CTestSuite* suite, const char* name, CTestFunc testFun
     } else if(NULL == name) {
         xprintf("Test name cannot be NULL. %s:%d\n", file, line);
         exit(1);
-    } else if(NULL == testFunction) {
-        xprintf("NULL == testFunction %s:%d\n", file, line);
-        exit(1);
     } else {
         test = create_test(name, testFunction);
 
@@ -1185,6 +8704,8 @@ CTestCase* CTest_add_test(CTestSuite* suite, const char* name, CTestFunc testFun
 
         assert(NULL != test);
 
+        test->file = file;
+        test->line = line;
         registry.number_of_tests++;
 
         if(test_exists(suite, name)) {
@@ -1198,6 +8719,272 @@ CTestCase* CTest_add_test(CTestSuite* suite, const char* name, CTestFunc testFun
     return test;
 }
 
+CTestCase* CTest_add_test(CTestSuite* suite, const char* name, CTestFunc testFunction, const char* file, const int line) {
+    if(NULL == testFunction) {
+        xprintf("NULL == testFunction %s:%d\n", file, line);
+        exit(1);
+    }
+
+    return add_test(suite, name, testFunction, file, line);
+}
+
+CTestCase* CTest_add_table_test(CTestSuite* suite, const char* name, CTestRowFunc rowFunction, const void* rows, size_t row_size, size_t row_count, const char* file, const int line) {
+    CTestCase* test = NULL;
+
+    if(NULL == rows) {
+        xprintf("NULL table rows not allowed. %s:%d\n", file, line);
+        exit(1);
+    }
+
+    // One registry entry for the whole table, the cases are expanded at run time
+    test = CTest_add_test(suite, name, (CTestFunc)rowFunction, file, line);
+    test->rows = rows;
+    test->row_size = row_size;
+    test->row_count = row_count;
+
+    registry.number_of_tests = registry.number_of_tests - 1 + (unsigned int)row_count;
+
+    return test;
+}
+
+CTestCase* CTest_add_property(CTestSuite* suite, const char* name, const CTestGen* gen, CTestCheckFunc check, unsigned long iterations, const char* file, const int line) {
+    CTestCase* test = NULL;
+    CTestProperty* prop = NULL;
+
+    if((NULL == gen) || (NULL == gen->generate) || (NULL == gen->print)) {
+        xprintf("Incomplete property generator. %s:%d\n", file, line);
+        exit(1);
+    }
+
+    if(gen->min > gen->max) {
+        xprintf("Empty property generator range. %s:%d\n", file, line);
+        exit(1);
+    }
+
+    prop = (CTestProperty*)malloc(sizeof(CTestProperty));
+
+    if(NULL == prop) {
+        xprintf("Memory allocation failed\n");
+        cleanup_test_registry();
+        exit(1);
+    }
+
+    prop->gen = gen;
+    prop->check = check;
+    prop->iterations = iterations;
+    prop->file = file;
+    prop->line = line;
+
+    test = CTest_add_test(suite, name, (CTestFunc)check, file, line);
+    test->property = prop;
+
+    return test;
+}
+
+CTestCase* CTest_add_fuzz(CTestSuite* suite, const char* name, CTestFuzzFunc fuzzFunction, const char* file, const int line) {
+    CTestCase* test = CTest_add_test(suite, name, (CTestFunc)fuzzFunction, file, line);
+
+    test->fuzz = fuzzFunction;
+    return test;
+}
+
+CTestCase* CTest_add_stress(CTestSuite* suite, const char* name, CTestStressFunc body, unsigned int threads, unsigned long iterations,
+                            const char* file, const int line) {
+    CTestCase* test = NULL;
+    CTestStress* stress = NULL;
+
+    if(NULL == body) {
+        xprintf("NULL == body %s:%d\n", file, line);
+        exit(1);
+    }
+
+    stress = (CTestStress*)malloc(sizeof(CTestStress));
+
+    if(NULL == stress) {
+        xprintf("Memory allocation failed\n");
+        cleanup_test_registry();
+        exit(1);
+    }
+
+    stress->body = body;
+    stress->threads = threads;
+    stress->iterations = (0 != iterations) ? iterations : 1;
+
+    // body has another signature, it is only called through stress
+    test = add_test(suite, name, NULL, file, line);
+    test->stress = stress;
+
+    return test;
+}
+
+// Parse unsigned number in decimal or 0x-hexadecimal form
+int parse_number(const char* str, uint64_t* value) {
+    char* end = NULL;
+
+    if('\0' == *str) {
+        return 0;
+    }
+
+    errno = 0;
+    *value = (uint64_t)strtoull(str, &end, 0);
+    return (0 == errno) && ('\0' == *end);
+}
+
+// Parse --shard=INDEX/COUNT into options, nothing is changed unless the whole value is valid
+int parse_shard(const char* str) {
+    char* end = NULL;
+    unsigned long long index, count;
+
+    if(!isdigit((unsigned char)*str)) {
+        return 0;
+    }
+
+    errno = 0;
+    index = strtoull(str, &end, 10);
+
+    if(0 != errno || '/' != *end || !isdigit((unsigned char)end[1])) {
+        return 0;
+    }
+
+    count = strtoull(end + 1, &end, 10);
+
+    if(0 != errno || '\0' != *end || 0 == count || count > UINT_MAX || index >= count) {
+        return 0;
+    }
+
+    options.shard_index = (unsigned int)index;
+    options.shard_count = (unsigned int)count;
+    return 1;
+}
+
+int CTest_parse_args(int argc, char** argv) {
+    int i;
+    int result = 0;
+    int shuffle_default = 0;
+    uint64_t value;
+
+    if(!options.seed_set) {
+        options.seed = (uint64_t)time(NULL);
+    }
+
+    options.argc = argc;
+    options.argv = argv;
+
+    for(i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+
+        if(0 == strncmp(arg, "--seed=", 7) && parse_number(arg + 7, &value)) {
+            options.seed = value;
+            options.seed_set = 1;
+        } else if(0 == strncmp(arg, "--iterations=", 13) && parse_number(arg + 13, &value) && value > 0) {
+            options.iterations = (unsigned long)value;
+        } else if(0 == strncmp(arg, "--threads=", 10) && parse_number(arg + 10, &value) && value > 0) {
+            options.threads = (unsigned int)value;
+        } else if(0 == strncmp(arg, "--replay=", 9) && parse_number(arg + 9, &value)) {
+            options.replay = value;
+            options.replay_set = 1;
+        } else if(0 == strcmp(arg, "--fuzz")) {
+            options.fuzz = 1;
+        } else if(0 == strncmp(arg, "--fuzz-runs=", 12) && parse_number(arg + 12, &value)) {
+            options.fuzz = 1;
+            options.fuzz_runs = (unsigned long)value;
+        } else if(0 == strncmp(arg, "--fuzz-seconds=", 15) && parse_number(arg + 15, &value)) {
+            options.fuzz = 1;
+            options.fuzz_seconds = (unsigned long)value;
+        } else if(0 == strncmp(arg, "--fuzz-max-len=", 15) && parse_number(arg + 15, &value) && value > 0) {
+            options.fuzz_max_len = (size_t)value;
+        } else if(0 == strncmp(arg, "--corpus=", 9) && '\0' != arg[9]) {
+            options.corpus = arg + 9;
+        } else if(0 == strncmp(arg, "--filter=", 9) && '\0' != arg[9]) {
+            options.filter = arg + 9;
+        } else if(0 == strncmp(arg, "--shard=", 8) && parse_shard(arg + 8)) {
+            // Parsed into options
+#ifndef WIN32
+        } else if(0 == strncmp(arg, "--event-fd=", 11) && parse_number(arg + 11, &value) && value <= INT_MAX) {
+            options.event_fd = (int)value;
+#endif
+        } else if(0 == strcmp(arg, "--watch")) {
+            options.watch = 1;
+        } else if(0 == strncmp(arg, "--watch=", 8) && '\0' != arg[8]) {
+            options.watch = 1;
+            options.watch_paths = arg + 8;
+        } else if(0 == strncmp(arg, "--rerun-failures=", 17) && parse_number(arg + 17, &value)) {
+            options.rerun = (unsigned int)value;
+        } else if(0 == strncmp(arg, "--jobs=", 7) && parse_number(arg + 7, &value) && value > 0) {
+            options.jobs = (unsigned int)value;
+        } else if(0 == strncmp(arg, "--quarantine=", 13) && '\0' != arg[13]) {
+            options.quarantine = arg + 13;
+        } else if(0 == strncmp(arg, "--run-index=", 12) && parse_number(arg + 12, &value) && value <= LONG_MAX) {
+            options.run_index = (long)value;
+        } else if(0 == strcmp(arg, "--shuffle")) {
+            options.shuffle = 1;
+            shuffle_default = 1;
+        } else if(0 == strncmp(arg, "--shuffle=", 10) && parse_number(arg + 10, &value)) {
+            options.shuffle = 1;
+            options.shuffle_seed = value;
+        } else if(0 == strcmp(arg, "--bisect-order")) {
+            options.bisect = 1;
+        } else if(0 == strncmp(arg, "--workers=", 10) && parse_number(arg + 10, &value) && value > 0) {
+            options.workers = (unsigned int)value;
+        } else if(0 == strcmp(arg, "--isolate")) {
+            options.isolate = 1;
+        } else if(0 == strncmp(arg, "--limit-as=", 11) && parse_number(arg + 11, &value) && value <= UINT64_MAX / 1048576) {
+            options.limits.address_space = value * 1048576;
+        } else if(0 == strncmp(arg, "--limit-cpu=", 12) && parse_number(arg + 12, &value)) {
+            options.limits.cpu_seconds = value;
+        } else if(0 == strncmp(arg, "--limit-fds=", 12) && parse_number(arg + 12, &value)) {
+            options.limits.open_files = value;
+        } else if(0 == strncmp(arg, "--cache-dir=", 12) && '\0' != arg[12]) {
+            options.cache_dir = arg + 12;
+        } else if(0 == strcmp(arg, "--no-cache")) {
+            options.no_cache = 1;
+        } else if(0 == strcmp(arg, "--journal")) {
+            options.journal = "JOURNAL.BIN";
+        } else if(0 == strncmp(arg, "--journal=", 10) && '\0' != arg[10]) {
+            options.journal = arg + 10;
+        } else if(0 == strcmp(arg, "--resume")) {
+            options.resume = 1;
+        } else if(0 == strncmp(arg, "--coordinator=", 14) && '\0' != arg[14]) {
+            options.coordinator = arg + 14;
+        } else if(0 == strncmp(arg, "--local-workers=", 16) && parse_number(arg + 16, &value) && value <= 1024) {
+            options.local_workers = (unsigned int)value;
+        } else if(0 == strncmp(arg, "--batch=", 8) && parse_number(arg + 8, &value) && value > 0) {
+            options.batch = (unsigned int)value;
+        } else if(0 == strncmp(arg, "--worker=", 9) && '\0' != arg[9]) {
+            options.worker = arg + 9;
+        } else if(0 == strncmp(arg, "--histograms=", 13) && '\0' != arg[13]) {
+            options.histograms = arg + 13;
+        } else if(0 == strncmp(arg, "--stress-ms=", 12) && parse_number(arg + 12, &value) && value > 0) {
+            options.stress_ms = (unsigned long)value;
+        } else if(0 == strcmp(arg, "--stress-sweep")) {
+            options.stress_sweep = 1;
+        } else if(0 == strcmp(arg, "--self-benchmark")) {
+            options.self_benchmark = "BENCHMARK.TXT";
+        } else if(0 == strncmp(arg, "--self-benchmark=", 17) && '\0' != arg[17]) {
+            options.self_benchmark = arg + 17;
+        } else if(0 == strcmp(arg, "--progress")) {
+            options.progress = 1;
+        } else if(0 == strncmp(arg, "--timings=", 10) && '\0' != arg[10]) {
+            options.timings = arg + 10;
+        } else if(0 == strncmp(arg, "--run-order=", 12) && '\0' != arg[12]) {
+            options.run_order = arg + 12;
+        } else if(0 == strncmp(arg, "--", 2)) {
+            xprintf("ERROR: Unknown or malformed option \"%s\"\n", arg);
+            result = 1;
+        }
+    }
+
+    if(shuffle_default) {
+        options.shuffle_seed = options.seed;
+    }
+
+    if(options.resume && NULL == options.journal) {
+        options.journal = "JOURNAL.BIN";
+    }
+
+    return result;
+}
+
 // Save string to file
 void str_to_file(const char* str, const char* filename) {
     FILE* f = fopen(filename, "w");
@@ -1223,4 +9010,3 @@ char* FileToStr(const char* filename) {
     fclose(f);
     return buf;
 }
-
@@ -2,90 +2,602 @@
 #define CTEST_H
 
 #include <math.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
 #include <setjmp.h> // jmp_buf
 #include <errno.h>
+#include <string.h> // strcmp in the assertion macros
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CTEST_LIKELY(x) __builtin_expect(!!(x), 1)
+#else
+#define CTEST_LIKELY(x) (!!(x))
+#endif
+
+// Runner state of the running test is per thread (--workers)
+#if defined(_MSC_VER)
+#define CTEST_THREAD_LOCAL __declspec(thread)
+#else
+#define CTEST_THREAD_LOCAL __thread
+#endif
+
+// Targets where a thread-local access is a function call (emutls) or not assumed native.
+// Define CTEST_EMULATED_TLS for both CTest.c and the tests to force it elsewhere.
+#if !defined(CTEST_EMULATED_TLS) && (defined(WIN32) || defined(__OpenBSD__))
+#define CTEST_EMULATED_TLS
+#endif
+
+// Passing assertions are counted inline here and added to the run summary after each test.
+// The counter belongs to the thread running the test (--workers pool, STRESS). With emulated
+// TLS it is a plain global instead: while tests run on several threads CTest_concurrent is set
+// and CTest_add_passed() counts them per thread.
+// Define CTEST_NO_ASSERT_COUNT before including CTest.h to drop the counting in a translation unit.
+#ifdef CTEST_EMULATED_TLS
+extern uint64_t CTest_asserts_passed;
+extern int CTest_concurrent;
+#else
+extern CTEST_THREAD_LOCAL uint64_t CTest_asserts_passed;
+#endif
+
+#ifdef CTEST_NO_ASSERT_COUNT
+#define CTEST_PASSED() ((void)0)
+#elif defined(CTEST_EMULATED_TLS)
+#define CTEST_PASSED() (CTEST_LIKELY(!CTest_concurrent) ? (void)++CTest_asserts_passed : CTest_add_passed(1))
+#else
+#define CTEST_PASSED() ((void)++CTest_asserts_passed)
+#endif
+
+// Batch the counter of a hot loop in a local variable (a register) which shadows the global one:
+//   CTEST_BATCH_BEGIN for(...) { CU_ASSERT(...); } CTEST_BATCH_END
+// A fatal failure inside the batch drops its passed count.
+#define CTEST_BATCH_BEGIN { uint64_t CTest_asserts_passed = 0;
+#define CTEST_BATCH_END CTest_add_passed(CTest_asserts_passed); }
+void CTest_add_passed(uint64_t count);
+
+// Failure path of the assertion macros. expression and file must be string literals, they are not copied.
+void CTest_fail(const char* expression, const char* file, const int line);
+void CTest_fail_fatal(const char* expression, const char* file, const int line);
+void CTest_fail_int(uint64_t a, uint64_t e, const char* expression, const char* file, const int line);
+void CTest_fail_strings(const char* actual, const char* expected, const char* expression, const char* file, const int line);
+
+// Only a failed condition leaves the inline path
+#define CTEST_CHECK(v, m) { if(CTEST_LIKELY(v)) { CTEST_PASSED(); } else { CTest_fail(m, __FILE__, __LINE__); } }
+#define CTEST_CHECK_FATAL(v, m) { if(CTEST_LIKELY(v)) { CTEST_PASSED(); } else { CTest_fail_fatal(m, __FILE__, __LINE__); } }
 
 // a - actual
 // e - expected
 // v - boolean condition
 // m - message
-#define CU_PASS(m) { CTest(1, ("PASS(" #m ")"), __FILE__, __LINE__); }
-#define CU_ASSERT(v) { CTest((v), #v, __FILE__, __LINE__); }
-#define CU_ASSERT_FATAL(v) { CTestFatal((v), #v, __FILE__,__LINE__); }
-#define CU_FAIL(m) { CTest(0, ("CU_FAIL(" #m ")"), __FILE__, __LINE__); }
-#define CU_FAIL_FATAL(m) { CTestFatal(0, ("CU_FAIL_FATAL(" #m ")"), __FILE__, __LINE__); }
-#define CU_ASSERT_EQUAL(a, e) { CTestInt(a, e, ("CU_ASSERT_EQUAL(" #a "," #e ")"), __FILE__,__LINE__); }
-#define CU_ASSERT_EQUAL_FATAL(a, e) { CTestFatal(((a) == (e)), ("CU_ASSERT_EQUAL_FATAL(" #a "," #e ")"), __FILE__, __LINE__); }
-#define CU_ASSERT_EQUAL_FATALX(a, e, m) { CTestFatal(((a) == (e)), m, __FILE__, __LINE__); }
-#define CU_ASSERT_NOT_EQUAL(a, e) { CTest(((a) != (e)), ("CU_ASSERT_NOT_EQUAL(" #a "," #e ")"), __FILE__, __LINE__); }
-#define CU_ASSERT_NOT_EQUAL_FATAL(a, e) { CTestFatal(((a) != (e)), ("CU_ASSERT_NOT_EQUAL_FATAL(" #a "," #e ")"), __FILE__, __LINE__); }
-
-#define CU_ASSERT_PTR_EQUAL(a, e) { CTest(((void*)(a) == (void*)(e)), ("CU_ASSERT_PTR_EQUAL(" #a "," #e ")"), __FILE__, __LINE__); }
-#define CU_ASSERT_PTR_EQUAL_FATAL(a, e) { CTestFatal(((void*)(a) == (void*)(e)), ("CU_ASSERT_PTR_EQUAL_FATAL(" #a "," #e ")"), __FILE__, __LINE__); }
-#define CU_ASSERT_PTR_NOT_EQUAL(a, e) { CTest(((void*)(a) != (void*)(e)), ("CU_ASSERT_PTR_NOT_EQUAL(" #a "," #e ")"), __FILE__, __LINE__); }
-#define CU_ASSERT_PTR_NOT_EQUAL_FATAL(a, e) { CTestFatal(((void*)(a) != (void*)(e)), ("CU_ASSERT_PTR_NOT_EQUAL_FATAL(" #a "," #e ")"), __FILE__, __LINE__); }
-#define CU_ASSERT_PTR_NULL(v) { CTest((NULL == (void*)(v)), ("CU_ASSERT_PTR_NULL(" #v")"), __FILE__, __LINE__); }
-#define CU_ASSERT_PTR_NULL_FATAL(v) { CTestFatal((NULL == (void*)(v)), ("CU_ASSERT_PTR_NULL_FATAL(" #v")"), __FILE__, __LINE__); }
-#define CU_ASSERT_PTR_NOT_NULL(v) { CTest((NULL != (void*)(v)), ("CU_ASSERT_PTR_NOT_NULL(" #v")"), __FILE__, __LINE__); }
-#define CU_ASSERT_PTR_NOT_NULL_FATAL(v) { CTestFatal((NULL != (void*)(v)), ("CU_ASSERT_PTR_NOT_NULL_FATAL(" #v")"), __FILE__,__LINE__); }
-
-#define CU_ASSERT_STRING_EQUAL(a, e) { CTestStrings(a,e,("CU_ASSERT_STRING_EQUAL(" #a ","  #e ")"), __FILE__, __LINE__); }
-#define CU_ASSERT_STRING_EQUAL_MESSAGE(a, e, m) { CTestStrings(a,e,("CU_ASSERT_STRING_EQUAL_MESSAGE(" #a ","  #e ") " m), __FILE__, __LINE__); }
-#define CU_ASSERT_STRING_EQUAL_FATAL(a, e) { CTestStringsFatal(!(strcmp((const char*)(a), (const char*)(e))), ("CU_ASSERT_STRING_EQUAL_FATAL(" #a ","  #e ")"), __FILE__, __LINE__); }
-#define CU_ASSERT_STRING_NOT_EQUAL(a, e) { CTest((strcmp((const char*)(a), (const char*)(e))), ("CU_ASSERT_STRING_NOT_EQUAL(" #a ","  #e ")"), __FILE__, __LINE__); }
-#define CU_ASSERT_STRING_NOT_EQUAL_FATAL(a, e) { CTestFatal((strcmp((const char*)(a), (const char*)(e))), ("CU_ASSERT_STRING_NOT_EQUAL_FATAL(" #a ","  #e ")"), __FILE__, __LINE__); }
-
-#define CU_ASSERT_NSTRING_EQUAL(a, e, count) { CTest(!(strncmp((const char*)(a), (const char*)(e), (size_t)(count))), ("CU_ASSERT_NSTRING_EQUAL(" #a ","  #e "," #count ")"), __FILE__, __LINE__); }
-#define CU_ASSERT_NSTRING_EQUAL_FATAL(a, e, count) { CTestFatal(!(strncmp((const char*)(a), (const char*)(e), (size_t)(count))), ("CU_ASSERT_NSTRING_EQUAL_FATAL(" #a ","  #e "," #count ")"), __FILE__, __LINE__); }
-#define CU_ASSERT_NSTRING_NOT_EQUAL(a, e, count) { CTest((strncmp((const char*)(a), (const char*)(e), (size_t)(count))), ("CU_ASSERT_NSTRING_NOT_EQUAL(" #a ","  #e "," #count ")"), __FILE__, __LINE__); }
-#define CU_ASSERT_NSTRING_NOT_EQUAL_FATAL(a, e, count) { CTestFatal((strncmp((const char*)(a), (const char*)(e), (size_t)(count))), ("CU_ASSERT_NSTRING_NOT_EQUAL_FATAL(" #a ","  #e "," #count ")"), __FILE__, __LINE__); }
-
-#define CU_ASSERT_DOUBLE_EQUAL(a, e, eps) { CTest(((fabs((double)(a) - (e)) <= fabs((double)(eps)))), ("CU_ASSERT_DOUBLE_EQUAL(" #a ","  #e "," #eps ")"), __FILE__, __LINE__); }
-#define CU_ASSERT_DOUBLE_EQUAL_FATAL(a, e, eps) { CTestFatal(((fabs((double)(a) - (e)) <= fabs((double)(eps)))), ("CU_ASSERT_DOUBLE_EQUAL_FATAL(" #a ","  #e "," #eps ")"), __FILE__, __LINE__); }
-#define CU_ASSERT_DOUBLE_NOT_EQUAL(a, e, eps) { CTest(((fabs((double)(a) - (e)) > fabs((double)(eps)))), ("CU_ASSERT_DOUBLE_NOT_EQUAL(" #a ","  #e "," #eps ")"), __FILE__, __LINE__); }
-#define CU_ASSERT_DOUBLE_NOT_EQUAL_FATAL(a, e, eps) { CTestFatal(((fabs((double)(a) - (e)) > fabs((double)(eps)))), ("CU_ASSERT_DOUBLE_NOT_EQUAL_FATAL(" #a ","  #e "," #eps ")"), __FILE__, __LINE__); }
+#define CU_PASS(m) { CTEST_PASSED(); }
+#define CU_ASSERT(v) CTEST_CHECK((v), #v)
+#define CU_ASSERT_FATAL(v) CTEST_CHECK_FATAL((v), #v)
+#define CU_FAIL(m) { CTest_fail(("CU_FAIL(" #m ")"), __FILE__, __LINE__); }
+#define CU_FAIL_FATAL(m) { CTest_fail_fatal(("CU_FAIL_FATAL(" #m ")"), __FILE__, __LINE__); }
+#define CU_ASSERT_EQUAL(a, e) { uint64_t ctest_a_ = (uint64_t)(a), ctest_e_ = (uint64_t)(e); \
+        if(CTEST_LIKELY(ctest_a_ == ctest_e_)) { CTEST_PASSED(); } else { CTest_fail_int(ctest_a_, ctest_e_, ("CU_ASSERT_EQUAL(" #a "," #e ")"), __FILE__, __LINE__); } }
+#define CU_ASSERT_EQUAL_FATAL(a, e) CTEST_CHECK_FATAL(((a) == (e)), ("CU_ASSERT_EQUAL_FATAL(" #a "," #e ")"))
+#define CU_ASSERT_EQUAL_FATALX(a, e, m) { if(CTEST_LIKELY((a) == (e))) { CTEST_PASSED(); } else { CTestFatal(0, m, __FILE__, __LINE__); } }
+#define CU_ASSERT_NOT_EQUAL(a, e) CTEST_CHECK(((a) != (e)), ("CU_ASSERT_NOT_EQUAL(" #a "," #e ")"))
+#define CU_ASSERT_NOT_EQUAL_FATAL(a, e) CTEST_CHECK_FATAL(((a) != (e)), ("CU_ASSERT_NOT_EQUAL_FATAL(" #a "," #e ")"))
+
+#define CU_ASSERT_PTR_EQUAL(a, e) CTEST_CHECK(((void*)(a) == (void*)(e)), ("CU_ASSERT_PTR_EQUAL(" #a "," #e ")"))
+#define CU_ASSERT_PTR_EQUAL_FATAL(a, e) CTEST_CHECK_FATAL(((void*)(a) == (void*)(e)), ("CU_ASSERT_PTR_EQUAL_FATAL(" #a "," #e ")"))
+#define CU_ASSERT_PTR_NOT_EQUAL(a, e) CTEST_CHECK(((void*)(a) != (void*)(e)), ("CU_ASSERT_PTR_NOT_EQUAL(" #a "," #e ")"))
+#define CU_ASSERT_PTR_NOT_EQUAL_FATAL(a, e) CTEST_CHECK_FATAL(((void*)(a) != (void*)(e)), ("CU_ASSERT_PTR_NOT_EQUAL_FATAL(" #a "," #e ")"))
+#define CU_ASSERT_PTR_NULL(v) CTEST_CHECK((NULL == (void*)(v)), ("CU_ASSERT_PTR_NULL(" #v")"))
+#define CU_ASSERT_PTR_NULL_FATAL(v) CTEST_CHECK_FATAL((NULL == (void*)(v)), ("CU_ASSERT_PTR_NULL_FATAL(" #v")"))
+#define CU_ASSERT_PTR_NOT_NULL(v) CTEST_CHECK((NULL != (void*)(v)), ("CU_ASSERT_PTR_NOT_NULL(" #v")"))
+#define CU_ASSERT_PTR_NOT_NULL_FATAL(v) CTEST_CHECK_FATAL((NULL != (void*)(v)), ("CU_ASSERT_PTR_NOT_NULL_FATAL(" #v")"))
+
+#define CU_ASSERT_STRING_EQUAL(a, e) { const char* ctest_a_ = (const char*)(a), *ctest_e_ = (const char*)(e); \
+        if(CTEST_LIKELY((NULL != ctest_a_) && (NULL != ctest_e_) && !strcmp(ctest_a_, ctest_e_))) { CTEST_PASSED(); } \
+        else { CTest_fail_strings(ctest_a_, ctest_e_, ("CU_ASSERT_STRING_EQUAL(" #a ","  #e ")"), __FILE__, __LINE__); } }
+#define CU_ASSERT_STRING_EQUAL_MESSAGE(a, e, m) { const char* ctest_a_ = (const char*)(a), *ctest_e_ = (const char*)(e); \
+        if(CTEST_LIKELY((NULL != ctest_a_) && (NULL != ctest_e_) && !strcmp(ctest_a_, ctest_e_))) { CTEST_PASSED(); } \
+        else { CTest_fail_strings(ctest_a_, ctest_e_, ("CU_ASSERT_STRING_EQUAL_MESSAGE(" #a ","  #e ") " m), __FILE__, __LINE__); } }
+#define CU_ASSERT_STRING_EQUAL_FATAL(a, e) CTEST_CHECK_FATAL(!(strcmp((const char*)(a), (const char*)(e))), ("CU_ASSERT_STRING_EQUAL_FATAL(" #a ","  #e ")"))
+#define CU_ASSERT_STRING_NOT_EQUAL(a, e) CTEST_CHECK((strcmp((const char*)(a), (const char*)(e))), ("CU_ASSERT_STRING_NOT_EQUAL(" #a ","  #e ")"))
+#define CU_ASSERT_STRING_NOT_EQUAL_FATAL(a, e) CTEST_CHECK_FATAL((strcmp((const char*)(a), (const char*)(e))), ("CU_ASSERT_STRING_NOT_EQUAL_FATAL(" #a ","  #e ")"))
+
+#define CU_ASSERT_NSTRING_EQUAL(a, e, count) CTEST_CHECK(!(strncmp((const char*)(a), (const char*)(e), (size_t)(count))), ("CU_ASSERT_NSTRING_EQUAL(" #a ","  #e "," #count ")"))
+#define CU_ASSERT_NSTRING_EQUAL_FATAL(a, e, count) CTEST_CHECK_FATAL(!(strncmp((const char*)(a), (const char*)(e), (size_t)(count))), ("CU_ASSERT_NSTRING_EQUAL_FATAL(" #a ","  #e "," #count ")"))
+#define CU_ASSERT_NSTRING_NOT_EQUAL(a, e, count) CTEST_CHECK((strncmp((const char*)(a), (const char*)(e), (size_t)(count))), ("CU_ASSERT_NSTRING_NOT_EQUAL(" #a ","  #e "," #count ")"))
+#define CU_ASSERT_NSTRING_NOT_EQUAL_FATAL(a, e, count) CTEST_CHECK_FATAL((strncmp((const char*)(a), (const char*)(e), (size_t)(count))), ("CU_ASSERT_NSTRING_NOT_EQUAL_FATAL(" #a ","  #e "," #count ")"))
+
+#define CU_ASSERT_DOUBLE_EQUAL(a, e, eps) CTEST_CHECK(((fabs((double)(a) - (e)) <= fabs((double)(eps)))), ("CU_ASSERT_DOUBLE_EQUAL(" #a ","  #e "," #eps ")"))
+#define CU_ASSERT_DOUBLE_EQUAL_FATAL(a, e, eps) CTEST_CHECK_FATAL(((fabs((double)(a) - (e)) <= fabs((double)(eps)))), ("CU_ASSERT_DOUBLE_EQUAL_FATAL(" #a ","  #e "," #eps ")"))
+#define CU_ASSERT_DOUBLE_NOT_EQUAL(a, e, eps) CTEST_CHECK(((fabs((double)(a) - (e)) > fabs((double)(eps)))), ("CU_ASSERT_DOUBLE_NOT_EQUAL(" #a ","  #e "," #eps ")"))
+#define CU_ASSERT_DOUBLE_NOT_EQUAL_FATAL(a, e, eps) CTEST_CHECK_FATAL(((fabs((double)(a) - (e)) > fabs((double)(eps)))), ("CU_ASSERT_DOUBLE_NOT_EQUAL_FATAL(" #a ","  #e "," #eps ")"))
 
 #define CU_ASSERT_FILES_EQUAL(a, e) { CTestFiles(a, e, ("CU_ASSERT_FILES_EQUAL(" #a ","  #e ")"),__FILE__,__LINE__); }
 
 #define TEST(suite, msg, test) ( CTest_add_test(suite, msg" - "#test, (CTestFunc)test, __FILE__, __LINE__) )
+// Table-driven test: fn(const Row* row) is called once per row of rows[0..n-1]
+#define TEST_TABLE(suite, fn, rows, n) ( CTest_add_table_test(suite, #fn, (CTestRowFunc)fn, (rows), sizeof((rows)[0]), (n), __FILE__, __LINE__) )
 #define TEST_SUITE(name, init, clean) ( CTest_add_suite(name, init, clean, __FILE__, __LINE__) )
+// Test that may run concurrently with other reentrant tests of its suite on the --workers pool
+#define TEST_REENTRANT(suite, msg, test) ( CTest_set_reentrant(TEST(suite, msg, test)) )
+// I/O bound test run on its own stack together with the other async tests of the suite (Linux)
+#define TEST_ASYNC(suite, msg, test) ( CTest_set_async(TEST(suite, msg, test)) )
+// Suite with setup/teardown called around each of its tests, a fatal assertion in setup skips the test
+#define TEST_SUITE_WITH_SETUP(name, init, clean, setup, teardown) \
+    ( CTest_add_suite_with_setup_and_teardown(name, init, clean, setup, teardown, __FILE__, __LINE__) )
+// Suite run after the listed suites and skipped when one of them fails: TEST_SUITE_AFTER("check", NULL, NULL, gen)
+#define TEST_SUITE_AFTER(name, init, clean, ...) ( CTest_add_suite_after(name, init, clean, __FILE__, __LINE__, __VA_ARGS__, NULL) )
+// Property test: check(const CTestValue*) must hold for every value produced by gen
+#define PROPERTY(suite, name, gen, check) ( CTest_add_property(suite, name, &(gen), check, 0, __FILE__, __LINE__) )
+// Fuzz target: fn(const uint8_t* data, size_t size) asserts with CU_ASSERT* like any test
+#define FUZZ(suite, name, fn) ( CTest_add_fuzz(suite, name, fn, __FILE__, __LINE__) )
+// Stress test: body(thread, iteration) is called iterations times per round on threads threads (0 - one per CPU the process may run on)
+#define STRESS(suite, name, body, threads, iterations) ( CTest_add_stress(suite, name, body, threads, iterations, __FILE__, __LINE__) )
 
 void CTest_cleanup_registry();
 
 typedef int (*CTest_suite_function)(void);
 typedef void (*CTestFunc)(void);        // Signature for a testing function in a test case
+typedef void (*CTestRowFunc)(const void* row); // Signature for a table-driven testing function
+typedef void (*CTestFuzzFunc)(const uint8_t* data, size_t size); // Signature for a fuzz target
+typedef void (*CTestStressFunc)(unsigned int thread, unsigned long iteration); // Signature for a stress body
+typedef void (*CTestHookFunc)(void);    // Per-test setup/teardown
+
+// Expensive per-test context. Instances are created on demand (one per test running at once),
+// kept in a pool and reset between tests instead of being rebuilt.
+//   static CTestFixture db = CTEST_FIXTURE_INIT(db_open, db_truncate, db_close);
+//   CTest_set_fixture(suite, &db);
+//   void test() { DB* d = CTEST_FIXTURE(DB); ... }
+typedef struct CTestFixture {
+    void*           (*create)(void);        // New instance, NULL - failure (the test fails)
+    void            (*reset)(void* data);   // Clean state for the next test, NULL - destroy and create again
+    void            (*destroy)(void* data);
+    // Pool, managed by the runner
+    void**          idle;                   // Instances not in use
+    unsigned int    idle_count;
+    unsigned int    idle_capacity;
+    unsigned int    created;                // Instances alive
+    struct CTestFixture* next_pool;
+    int             registered;
+} CTestFixture;
+
+#define CTEST_FIXTURE_INIT(create, reset, destroy) { create, reset, destroy, NULL, 0, 0, 0, NULL, 0 }
+// Fixture instance of the running test
+#define CTEST_FIXTURE(type) ( (type*)CTest_fixture() )
+
+// Read-only data shared by all processes of a run (see CTest_shared)
+typedef struct CTestShared {
+    const char*     name;
+    const void*     data;           // Read-only mapping, writes crash
+    size_t          size;
+    int             fd;             // Sealed memfd, -1 - private copy of this process
+    struct CTestShared* next;
+} CTestShared;
+
+// Fill data (size bytes, zeroed) once. Return: 0 - OK
+typedef int (*CTestSharedBuild)(void* data, size_t size, void* context);
 
-// Basic assert
+// Basic assert. message and file are copied on failure.
 int CTest(int condition, const char* message, const char* file, const int line);
 int CTestFatal(int condition, const char* message, const char* file, const int line);
 
+// Resource limits of a test, 0 - the --limit-* default. A test with limits runs in a forked child.
+typedef struct CTestLimits {
+    uint64_t        address_space;  // Bytes (RLIMIT_AS)
+    uint64_t        cpu_seconds;    // RLIMIT_CPU
+    uint64_t        open_files;     // RLIMIT_NOFILE
+} CTestLimits;
+
 typedef struct CTestCase {
     char*           name;
     int             active;
-    CTestFunc       test;
+    CTestFunc       test;      // NULL for a STRESS test, see stress
     jmp_buf*        jumpBuf; // Jump buffer for setjmp/longjmp test abort mechanism
+    const void*     rows;      // Table rows (not copied), NULL for an ordinary test
+    size_t          row_size;  // Size of one table row in bytes
+    size_t          row_count; // Number of table rows (cases)
+    struct CTestProperty* property; // Property checked by this test, NULL for an ordinary test
+    CTestFuzzFunc   fuzz;      // Fuzz target, NULL for an ordinary test
+    struct CTestStress* stress; // Stress run of this test, NULL for an ordinary test
+    const char*     file;      // Registration place (not copied)
+    int             line;
+    unsigned int    flags;     // CTEST_* flags
+    unsigned int    index;     // Position in the flat registry arrays
+    CTestLimits*    limits;    // Own resource limits, NULL - defaults
+    const char* const* inputs; // Input files of a deterministic test, NULL terminated (not copied)
     struct CTestCase* prev, *next;
 } CTestCase;
 
+// Node is static storage from CTEST_SUITE()/CTEST(), it is never freed
+#define CTEST_STATIC_NODE 1
+// Test is reentrant: it touches no state shared with other tests and may run on a worker thread
+#define CTEST_REENTRANT 2
+// Test result depends only on the binary and its input files, a pass may be replayed from --cache-dir
+#define CTEST_DETERMINISTIC 4
+// Test waits on I/O with CTest_await_fd()/CTest_sleep_ms() and runs together with the other async tests of its suite
+#define CTEST_ASYNC 8
+
 typedef struct CTestSuite {
     char*             name;
     int               active;    // Flag for whether suite is executed during a run
     CTestCase*        test;      // Pointer to the 1st test in the suite
     CTest_suite_function initialize;  // Pointer to the suite initialization function
     CTest_suite_function cleanup;     // Pointer to the suite cleanup function
+    CTestHookFunc     setup;     // Called before each test of the suite
+    CTestHookFunc     teardown;  // Called after each test of the suite
+    CTestFixture*     fixture;   // Pooled fixture handed to each test, NULL - none
 
     unsigned int      number_of_tests;  // Number of tests in the suite.
+    const char*       file;      // Registration place (not copied)
+    int               line;
+    unsigned int      flags;     // CTEST_* flags
+    CTestCase*        last;      // Pointer to the last test in the suite
+    unsigned int      index;     // Position in the flat registry arrays
     struct CTestSuite* prev, *next;
 } CTestSuite;
 
+// Types of failures occurring during test runs
+typedef enum CTest_FailureTypes {
+    CUF_SuiteInactive = 1,    // Inactive suite was run
+    CUF_SuiteInitFailed,      // Suite initialization function failed
+    CUF_SuiteCleanupFailed,   // Suite cleanup function failed
+    CUF_TestInactive,         // Inactive test was run
+    CUF_AssertFailed,         // CTest assertion failed during test run
+    CUF_FixtureFailed,        // Fixture of the test could not be created
+    CUF_LimitExceeded,        // Isolated test exceeded a resource limit
+    CUF_TestCrashed,          // Isolated test or --worker process died
+    CUF_DependencyFailed      // Suite skipped, a suite it depends on failed or was skipped
+} CTest_FailureType;          // Failure type
+
+// Raw failure payload, turned into text only when a reporter prints it
+typedef enum CTest_PayloadTypes {
+    CTP_Message = 0,          // message only
+    CTP_Integers,             // actual/expected integers
+    CTP_Strings               // actual/expected strings
+} CTest_PayloadType;
+
+// Data type for holding assertion failure information (linked list)
+typedef struct CTest_FailureRecord {
+    CTest_FailureType  type;        // Failure type
+    unsigned int    line;           // Line number of failure
+    const char*     file;           // Name of file where failure occurred (static or stored with the record)
+    const char*     message;        // Test condition which failed (static expression or stored with the record)
+    CTestCase*      test;           // Test containing failure
+    CTestSuite*     suite;          // Suite containing test having failure
+    long            row;            // Table row of the failed case, -1 for an ordinary test
+    CTest_PayloadType payload;      // Kind of the raw values below
+    uint64_t        actual, expected;           // CTP_Integers
+    const char*     actual_str, *expected_str;  // CTP_Strings, NULL if the string was NULL
+    size_t          actual_len, expected_len;
+    struct CTest_FailureRecord* prev, *next;
+} CTest_FailureRecord;
+
+// Human readable text of a failure, caller must call free(str)
+char* CTest_format_failure(const CTest_FailureRecord* failure);
+
+// == Listeners ==
+// Observers of the run, called in the order of registration. Any callback may be NULL.
+// The console output is CTest_console_listener, installed by default.
+// test_start, test_failure and test_end are called on the thread of the test: with --workers they
+// run concurrently on the pool threads, and no lock is held while a listener runs.
+typedef struct CTestListener {
+    void (*run_start)(void* context);
+    void (*run_end)(void* context);     // Results are complete, see CU_get_run_results_string()
+    void (*suite_start)(const CTestSuite* suite, void* context);
+    void (*suite_end)(const CTestSuite* suite, void* context);
+    void (*test_start)(const CTestSuite* suite, const CTestCase* test, void* context);
+    // failures - 1st failure of the test (NULL - passed), the following ones are linked by next
+    void (*test_end)(const CTestSuite* suite, const CTestCase* test, const CTest_FailureRecord* failures,
+                     uint64_t duration_ns, void* context);
+    // Each failure of the test once it has ended, just before test_end
+    void (*test_failure)(const CTest_FailureRecord* failure, void* context);
+    void* context;
+} CTestListener;
+
+#define CTEST_MAX_LISTENERS 8
+
+extern const CTestListener CTest_console_listener;
+
+// Listeners are changed between runs only. Return: 0 - OK, 1 - CTEST_MAX_LISTENERS reached
+int CTest_add_listener(const CTestListener* listener);
+void CTest_remove_listener(const CTestListener* listener);
+
+// == Binary result protocol ==
+// Versioned, length prefixed frames for streaming results between processes:
+//   u8 'C', u8 'T', u8 version, u8 type, u32 payload length, payload
+// Integers are little endian, strings are u32 length (with NUL, 0 - NULL) + bytes.
+#define CTEST_PROTOCOL_VERSION 1
+#define CTEST_FRAME_HEADER 8
+#define CTEST_MAX_FRAME (16u << 20)   // Longest payload, the decoder rejects longer frames
+#define CTEST_NO_TEST 0xFFFFFFFFu     // Test index of suite level events
+
+typedef enum CTestEventType {
+    CTE_RunStart = 1,         // count[0] suites, count[1] tests, count[2] seed
+    CTE_TestStart,            // suite, test, suite_name, name
+    CTE_TestEnd,              // suite, test, status, asserts, asserts_failed, duration_ns
+    CTE_Failure,              // suite, test, failure_type, line, row, payload, actual, expected, file, message, actual_str, expected_str
+    CTE_RunEnd                // count[0..5] suites run/failed/inactive, tests run/failed/inactive, asserts, asserts_failed, duration_ns
+} CTestEventType;
+
+typedef enum CTestStatus {
+    CTS_Passed = 0,
+    CTS_Failed,
+    CTS_Inactive,
+    CTS_Skipped                     // Not run, the suite initialization failed on a --worker
+} CTestStatus;
+
+typedef struct CTestEvent {
+    CTestEventType  type;
+    uint32_t        suite;          // Suite index in the registry
+    uint32_t        test;           // Test index in the registry or CTEST_NO_TEST
+    uint32_t        status;         // CTestStatus
+    uint32_t        failure_type;   // CTest_FailureType
+    uint32_t        line;
+    uint32_t        payload;        // CTest_PayloadType
+    int64_t         row;
+    uint64_t        asserts, asserts_failed;
+    uint64_t        duration_ns;
+    uint64_t        actual, expected;
+    uint64_t        count[6];
+    // Decoded strings point into the fed buffer and are NUL terminated
+    const char*     suite_name, *name, *file, *message, *actual_str, *expected_str;
+} CTestEvent;
+
+// Encode one frame into buf. Returns the frame size; nothing is written if it is larger than size.
+size_t CTest_encode_event(const CTestEvent* event, unsigned char* buf, size_t size);
+// Fill a CTE_Failure event from a failure record (raw payload, no formatting)
+void CTest_failure_event(const CTest_FailureRecord* failure, CTestEvent* event);
+
+typedef void (*CTestEventHandler)(const CTestEvent* event, void* context);
+
+// Incremental decoder: frames complete in the fed buffer are decoded in place,
+// only a frame split between two feeds is copied.
+typedef struct CTestDecoder {
+    unsigned char*  partial;        // Bytes of an incomplete frame
+    size_t          partial_size;
+    size_t          partial_capacity;
+} CTestDecoder;
+
+void CTest_decoder_init(CTestDecoder* decoder);
+// Return: 0 - OK, -1 - malformed frame, payload over CTEST_MAX_FRAME or unsupported version
+int CTest_decoder_feed(CTestDecoder* decoder, const void* data, size_t size, CTestEventHandler handler, void* context);
+void CTest_decoder_free(CTestDecoder* decoder);
+
+// Monotonic time in nanoseconds
+uint64_t CTest_time_ns(void);
+
+// == Static registration ==
+// Descriptors are emitted into the ctest_suites/ctest_tests ELF sections and linked
+// into the registry by CTest_initialize_registry() without copying them; its index arrays
+// are allocated once, sized from the section bounds:
+//   CTEST_SUITE(parser, NULL, NULL);
+//   CTEST(parser, test_empty_input);
+// Static suites and tests come first, ordered by file and line; CTest_add_suite()
+// and CTest_add_test() keep working alongside, also on static suites.
+typedef struct CTestSuiteEntry {
+    CTestSuite*     suite;
+} CTestSuiteEntry;
+
+typedef struct CTestCaseEntry {
+    CTestSuite*     suite;
+    CTestCase*      test;
+} CTestCaseEntry;
+
+#if defined(__ELF__)
+#define CTEST_SECTION(name) __attribute__((used, section(name), aligned(sizeof(void*))))
+
+#define CTEST_SUITE(id, init, clean) \
+    CTestSuite ctest_suite_##id = { .name = (char*)#id, .active = 1, .initialize = init, .cleanup = clean, \
+                                    .file = __FILE__, .line = __LINE__, .flags = CTEST_STATIC_NODE }; \
+    static const CTestSuiteEntry ctest_suite_entry_##id CTEST_SECTION("ctest_suites") = { &ctest_suite_##id }
+
+// Suite defined by CTEST_SUITE() in another file
+#define CTEST_SUITE_EXTERN(id) extern CTestSuite ctest_suite_##id
+
+#define CTEST(suite_id, fn) \
+    extern CTestSuite ctest_suite_##suite_id; \
+    static CTestCase ctest_case_##suite_id##_##fn = { .name = (char*)#fn, .active = 1, .test = (CTestFunc)fn, \
+                                                      .file = __FILE__, .line = __LINE__, .flags = CTEST_STATIC_NODE }; \
+    static const CTestCaseEntry ctest_case_entry_##suite_id##_##fn CTEST_SECTION("ctest_tests") = \
+        { &ctest_suite_##suite_id, &ctest_case_##suite_id##_##fn }
+#endif
+
 CTestSuite* CTest_add_suite(const char* name, CTest_suite_function init, CTest_suite_function clean, const char* file, const int line);
+CTestSuite* CTest_add_suite_with_setup_and_teardown(const char* name, CTest_suite_function init, CTest_suite_function clean,
+        CTestHookFunc setup, CTestHookFunc teardown, const char* file, const int line);
+// Suite depending on the NULL terminated list of suites
+CTestSuite* CTest_add_suite_after(const char* name, CTest_suite_function init, CTest_suite_function clean, const char* file, const int line, ...);
+// Run suite after dependency and skip it when dependency fails. Suites without a path between them keep
+// registration order and run concurrently under --coordinator. Return: 0 - OK, -1 - would close a cycle (not added)
+int CTest_add_dependency(CTestSuite* suite, CTestSuite* dependency);
+// Set CTEST_REENTRANT, returns test
+CTestCase* CTest_set_reentrant(CTestCase* test);
+// Set CTEST_ASYNC, returns test
+CTestCase* CTest_set_async(CTestCase* test);
+
+#define CTEST_READ  1
+#define CTEST_WRITE 4
+// Wait until fd is ready for events (CTEST_READ | CTEST_WRITE, fd -1 - none) or timeout_ms ends (-1 - no timeout).
+// An async test yields to the other tests meanwhile, an ordinary one blocks in poll().
+// Return: ready events, 0 - timeout, -1 - error
+int CTest_await_fd(int fd, int events, int timeout_ms);
+void CTest_sleep_ms(int ms);
+// Set CTEST_DETERMINISTIC, inputs - NULL terminated list of files the test reads (NULL - none), returns test
+CTestCase* CTest_set_deterministic(CTestCase* test, const char* const* inputs);
+// Run test in a child process limited to address_space bytes, cpu_seconds and open_files (0 - the default), returns test
+CTestCase* CTest_set_limits(CTestCase* test, uint64_t address_space, uint64_t cpu_seconds, uint64_t open_files);
+// Hand each test of the suite an instance of fixture (NULL - none)
+void CTest_set_fixture(CTestSuite* suite, CTestFixture* fixture);
+// Fixture instance of the running test, NULL if its suite has none
+void* CTest_fixture();
+// Shared read-only data, usually from a suite initialize. The first process of the run builds it
+// into a sealed memfd; processes started by the runner (--jobs, --rerun-failures, ...) map the same
+// pages. Calls with the same name return the same region until CTest_cleanup_registry().
+// Without memfd every process builds a private copy. Return: NULL - build failed
+const CTestShared* CTest_shared(const char* name, size_t size, CTestSharedBuild build, void* context);
 
 CTestCase* CTest_add_test(CTestSuite* suite, const char* name, CTestFunc testFunction, const char* file, const int line);
 
+// Register one logical test which expands into row_count cases at run time.
+// Rows are referenced in place, so they may live in static or memory-mapped storage.
+CTestCase* CTest_add_table_test(CTestSuite* suite, const char* name, CTestRowFunc rowFunction, const void* rows, size_t row_size, size_t row_count, const char* file, const int line);
+
+// == Property-based testing ==
+
+// Deterministic pseudo random generator (splitmix64)
+typedef struct CTestRandom {
+    uint64_t state;
+} CTestRandom;
+
+uint64_t CTest_random_next(CTestRandom* rnd);
+// Uniform value in [0, bound)
+uint64_t CTest_random_below(CTestRandom* rnd, uint64_t bound);
+
+// Value passed to a property check
+typedef struct CTestValue {
+    int64_t         i;        // Integer value
+    unsigned char*  data;     // Byte buffer or NUL terminated string
+    size_t          size;     // Length of data in bytes
+} CTestValue;
+
+typedef struct CTestGen {
+    // Fill value with a random instance
+    void (*generate)(const struct CTestGen* gen, CTestRandom* rnd, CTestValue* value);
+    // Write the step-th simpler candidate of value to candidate, return 0 when there are no more
+    int (*shrink)(const struct CTestGen* gen, const CTestValue* value, unsigned int step, CTestValue* candidate);
+    // Print value for a failure message, caller must call free(str)
+    char* (*print)(const struct CTestGen* gen, const CTestValue* value);
+    int64_t         min, max;   // Integer range
+    size_t          max_size;   // Maximal buffer/string length
+} CTestGen;
+
+// Property check: returns nonzero if the property holds for value. A fatal assertion
+// in the check fails the case. With --threads=N checks run concurrently and must not use CU_ASSERT*.
+typedef int (*CTestCheckFunc)(const CTestValue* value);
+
+void CTest_gen_int_generate(const CTestGen* gen, CTestRandom* rnd, CTestValue* value);
+int CTest_gen_int_shrink(const CTestGen* gen, const CTestValue* value, unsigned int step, CTestValue* candidate);
+char* CTest_gen_int_print(const CTestGen* gen, const CTestValue* value);
+void CTest_gen_bytes_generate(const CTestGen* gen, CTestRandom* rnd, CTestValue* value);
+void CTest_gen_string_generate(const CTestGen* gen, CTestRandom* rnd, CTestValue* value);
+int CTest_gen_bytes_shrink(const CTestGen* gen, const CTestValue* value, unsigned int step, CTestValue* candidate);
+char* CTest_gen_bytes_print(const CTestGen* gen, const CTestValue* value);
+char* CTest_gen_string_print(const CTestGen* gen, const CTestValue* value);
+
+// Generator initializers: static const CTestGen gen = CTEST_GEN_INT(0, 100);
+#define CTEST_GEN_INT(min, max) { CTest_gen_int_generate, CTest_gen_int_shrink, CTest_gen_int_print, (min), (max), 0 }
+#define CTEST_GEN_BYTES(max_size) { CTest_gen_bytes_generate, CTest_gen_bytes_shrink, CTest_gen_bytes_print, 0, 255, (max_size) }
+#define CTEST_GEN_STRING(max_size) { CTest_gen_string_generate, CTest_gen_bytes_shrink, CTest_gen_string_print, 32, 126, (max_size) }
+
+// iterations == 0 - use --iterations (default 100)
+CTestCase* CTest_add_property(CTestSuite* suite, const char* name, const CTestGen* gen, CTestCheckFunc check, unsigned long iterations, const char* file, const int line);
+
+// A normal run replays every input saved in <corpus>/<suite>.<name>/.
+// With --fuzz the target is mutated in process, guided by edge coverage of code
+// compiled with -fsanitize-coverage=trace-pc-guard (CTest.c itself without it).
+// Inputs reaching new coverage are added to the corpus, failing inputs are saved
+// as failure-<hash> and crashing inputs as crash-<hash>.
+CTestCase* CTest_add_fuzz(CTestSuite* suite, const char* name, CTestFuzzFunc fuzzFunction, const char* file, const int line);
+
+// (POSIX) The threads are pinned to the CPUs of the process affinity mask and released together by a
+// spin barrier every round; rounds repeat for --stress-ms. CU_ASSERT* may be used in body, a failed
+// assertion ends the run after its round. Operations per second of each thread, the failed assertions
+// and the threads which could not be pinned are in the run results.
+CTestCase* CTest_add_stress(CTestSuite* suite, const char* name, CTestStressFunc body, unsigned int threads, unsigned long iterations,
+                            const char* file, const int line);
+
+// == Latency histogram ==
+// Fixed size log-linear (HDR style) histogram of nanosecond values: values below 2^(CTEST_HISTOGRAM_BITS + 1)
+// are exact, larger ones fall into 2^CTEST_HISTOGRAM_BITS buckets per power of two (under 1% error).
+#define CTEST_HISTOGRAM_BITS 7
+#define CTEST_HISTOGRAM_BUCKETS ((64 - CTEST_HISTOGRAM_BITS + 1) << CTEST_HISTOGRAM_BITS)
+
+typedef struct CTestHistogram {
+    char*           name;
+    uint64_t        count;
+    uint64_t        min, max;
+    uint64_t        sum;
+    uint64_t        counts[CTEST_HISTOGRAM_BUCKETS];
+} CTestHistogram;
+
+// Empty histogram, caller must call CTest_histogram_free()
+CTestHistogram* CTest_histogram_new(const char* name);
+void CTest_histogram_free(CTestHistogram* h);
+void CTest_histogram_reset(CTestHistogram* h);
+// O(1), lock free: many threads may record into one histogram (atomic with GCC/Clang)
+void CTest_histogram_record(CTestHistogram* h, uint64_t value);
+// Add the values of from to to, e.g. per thread histograms once the threads are done
+void CTest_histogram_merge(CTestHistogram* to, const CTestHistogram* from);
+// Value that percent of the recorded values do not exceed (upper end of its bucket, at most max), 0 - empty
+uint64_t CTest_histogram_percentile(const CTestHistogram* h, double percent);
+// Count, min, mean, max and p50/p90/p99/p99.9/p99.99 lines, caller must call free(str)
+char* CTest_histogram_table(const CTestHistogram* h);
+// Keep the percentiles of h with the results of the running test: listed in the run results
+// and written to --histograms. Collected in the process running the test.
+void CTest_histogram_export(const CTestHistogram* h);
+
+// Fails with the percentile table of h unless the percent-th percentile is below ns
+#define CU_ASSERT_PERCENTILE_BELOW(h, percent, ns) { const CTestHistogram* ctest_h_ = (h); \
+        if(CTEST_LIKELY(CTest_histogram_percentile(ctest_h_, (percent)) < (uint64_t)(ns))) { CTEST_PASSED(); } else { \
+            CTestPercentile(ctest_h_, (percent), (uint64_t)(ns), ("CU_ASSERT_PERCENTILE_BELOW(" #h "," #percent "," #ns ")"), __FILE__, __LINE__); } }
+
+void CTestPercentile(const CTestHistogram* h, double percent, uint64_t limit, const char* message, const char* file, const int line);
+
+// Parse command line options:
+//   --seed=N        base seed for property tests
+//   --iterations=N  default number of property iterations
+//   --threads=N     worker threads for property iterations
+//   --replay=SEED   run every property once with the case seed printed on failure
+//   --fuzz          fuzz FUZZ targets (--fuzz-seconds=60 each, or --fuzz-runs=N)
+//   --fuzz-max-len=N  maximal fuzz input length (4096)
+//   --corpus=DIR    corpus root directory ("corpus")
+//   --filter=GLOB   run only tests whose "suite/test" name matches (* and ?)
+//   --shard=K/N     run only the K-th (0-based) of N equal slices of the selected tests
+//   --event-fd=N    (POSIX) stream binary protocol events of the run to file descriptor N
+//   --watch[=PATHS] (Linux) rerun the binary whenever it or one of the ':' separated PATHS changes;
+//                   last failed tests run first, then tests whose __FILE__ changed, then the rest
+//   --run-order=FILE order file of the --watch supervisor ("F\tsuite\ttest" and "C\tpath" lines)
+//   --rerun-failures=N rerun each failed test N times alone in a new process and classify it
+//                   as deterministic-fail, flaky or passed-on-retry in the run results
+//   --jobs=N        child processes running at once (1)
+//   --quarantine=FILE "suite/test" globs, one per line: failures of matching tests are reported
+//                   but not counted in CU_get_number_of_tests_failed()
+//   --run-index=N   run only the test with registry index N (used by --rerun-failures)
+//   --shuffle[=SEED] run suites and tests of each suite in random order, SEED defaults to --seed
+//   --bisect-order  for each failed test that passes alone, find the preceding test that pollutes it
+//   --progress      one status line (done/total, failures, tests/s, ETA) redrawn at 10 Hz
+//                   instead of a line per test; failures are still printed in full
+//   --timings=FILE  test durations kept between runs for the ETA (TIMINGS.TXT)
+//   --workers=N     run the reentrant tests of each suite on a pool of N threads (work stealing),
+//                   the other tests run serially on the main thread afterwards
+//   --isolate       (POSIX) run each test in a forked child and report its resource usage
+//   --limit-as=MB, --limit-cpu=SEC, --limit-fds=N  default limits of isolated tests (setrlimit), setting
+//                   one isolates every test; violations fail the test with CUF_LimitExceeded
+//   --cache-dir=DIR replay passes of deterministic tests keyed by the binary, test name and input files
+//   --no-cache      run every test, overrides --cache-dir
+//   --journal[=FILE] (POSIX) record each completed test in a memory mapped journal (JOURNAL.BIN)
+//   --resume        skip the tests recorded by an interrupted run and add its results (implies --journal)
+//   --coordinator=ADDR (POSIX) hand the selected tests out in batches to --worker processes connecting
+//                   to ADDR ("unix:PATH" or "HOST:PORT") and report their results as one run; tests of
+//                   a worker that dies go to another one
+//   --local-workers=N  worker processes of this binary started by the coordinator
+//   --batch=N       tests per batch (up to 64), by default shrinking as the queue drains
+//   --worker=ADDR   run the batches of the coordinator at ADDR, streaming the results back
+//   --histograms=FILE  write the percentiles of the exported histograms as tab separated lines
+//   --stress-ms=N   time budget of each STRESS run in milliseconds (200)
+//   --stress-sweep  run STRESS tests with 1, 2, 4... up to their thread count for a scaling curve
+//   --self-benchmark[=FILE] measure the framework itself instead of running the tests (BENCHMARK.TXT)
+// Return: 0 - OK, otherwise unknown or malformed option
+int CTest_parse_args(int argc, char** argv);
+
 void CTest_initialize_registry();
 void CTest_run_all_tests();
 void CTest_run_tests();
+// Failed tests of the last run, quarantined tests excluded. Usable as the exit code.
+unsigned int CU_get_number_of_tests_failed();
+// Measure registration, assertion, failure recording, console output and file comparison costs.
+// Writes "benchmark<TAB>size<TAB>count<TAB>total_ns<TAB>ns_per_op" lines to filename.
+// Return: 0 - OK, 1 - filename cannot be written
+int CTest_self_benchmark(const char* filename);
 
+// message and file are copied on failure
 void CTestStrings(const char* actual, // Actual string
                   const char* expected, // Expected string
                   const char* message, // Message
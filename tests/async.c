@@ -0,0 +1,92 @@
+// TEST_ASYNC: tests of a suite interleave while they sleep, a stack overflow faults on the guard page
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "check.h"
+
+static char order[64];
+
+static void note(char c) {
+    size_t used = strlen(order);
+
+    order[used] = c;
+    order[used + 1] = '\0';
+}
+
+static void slow() {
+    note('a');
+    CTest_sleep_ms(20);
+    note('A');
+    CU_ASSERT(1);
+}
+
+static void fast() {
+    note('b');
+    CTest_sleep_ms(5);
+    note('B');
+    CU_ASSERT(1);
+}
+
+// Deeper than the async stack: without a guard page it runs on into the stack mapped below
+static unsigned int recurse(volatile char* previous, unsigned int depth) {
+    volatile char frame[1024];
+
+    frame[0] = (char)depth;
+    frame[sizeof(frame) - 1] = previous[0];
+    return (0 == depth) ? (unsigned int)frame[0] : recurse(frame, depth - 1) + frame[sizeof(frame) - 1];
+}
+
+static void overflow() {
+    char first = 1;
+
+    CU_ASSERT(0 != recurse(&first, 320));
+}
+
+static void idle() {
+    CTest_sleep_ms(50);
+}
+
+// Exit status of a child process running the overflow test next to idle async tests
+static int overflow_status(void) {
+    CTestSuite* suite;
+    pid_t pid = fork();
+    int status = 0;
+
+    if(0 == pid) {
+        suite = TEST_SUITE("overflow", NULL, NULL);
+        TEST_ASYNC(suite, "deep", overflow);
+        TEST_ASYNC(suite, "idle 1", idle);
+        TEST_ASYNC(suite, "idle 2", idle);
+        CTest_run_tests();
+        _exit(0);
+    }
+
+    waitpid(pid, &status, 0);
+    return status;
+}
+
+int main() {
+    CTestSuite* suite;
+    int status;
+
+    CTest_initialize_registry();
+    suite = TEST_SUITE("async", NULL, NULL);
+    TEST_ASYNC(suite, "slow", slow);
+    TEST_ASYNC(suite, "fast", fast);
+
+    CHECK(0 == check_run());
+    CHECK(2 == check_ended);
+    CHECK(0 == strcmp(order, "abBA"));
+    CTest_cleanup_registry();
+
+#if defined(__linux__) && !defined(__SANITIZE_ADDRESS__)
+    CTest_initialize_registry();
+    status = overflow_status();
+    CHECK(WIFSIGNALED(status) && SIGSEGV == WTERMSIG(status));
+    CTest_cleanup_registry();
+#else
+    (void)status;
+#endif
+
+    return CHECK_RESULT();
+}
@@ -0,0 +1,60 @@
+// CTest_self_benchmark: one tab separated line per measurement, the registry of the caller is left intact
+#include "check.h"
+
+static unsigned int runs = 0;
+
+static void counted() {
+    runs++;
+    CU_ASSERT(1);
+}
+
+// "benchmark<TAB>size<TAB>count<TAB>total_ns<TAB>ns_per_op" lines after the comments, 0 - malformed
+static unsigned int measurements(const char* text) {
+    char name[64];
+    unsigned long long size, count, total;
+    double per_op;
+    unsigned int lines = 0;
+    const char* line;
+
+    for(line = text; '\0' != *line; line = strchr(line, '\n') + 1) {
+        if('#' != line[0]) {
+            if(5 != sscanf(line, "%63[^\t]\t%llu\t%llu\t%llu\t%lf", name, &size, &count, &total, &per_op) || 0 == count) {
+                return 0;
+            }
+
+            lines++;
+        }
+
+        if(NULL == strchr(line, '\n')) {
+            break;
+        }
+    }
+
+    return lines;
+}
+
+int main() {
+    CTestSuite* suite;
+    const char* text;
+
+    CTest_initialize_registry();
+    suite = TEST_SUITE("benchmark", NULL, NULL);
+    CTest_add_test(suite, "counted", counted, __FILE__, __LINE__);
+
+    CHECK(0 == CTest_self_benchmark("bench.txt"));
+    text = check_read_file("bench.txt");
+    CHECK(measurements(text) >= 10);
+    CHECK(NULL != strstr(text, "\nregister\t1000\t"));
+    CHECK(NULL != strstr(text, "\nassert_pass_inline\t"));
+    CHECK(NULL != strstr(text, "\nadd_failure\t"));
+    CHECK(NULL != strstr(text, "\nxprintf\t"));
+    CHECK(NULL != strstr(text, "\ncompare_files\t"));
+
+    CHECK(1 == CTest_self_benchmark("missing/dir/bench.txt"));
+
+    CHECK(0 == check_run());
+    CHECK(1 == runs && 1 == check_ended);
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
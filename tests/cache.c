@@ -0,0 +1,39 @@
+// Result cache: tests with missing input files get keys of their own, a failure is never replayed as a pass
+#include "check.h"
+
+static const char* const inputs_a[] = {"missing_a.txt", NULL};
+static const char* const inputs_b[] = {"missing_b.txt", NULL};
+static unsigned int runs_a = 0, runs_b = 0;
+
+static void passes() {
+    runs_a++;
+    CU_ASSERT(1);
+}
+
+static void fails() {
+    runs_b++;
+    CU_ASSERT(0);
+}
+
+int main(int argc, char** argv) {
+    char* args[] = {argv[0], "--cache-dir=cache.dir", NULL};
+    CTestSuite* suite;
+
+    (void)argc;
+    CTest_initialize_registry();
+    CHECK(0 == CTest_parse_args(2, args));
+    suite = TEST_SUITE("cache", NULL, NULL);
+    CTest_set_deterministic(TEST(suite, "a", passes), inputs_a);
+    CTest_set_deterministic(TEST(suite, "b", fails), inputs_b);
+
+    CHECK(1 == check_run());
+    CHECK(1 == runs_a && 1 == runs_b);
+
+    // The pass of a is replayed, b runs again
+    CHECK(1 == check_run());
+    CHECK(1 == runs_a && 2 == runs_b);
+    CHECK(NULL != strstr(check_log, "cache/b - fails: 0"));
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
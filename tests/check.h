@@ -0,0 +1,113 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+// Checks of the framework itself. Every tests/*.c is a program built with CTest.c (see run.sh):
+// it registers tests, runs them through the public API and returns nonzero when a CHECK fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "CTest.h"
+
+static int checks_failed = 0;
+
+#define CHECK(v) { if(!(v)) { fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #v); checks_failed++; } }
+
+// Results of the last check_run(): one "suite/test: message" line per failure of a test
+static char check_log[65536];
+static unsigned int check_ended = 0;        // test_end callbacks
+static unsigned int check_failed = 0;       // Tests which ended with failures
+static pthread_mutex_t check_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void check_test_end(const CTestSuite* suite, const CTestCase* test, const CTest_FailureRecord* failures,
+                           uint64_t duration_ns, void* context) {
+    const CTest_FailureRecord* failure;
+    size_t used;
+    char* text;
+
+    (void)duration_ns;
+    (void)context;
+
+    // Test callbacks run concurrently on --workers threads
+    pthread_mutex_lock(&check_lock);
+    check_ended++;
+    check_failed += (NULL != failures);
+
+    for(failure = failures; NULL != failure; failure = failure->next) {
+        text = CTest_format_failure(failure);
+        used = strlen(check_log);
+        snprintf(check_log + used, sizeof(check_log) - used, "%s/%s: %s\n", suite->name, test->name, text);
+        free(text);
+    }
+
+    pthread_mutex_unlock(&check_lock);
+}
+
+static const CTestListener check_listener = {NULL, NULL, NULL, NULL, NULL, check_test_end, NULL, NULL};
+
+// Run the registered tests, return the number of failed tests
+static unsigned int check_run(void) {
+    check_log[0] = '\0';
+    check_ended = 0;
+    check_failed = 0;
+    CTest_add_listener(&check_listener);
+    CTest_run_tests();
+    CTest_remove_listener(&check_listener);
+    return CU_get_number_of_tests_failed();
+}
+
+// Last CTE_RunEnd of an --event-fd stream, see check_read_events()
+static CTestEvent check_run_end;
+
+static void check_event(const CTestEvent* event, void* context) {
+    (void)context;
+
+    if(CTE_RunEnd == event->type) {
+        check_run_end = *event;
+    }
+}
+
+// Decode the event stream written to path. Return: 0 - OK
+static int check_read_events(const char* path) {
+    CTestDecoder decoder;
+    char data[4096];
+    size_t size;
+    int result = 0;
+    FILE* f = fopen(path, "rb");
+
+    if(NULL == f) {
+        return -1;
+    }
+
+    memset(&check_run_end, 0, sizeof(check_run_end));
+    CTest_decoder_init(&decoder);
+
+    while(0 == result && 0 != (size = fread(data, 1, sizeof(data), f))) {
+        result = CTest_decoder_feed(&decoder, data, size, check_event, NULL);
+    }
+
+    CTest_decoder_free(&decoder);
+    fclose(f);
+    return result;
+}
+
+// Contents of a text file (CONSOLE.TXT, reports), "" if it cannot be read. Valid until the next call
+static const char* check_read_file(const char* path) {
+    static char text[65536];
+    size_t size = 0;
+    FILE* f = fopen(path, "rb");
+
+    if(NULL != f) {
+        size = fread(text, 1, sizeof(text) - 1, f);
+        fclose(f);
+    }
+
+    text[size] = '\0';
+    return text;
+}
+
+// Exit code of the check program
+#define CHECK_RESULT() (0 != checks_failed ? (fprintf(stderr, "%d checks failed\n", checks_failed), 1) : 0)
+
+#endif // CHECK_H
@@ -0,0 +1,34 @@
+// Assertion counters of the run summary do not wrap at 32 bits
+#include <fcntl.h>
+#include <unistd.h>
+#include "check.h"
+
+static void many() {
+    CTest_add_passed(((uint64_t)1 << 32) + 5);
+    CU_ASSERT(1);
+    CU_ASSERT(0);
+}
+
+int main(int argc, char** argv) {
+    int fd = open("events.bin", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    char event_fd[32];
+    char* args[] = {argv[0], event_fd, NULL};
+    CTestSuite* suite;
+
+    (void)argc;
+    snprintf(event_fd, sizeof(event_fd), "--event-fd=%d", fd);
+    CTest_initialize_registry();
+    CHECK(0 == CTest_parse_args(2, args));
+    suite = TEST_SUITE("counters", NULL, NULL);
+    TEST(suite, "many", many);
+
+    CHECK(1 == check_run());
+    close(fd);
+
+    CHECK(0 == check_read_events("events.bin"));
+    CHECK(((uint64_t)1 << 32) + 7 == check_run_end.asserts);
+    CHECK(1 == check_run_end.asserts_failed);
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
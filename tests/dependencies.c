@@ -0,0 +1,103 @@
+// Suite dependencies: a suite runs after the suites it depends on and is skipped when one of them fails,
+// also when its initialization fails
+#include "check.h"
+
+static char order[64];
+
+static void note(char c) {
+    size_t used = strlen(order);
+
+    order[used] = c;
+    order[used + 1] = '\0';
+}
+
+static void consumer() { note('c'); }
+static void producer() { note('p'); }
+static void base() { note('b'); }
+
+static void broken() {
+    note('x');
+    CU_FAIL("broken dependency");
+}
+
+static void never() {
+    note('n');
+}
+
+static void independent() {
+    note('i');
+}
+
+static int failing_init() {
+    return 1;
+}
+
+// Dependents of a suite whose initialization fails are skipped, independent suites still run
+static void check_init_failure(int argc, char** argv) {
+    char* args[] = {argc > 0 ? argv[0] : "dependencies", "--shuffle=7", NULL};
+    CTestSuite* producer;
+    CTestSuite* consumer;
+    CTestSuite* other;
+    int shuffled;
+
+    for(shuffled = 0; shuffled < 2; shuffled++) {
+        CTest_initialize_registry();
+
+        // run_plan() orders a shuffled run, run_suites() the plain one
+        if(shuffled) {
+            CHECK(0 == CTest_parse_args(2, args));
+        }
+
+        producer = TEST_SUITE("producer", failing_init, NULL);
+        CTest_add_test(producer, "never", never, __FILE__, __LINE__);
+        consumer = TEST_SUITE("consumer", NULL, NULL);
+        CTest_add_test(consumer, "never", never, __FILE__, __LINE__);
+        other = TEST_SUITE("other", NULL, NULL);
+        CTest_add_test(other, "independent", independent, __FILE__, __LINE__);
+        CHECK(0 == CTest_add_dependency(consumer, producer));
+
+        order[0] = '\0';
+        remove("CONSOLE.TXT");
+        check_run();
+        CHECK(0 == strcmp(order, "i"));
+        CHECK(NULL != strstr(check_read_file("CONSOLE.TXT"), "Skipped by dependency: 1 suites, 1 tests"));
+        CHECK(NULL != strstr(check_read_file("CONSOLE.TXT"), "WARNING - Suite initialization failed for 'producer'."));
+        CTest_cleanup_registry();
+    }
+}
+
+int main(int argc, char** argv) {
+    CTestSuite* consumers;
+    CTestSuite* producers;
+    CTestSuite* bases;
+    CTestSuite* broken_suite;
+    CTestSuite* skipped;
+
+    CTest_initialize_registry();
+    consumers = TEST_SUITE("consumers", NULL, NULL);
+    CTest_add_test(consumers, "consumer", consumer, __FILE__, __LINE__);
+    producers = TEST_SUITE("producers", NULL, NULL);
+    CTest_add_test(producers, "producer", producer, __FILE__, __LINE__);
+    bases = TEST_SUITE("bases", NULL, NULL);
+    CTest_add_test(bases, "base", base, __FILE__, __LINE__);
+    broken_suite = TEST_SUITE("broken", NULL, NULL);
+    CTest_add_test(broken_suite, "broken", broken, __FILE__, __LINE__);
+    skipped = TEST_SUITE_AFTER("skipped", NULL, NULL, producers, broken_suite);
+    CTest_add_test(skipped, "never 1", never, __FILE__, __LINE__);
+    CTest_add_test(skipped, "never 2", never, __FILE__, __LINE__);
+
+    // consumers -> producers -> bases
+    CHECK(0 == CTest_add_dependency(consumers, producers));
+    CHECK(0 == CTest_add_dependency(producers, bases));
+    CHECK(-1 == CTest_add_dependency(bases, consumers));
+    CHECK(-1 == CTest_add_dependency(bases, bases));
+
+    CHECK(1 == check_run());
+    CHECK(0 == strcmp(order, "bpcx"));
+    CHECK(NULL != strstr(check_read_file("CONSOLE.TXT"), "Skipped by dependency: 1 suites, 2 tests"));
+
+    CTest_cleanup_registry();
+
+    check_init_failure(argc, argv);
+    return CHECK_RESULT();
+}
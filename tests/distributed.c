@@ -0,0 +1,61 @@
+// --coordinator with a local worker: a failed suite initialization skips the suite, the worker goes on
+#include <fcntl.h>
+#include <unistd.h>
+#include "check.h"
+
+static int broken_init() {
+    return 1;
+}
+
+static void never() {
+    CU_FAIL("test of a suite whose initialization failed ran");
+}
+
+static void passes() {
+    CU_ASSERT(1);
+}
+
+void register_tests() {
+    CTestSuite* suite = TEST_SUITE("broken", broken_init, NULL);
+
+    TEST(suite, "a", never);
+    TEST(suite, "b", never);
+    suite = TEST_SUITE("fine", NULL, NULL);
+    TEST(suite, "c", passes);
+    TEST(suite, "d", passes);
+}
+
+int main(int argc, char** argv) {
+    char event_fd[32];
+    char* args[] = {argv[0], "--coordinator=unix:coordinator.sock", "--local-workers=1", event_fd, NULL};
+    int fd;
+
+    CTest_initialize_registry();
+
+    // The local worker, started by the coordinator with its own arguments
+    if(argc > 1) {
+        CTest_parse_args(argc, argv);
+        register_tests();
+        CTest_run_tests();
+        CTest_cleanup_registry();
+        return 0;
+    }
+
+    fd = open("events.bin", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    snprintf(event_fd, sizeof(event_fd), "--event-fd=%d", fd);
+    CHECK(0 == CTest_parse_args(4, args));
+    register_tests();
+
+    CHECK(0 == check_run());
+    close(fd);
+    // Only the tests of the fine suite report
+    CHECK(2 == check_ended);
+    CHECK(NULL == strstr(check_log, "ran"));
+
+    CHECK(0 == check_read_events("events.bin"));
+    CHECK(1 == check_run_end.count[0] && 1 == check_run_end.count[1]);     // Suites run, failed
+    CHECK(2 == check_run_end.count[3] && 0 == check_run_end.count[4]);     // Tests run, failed
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
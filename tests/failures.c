@@ -0,0 +1,70 @@
+// Failure records: the public assertion functions copy message and file, the macros keep literals
+#include "check.h"
+
+static char seen[4096];
+
+static void record_files(const CTestSuite* suite, const CTestCase* test, const CTest_FailureRecord* failures,
+                         uint64_t duration_ns, void* context) {
+    const CTest_FailureRecord* failure;
+    char* text;
+    size_t used;
+
+    (void)suite;
+    (void)test;
+    (void)duration_ns;
+    (void)context;
+
+    for(failure = failures; NULL != failure; failure = failure->next) {
+        text = CTest_format_failure(failure);
+        used = strlen(seen);
+        snprintf(seen + used, sizeof(seen) - used, "%s:%u %s\n", failure->file, failure->line, text);
+        free(text);
+    }
+}
+
+static const CTestListener files_listener = {NULL, NULL, NULL, NULL, NULL, record_files, NULL, NULL};
+
+// Message and file built on the stack, overwritten before the report
+static void built_names() {
+    char file[64];
+    char message[64];
+
+    strcpy(file, "generated.c");
+    strcpy(message, "built message");
+    CTest(0, message, file, 7);
+    CTestInt(1, 2, message, file, 8);
+    CTestStrings("a", "b", message, file, 9);
+    memset(file, 'x', sizeof(file) - 1);
+    memset(message, 'y', sizeof(message) - 1);
+}
+
+static void macros() {
+    int one = 1;
+
+    CU_ASSERT_EQUAL(one, 2);
+    CU_ASSERT_STRING_EQUAL("left", "right");
+}
+
+int main() {
+    CTestSuite* suite;
+
+    CTest_initialize_registry();
+    suite = TEST_SUITE("failures", NULL, NULL);
+    TEST(suite, "built names", built_names);
+    TEST(suite, "macros", macros);
+
+    CTest_add_listener(&files_listener);
+    CHECK(2 == check_run());
+    CTest_remove_listener(&files_listener);
+
+    CHECK(NULL != strstr(seen, "generated.c:7 built message\n"));
+    CHECK(NULL != strstr(seen, "generated.c:8 actual=1 expected=2 built message\n"));
+    CHECK(NULL != strstr(seen, "generated.c:9 built message\n === actual ===\n\"a\""));
+    CHECK(NULL != strstr(seen, "actual=1 expected=2 CU_ASSERT_EQUAL(one,2)\n"));
+    CHECK(NULL != strstr(seen, "CU_ASSERT_STRING_EQUAL(\"left\",\"right\")\n === actual ===\n\"left\""));
+    CHECK(NULL == strstr(seen, "xxx"));
+    CHECK(NULL == strstr(seen, "yyy"));
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
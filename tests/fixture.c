@@ -0,0 +1,39 @@
+// Per-test setup: a fatal assertion in setup skips the test body, teardown still runs
+#include "check.h"
+
+static int setup_ok = 1;
+static unsigned int bodies = 0, teardowns = 0;
+
+static void setup() {
+    CU_ASSERT_FATAL(setup_ok);
+}
+
+static void teardown() {
+    teardowns++;
+}
+
+static void body() {
+    bodies++;
+    CU_ASSERT(1);
+}
+
+int main() {
+    CTestSuite* suite;
+
+    CTest_initialize_registry();
+    suite = TEST_SUITE_WITH_SETUP("fixture", NULL, NULL, setup, teardown);
+    TEST(suite, "a", body);
+    TEST(suite, "b", body);
+
+    CHECK(0 == check_run());
+    CHECK(2 == bodies && 2 == teardowns);
+
+    setup_ok = 0;
+    bodies = teardowns = 0;
+    CHECK(2 == check_run());
+    CHECK(0 == bodies && 2 == teardowns);
+    CHECK(NULL != strstr(check_log, "fixture/a - body: setup_ok\n"));
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
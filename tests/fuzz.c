@@ -0,0 +1,77 @@
+// FUZZ: saved corpus inputs are replayed in a normal run, --fuzz saves the inputs that fail
+#include <dirent.h>
+#include <sys/stat.h>
+#include "check.h"
+
+static unsigned long calls = 0;
+
+// Fails on every input starting with '!'
+static void bang(const uint8_t* data, size_t size) {
+    calls++;
+    CU_ASSERT(0 == size || '!' != data[0]);
+}
+
+// Fails on every input longer than one byte
+static void short_only(const uint8_t* data, size_t size) {
+    (void)data;
+    CU_ASSERT(size <= 1);
+}
+
+static void save(const char* path, const char* text) {
+    FILE* f = fopen(path, "wb");
+
+    if(NULL != f) {
+        fputs(text, f);
+        fclose(f);
+    }
+}
+
+// Saved failure-* inputs of a target directory
+static unsigned int failures_saved(const char* path) {
+    unsigned int count = 0;
+    struct dirent* entry;
+    DIR* dir = opendir(path);
+
+    while(NULL != dir && NULL != (entry = readdir(dir))) {
+        count += (0 == strncmp(entry->d_name, "failure-", 8));
+    }
+
+    if(NULL != dir) {
+        closedir(dir);
+    }
+
+    return count;
+}
+
+int main(int argc, char** argv) {
+    char* args[] = {argv[0], "--corpus=corpus", "--fuzz-runs=2000", "--fuzz-max-len=8", "--seed=1", NULL};
+    CTestSuite* suite;
+
+    (void)argc;
+    mkdir("corpus", 0755);
+    mkdir("corpus/fuzz.bang", 0755);
+    save("corpus/fuzz.bang/good", "ok");
+    save("corpus/fuzz.bang/bad", "!x");
+
+    // A normal run: the corpus only, the bad input fails the target
+    CTest_initialize_registry();
+    CHECK(0 == CTest_parse_args(2, args));
+    suite = TEST_SUITE("fuzz", NULL, NULL);
+    FUZZ(suite, "bang", bang);
+    CHECK(1 == check_run());
+    CHECK(NULL != strstr(check_log, "fuzz/bang: Corpus input corpus/fuzz.bang/bad failed\n"));
+    CHECK(calls <= 2);
+    CTest_cleanup_registry();
+
+    // --fuzz: a failing mutation is reported and kept as a regression case
+    CTest_initialize_registry();
+    CHECK(0 == CTest_parse_args(5, args));
+    suite = TEST_SUITE("fuzz", NULL, NULL);
+    FUZZ(suite, "short", short_only);
+    CHECK(1 == check_run());
+    CHECK(NULL != strstr(check_log, "fuzz/short: Fuzz input failed after"));
+    CHECK(1 == failures_saved("corpus/fuzz.short"));
+    CTest_cleanup_registry();
+
+    return CHECK_RESULT();
+}
@@ -0,0 +1,42 @@
+// Latency histograms: exact percentiles of small values, run.sh links without libm
+#include "check.h"
+
+static void percentiles() {
+    CTestHistogram* h = CTest_histogram_new("latency");
+    uint64_t v;
+
+    for(v = 1; v <= 100; v++) {
+        CTest_histogram_record(h, v);
+    }
+
+    CU_ASSERT_EQUAL(CTest_histogram_percentile(h, 50.0), 50);
+    CU_ASSERT_EQUAL(CTest_histogram_percentile(h, 99.0), 99);
+    CU_ASSERT_EQUAL(CTest_histogram_percentile(h, 99.5), 100);
+    CU_ASSERT_EQUAL(CTest_histogram_percentile(h, 100.0), 100);
+    CU_ASSERT_EQUAL(CTest_histogram_percentile(h, 0.0), 1);
+    CU_ASSERT_PERCENTILE_BELOW(h, 90.0, 91);
+    CTest_histogram_free(h);
+}
+
+static void over_limit() {
+    CTestHistogram* h = CTest_histogram_new("slow");
+
+    CTest_histogram_record(h, 5000);
+    CU_ASSERT_PERCENTILE_BELOW(h, 50.0, 1000);
+    CTest_histogram_free(h);
+}
+
+int main() {
+    CTestSuite* suite;
+
+    CTest_initialize_registry();
+    suite = TEST_SUITE("histogram", NULL, NULL);
+    TEST(suite, "percentiles", percentiles);
+    TEST(suite, "over limit", over_limit);
+
+    CHECK(1 == check_run());
+    CHECK(NULL != strstr(check_log, "over_limit: CU_ASSERT_PERCENTILE_BELOW(h,50.0,1000) p50 = 5000 ns"));
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
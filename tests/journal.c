@@ -0,0 +1,59 @@
+// --journal: a journal which cannot grow stops cleanly at its last committed test, --resume uses it
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "check.h"
+
+#define TESTS 40
+
+static char big[128 * 1024];
+static unsigned int runs = 0;
+
+// Each failure adds about 256 KB to the journal
+static void fails() {
+    runs++;
+    CU_ASSERT_STRING_EQUAL(big, "");
+}
+
+int main(int argc, char** argv) {
+    char* args[] = {argv[0], "--journal=journal.bin", NULL};
+    char* resume[] = {argv[0], "--journal=journal.bin", "--resume", NULL};
+    struct rlimit limit, saved;
+    struct stat st;
+    CTestSuite* suite;
+    char name[16];
+    int i;
+
+    (void)argc;
+    memset(big, 'x', sizeof(big) - 1);
+    signal(SIGXFSZ, SIG_IGN);       // Writes over the limit fail with EFBIG instead
+
+    CTest_initialize_registry();
+    suite = TEST_SUITE("journal", NULL, NULL);
+
+    for(i = 0; i < TESTS; i++) {
+        snprintf(name, sizeof(name), "t%d", i);
+        CTest_add_test(suite, name, fails, __FILE__, __LINE__);
+    }
+
+    getrlimit(RLIMIT_FSIZE, &saved);
+    limit = saved;
+    limit.rlim_cur = 3 << 20;
+    CHECK(0 == setrlimit(RLIMIT_FSIZE, &limit));
+    CHECK(0 == CTest_parse_args(2, args));
+    CHECK(TESTS == check_run());
+    CHECK(TESTS == runs);
+
+    // Cut to the tests recorded before the file could not grow
+    CHECK(0 == stat("journal.bin", &st));
+    CHECK(st.st_size > (1 << 20) && st.st_size < (3 << 20));
+
+    setrlimit(RLIMIT_FSIZE, &saved);
+    runs = 0;
+    CHECK(0 == CTest_parse_args(3, resume));
+    CHECK(TESTS == check_run());
+    CHECK(0 < runs && runs < TESTS);
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,46 @@
+// Isolated tests: a crash under an address space limit is a crash unless memory ran out
+#include <signal.h>
+#include "check.h"
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define __SANITIZE_ADDRESS__ 1
+#endif
+#endif
+
+static void crash() {
+    raise(SIGSEGV);
+}
+
+// Touch memory until the limit is hit, then crash like an unchecked malloc would
+static void exhaust() {
+    size_t chunk = 1 << 20;
+    char* p;
+
+    while(NULL != (p = (char*)malloc(chunk))) {
+        memset(p, 1, chunk);
+    }
+
+    abort();
+}
+
+int main() {
+    CTestSuite* suite;
+
+#ifdef __SANITIZE_ADDRESS__
+    // The shadow memory of the sanitizer does not fit under an address space limit
+    return 0;
+#endif
+
+    CTest_initialize_registry();
+    suite = TEST_SUITE("limits", NULL, NULL);
+    CTest_set_limits(TEST(suite, "crash", crash), 256 << 20, 0, 0);
+    CTest_set_limits(TEST(suite, "exhaust", exhaust), 128 << 20, 0, 0);
+
+    CHECK(2 == check_run());
+    CHECK(NULL != strstr(check_log, "limits/crash - crash: Test process killed by signal 11\n"));
+    CHECK(NULL != strstr(check_log, "limits/exhaust - exhaust: Killed by signal 6, address space limit of 128 MB\n"));
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
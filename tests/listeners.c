@@ -0,0 +1,55 @@
+// Listener callbacks: order of test_start, test_failure and test_end, durations for listeners
+#include <unistd.h>
+#include "check.h"
+
+static char calls[1024];
+
+static void append(const char* text) {
+    size_t used = strlen(calls);
+
+    snprintf(calls + used, sizeof(calls) - used, "%s;", text);
+}
+
+static void on_start(const CTestSuite* suite, const CTestCase* test, void* context) {
+    (void)suite;
+    (void)context;
+    append(test->name);
+}
+
+static void on_failure(const CTest_FailureRecord* failure, void* context) {
+    (void)context;
+    append(failure->message);
+}
+
+static void on_end(const CTestSuite* suite, const CTestCase* test, const CTest_FailureRecord* failures,
+                   uint64_t duration_ns, void* context) {
+    (void)suite;
+    (void)test;
+    (void)failures;
+    (void)context;
+    append(duration_ns >= 1000000 ? "end" : "end too soon");
+}
+
+static const CTestListener order_listener = {NULL, NULL, NULL, NULL, on_start, on_end, on_failure, NULL};
+
+static void sleeps() {
+    usleep(2000);
+    CU_ASSERT(0 == 1);
+    CU_ASSERT(2 == 3);
+}
+
+int main() {
+    CTestSuite* suite;
+
+    CTest_initialize_registry();
+    suite = TEST_SUITE("listeners", NULL, NULL);
+    TEST(suite, "a", sleeps);
+
+    CTest_add_listener(&order_listener);
+    CHECK(1 == check_run());
+    CTest_remove_listener(&order_listener);
+    CHECK(0 == strcmp(calls, "a - sleeps;0 == 1;2 == 3;end;"));
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
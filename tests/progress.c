@@ -0,0 +1,75 @@
+// --progress: one redrawn status line instead of a line per test, durations kept in --timings for the ETA
+#include <fcntl.h>
+#include <unistd.h>
+#include "check.h"
+
+static void slow() {
+    CTest_sleep_ms(20);
+    CU_ASSERT(1);
+}
+
+static void fast() {
+    CU_ASSERT(1);
+}
+
+static void fails() {
+    CU_FAIL("progress failure");
+}
+
+// Nanoseconds recorded for "progress<TAB>name" in the timings file, 0 - none
+static unsigned long long recorded(const char* timings, const char* name) {
+    char key[64];
+    const char* line;
+
+    snprintf(key, sizeof(key), "progress\t%s\t", name);
+    line = strstr(timings, key);
+    return (NULL != line) ? strtoull(line + strlen(key), NULL, 10) : 0;
+}
+
+int main(int argc, char** argv) {
+    char* args[] = {argv[0], "--progress", "--timings=timings.txt", "--filter=progress/*s*", NULL};
+    CTestSuite* suite;
+    const char* text;
+    int saved_fd, out_fd;
+    FILE* f = fopen("timings.txt", "w");
+
+    (void)argc;
+    // Kept for a test which is not run, dropped for one which no longer exists
+    CHECK(NULL != f);
+    fputs("progress\tnot run\t7000\nprogress\tgone\t5000\n", f);
+    fclose(f);
+
+    CTest_initialize_registry();
+    CHECK(0 == CTest_parse_args(4, args));
+    suite = TEST_SUITE("progress", NULL, NULL);
+    CTest_add_test(suite, "slow", slow, __FILE__, __LINE__);
+    CTest_add_test(suite, "fast", fast, __FILE__, __LINE__);
+    CTest_add_test(suite, "fails", fails, __FILE__, __LINE__);
+    CTest_add_test(suite, "not run", fast, __FILE__, __LINE__);
+
+    fflush(stdout);
+    saved_fd = dup(STDOUT_FILENO);
+    out_fd = open("stdout.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(out_fd, STDOUT_FILENO);
+    CHECK(1 == check_run());
+    fflush(stdout);
+    dup2(saved_fd, STDOUT_FILENO);
+    close(saved_fd);
+    close(out_fd);
+
+    text = check_read_file("stdout.txt");
+    CHECK(NULL != strstr(text, "[3/3] 1 failed |"));
+    CHECK(NULL != strstr(text, "progress failure"));
+    CHECK(NULL == strstr(text, "slow.. OK"));
+    CHECK(NULL == strstr(check_read_file("CONSOLE.TXT"), "[3/3]"));
+
+    text = check_read_file("timings.txt");
+    CHECK(recorded(text, "slow") >= 20000000ULL);
+    CHECK(0 != recorded(text, "fast"));
+    CHECK(0 != recorded(text, "fails"));
+    CHECK(7000 == recorded(text, "not run"));
+    CHECK(0 == recorded(text, "gone"));
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,38 @@
+// PROPERTY: fatal assertions in checks, shrinking over the whole int64_t range
+#include <stdint.h>
+#include "check.h"
+
+static const CTestGen small = CTEST_GEN_INT(0, 1000);
+static const CTestGen full = CTEST_GEN_INT(INT64_MIN, INT64_MAX);
+
+static int below_500(const CTestValue* value) {
+    CU_ASSERT_FATAL(value->i < 500);
+    return 1;
+}
+
+static int not_min(const CTestValue* value) {
+    return value->i > INT64_MIN + 10;
+}
+
+static int holds(const CTestValue* value) {
+    return value->i >= 0;
+}
+
+int main() {
+    CTestSuite* suite;
+
+    CTest_initialize_registry();
+    suite = TEST_SUITE("property", NULL, NULL);
+    PROPERTY(suite, "fatal", small, below_500);
+    PROPERTY(suite, "min", full, not_min);
+    PROPERTY(suite, "holds", small, holds);
+
+    CHECK(2 == check_run());
+    // Shrunk to the boundaries
+    CHECK(NULL != strstr(check_log, "property/fatal: Property failed on iteration"));
+    CHECK(NULL != strstr(check_log, "shrinks: 500\n"));
+    CHECK(NULL != strstr(check_log, "shrinks: -9223372036854775798\n"));
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
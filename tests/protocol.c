@@ -0,0 +1,49 @@
+// Binary result protocol: round trip of an event, frames over CTEST_MAX_FRAME are rejected
+#include "check.h"
+
+static unsigned int decoded = 0;
+static char message[64];
+
+static void count_event(const CTestEvent* event, void* context) {
+    (void)context;
+    decoded++;
+    snprintf(message, sizeof(message), "%s", (NULL != event->message) ? event->message : "");
+}
+
+int main() {
+    CTestDecoder decoder;
+    CTestEvent event;
+    unsigned char frame[256];
+    unsigned char header[CTEST_FRAME_HEADER] = {'C', 'T', CTEST_PROTOCOL_VERSION, CTE_Failure, 0xFF, 0xFF, 0xFF, 0x7F};
+    size_t size, k;
+
+    memset(&event, 0, sizeof(event));
+    event.type = CTE_Failure;
+    event.test = CTEST_NO_TEST;
+    event.message = "split frame";
+    size = CTest_encode_event(&event, frame, sizeof(frame));
+    CHECK(size <= sizeof(frame));
+
+    // Fed a byte at a time
+    CTest_decoder_init(&decoder);
+
+    for(k = 0; k < size; k++) {
+        CHECK(0 == CTest_decoder_feed(&decoder, frame + k, 1, count_event, NULL));
+    }
+
+    CHECK(1 == decoded);
+    CHECK(0 == strcmp(message, "split frame"));
+    CTest_decoder_free(&decoder);
+
+    // A 2 GB payload is refused from the header alone
+    CTest_decoder_init(&decoder);
+    CHECK(-1 == CTest_decoder_feed(&decoder, header, sizeof(header), count_event, NULL));
+    CTest_decoder_free(&decoder);
+    CTest_decoder_init(&decoder);
+    CHECK(0 == CTest_decoder_feed(&decoder, header, 5, count_event, NULL));
+    CHECK(-1 == CTest_decoder_feed(&decoder, header + 5, sizeof(header) - 5, count_event, NULL));
+    CTest_decoder_free(&decoder);
+    CHECK(1 == decoded);
+
+    return CHECK_RESULT();
+}
@@ -0,0 +1,65 @@
+// --rerun-failures: failed tests rerun alone in new processes and are classified, --quarantine keeps
+// matching failures out of the failed count
+#include "check.h"
+
+static int child = 0;
+
+static void always() {
+    CU_FAIL("always fails");
+}
+
+// Fails in the first run only, the reruns are new processes
+static void first_run() {
+    CU_ASSERT(child);
+}
+
+static void passes() {
+    CU_ASSERT(1);
+}
+
+static void register_tests() {
+    CTestSuite* suite = TEST_SUITE("rerun", NULL, NULL);
+
+    CTest_add_test(suite, "always", always, __FILE__, __LINE__);
+    CTest_add_test(suite, "first run", first_run, __FILE__, __LINE__);
+    CTest_add_test(suite, "passes", passes, __FILE__, __LINE__);
+}
+
+int main(int argc, char** argv) {
+    char* args[] = {argv[0], "--rerun-failures=2", "--jobs=2", "--quarantine=quarantine.txt", NULL};
+    const char* console;
+    FILE* f;
+
+    CTest_initialize_registry();
+
+    // A rerun, started with --run-index and --event-fd
+    if(argc > 1) {
+        child = 1;
+        CTest_parse_args(argc, argv);
+        register_tests();
+        CTest_run_tests();
+        CTest_cleanup_registry();
+        return 0;
+    }
+
+    f = fopen("quarantine.txt", "w");
+    CHECK(NULL != f);
+    fputs("# Known failures\nrerun/al*\n", f);
+    fclose(f);
+
+    CHECK(0 == CTest_parse_args(4, args));
+    register_tests();
+
+    // Both failures are reported, only the one of the unquarantined test counts
+    CHECK(1 == check_run());
+    CHECK(2 == check_failed);
+
+    console = check_read_file("CONSOLE.TXT");
+    CHECK(NULL != strstr(console, "Failed tests (2 reruns each, passed/reruns):"));
+    CHECK(NULL != strstr(console, "deterministic-fail   0/2   rerun/always [quarantined]\n"));
+    CHECK(NULL != strstr(console, "passed-on-retry      2/2   rerun/first run\n"));
+    CHECK(NULL != strstr(console, "1 failed test(s) quarantined, not counted as failed"));
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
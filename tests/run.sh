@@ -0,0 +1,33 @@
+#!/bin/sh
+# Build every tests/*.c with CTest.c and run it in a scratch directory.
+#   tests/run.sh [extra compiler flags]      CC=clang tests/run.sh -fsanitize=address
+# Only -pthread is linked: the library must not need libm or other libraries.
+
+cd "$(dirname "$0")/.." || exit 1
+root=$(pwd)
+cc=${CC:-gcc}
+work=$(mktemp -d) || exit 1
+failed=0
+
+for src in tests/*.c; do
+    name=$(basename "$src" .c)
+    mkdir "$work/$name"
+
+    if ! $cc -std=gnu99 -Wall -g -I"$root" -I"$root/tests" "$@" "$src" CTest.c -o "$work/$name/$name" -pthread 2> "$work/$name/build.txt"; then
+        echo "FAIL $name (build)"
+        tail -n 20 "$work/$name/build.txt"
+        failed=1
+        continue
+    fi
+
+    if (cd "$work/$name" && "./$name" > output.txt 2>&1); then
+        echo "ok   $name"
+    else
+        echo "FAIL $name"
+        cat "$work/$name/output.txt"
+        failed=1
+    fi
+done
+
+rm -rf "$work"
+exit $failed
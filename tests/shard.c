@@ -0,0 +1,45 @@
+// --shard=INDEX/COUNT: malformed values are rejected and leave the options alone, a shard runs its slice
+#include "check.h"
+
+static unsigned int runs = 0;
+
+static void counted() {
+    runs++;
+    CU_ASSERT(1);
+}
+
+static int parse(char* arg) {
+    char* args[] = {"shard", arg, NULL};
+
+    return CTest_parse_args(2, args);
+}
+
+int main() {
+    CTestSuite* suite;
+
+    CHECK(0 != parse("--shard=1/2xyz"));
+    CHECK(0 != parse("--shard=2/2"));
+    CHECK(0 != parse("--shard=1/0"));
+    CHECK(0 != parse("--shard=-1/2"));
+    CHECK(0 != parse("--shard= 1/2"));
+    CHECK(0 != parse("--shard=1/ 2"));
+    CHECK(0 != parse("--shard=1/4294967296"));
+
+    // Nothing above was applied: all 4 tests run
+    CTest_initialize_registry();
+    suite = TEST_SUITE("shard", NULL, NULL);
+    TEST(suite, "a", counted);
+    TEST(suite, "b", counted);
+    TEST(suite, "c", counted);
+    TEST(suite, "d", counted);
+    CHECK(0 == check_run());
+    CHECK(4 == runs);
+
+    CHECK(0 == parse("--shard=1/2"));
+    runs = 0;
+    CHECK(0 == check_run());
+    CHECK(2 == runs);
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
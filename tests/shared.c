@@ -0,0 +1,97 @@
+// CTest_shared: built once per run, the same sealed pages in processes started by the run, read only
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "check.h"
+
+#define SHARED_SIZE 4096
+
+static unsigned int builds = 0;
+
+static int build_table(void* data, size_t size, void* context) {
+    unsigned char* bytes = (unsigned char*)data;
+    size_t i;
+
+    (void)context;
+    builds++;
+
+    for(i = 0; i < size; i++) {
+        bytes[i] = (unsigned char)(i * 7);
+    }
+
+    return 0;
+}
+
+// A process started by the run must map the pages, not build them
+static int refuse(void* data, size_t size, void* context) {
+    (void)data;
+    (void)size;
+    (void)context;
+    return 1;
+}
+
+static int table_valid(const CTestShared* shared) {
+    const unsigned char* bytes = (const unsigned char*)shared->data;
+    size_t i;
+
+    for(i = 0; i < shared->size; i++) {
+        if(bytes[i] != (unsigned char)(i * 7)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    const CTestShared* shared;
+    const CTestShared* again;
+    pid_t pid;
+    int status = 0;
+
+    CTest_initialize_registry();
+
+    if(argc > 1) {
+        shared = CTest_shared("table", SHARED_SIZE, refuse, NULL);
+        return (NULL != shared && table_valid(shared)) ? 0 : 1;
+    }
+
+    shared = CTest_shared("table", SHARED_SIZE, build_table, NULL);
+    again = CTest_shared("table", SHARED_SIZE, build_table, NULL);
+    CHECK(NULL != shared && table_valid(shared));
+    CHECK(shared == again && 1 == builds);
+    CHECK(NULL == CTest_shared("table", 2 * SHARED_SIZE, build_table, NULL));
+    CHECK(NULL == CTest_shared("refused", SHARED_SIZE, refuse, NULL));
+
+#ifdef __linux__
+    CHECK(shared->fd >= 0);
+
+    // A new process of the run inherits the memfd
+    pid = fork();
+
+    if(0 == pid) {
+        execl(argv[0], argv[0], "child", (char*)NULL);
+        _exit(2);
+    }
+
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+
+    // Writes crash (a sanitizer reports the SIGSEGV and exits instead)
+    pid = fork();
+
+    if(0 == pid) {
+        ((unsigned char*)shared->data)[0] = 1;
+        _exit(0);
+    }
+
+    waitpid(pid, &status, 0);
+    CHECK((WIFSIGNALED(status) && SIGSEGV == WTERMSIG(status)) || (WIFEXITED(status) && 0 != WEXITSTATUS(status)));
+#else
+    (void)pid;
+    (void)status;
+#endif
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,110 @@
+// --shuffle: a seed gives one permutation of the tests, --bisect-order finds the test a failure depends on
+#include "check.h"
+
+static char order[64];
+static int polluted = 0;
+
+static void note(char c) {
+    size_t used = strlen(order);
+
+    order[used] = c;
+    order[used + 1] = '\0';
+}
+
+static void a() { note('a'); }
+static void b() { note('b'); }
+static void c() { note('c'); }
+static void d() { note('d'); }
+static void e() { note('e'); }
+static void f() { note('f'); }
+
+static void pollute() {
+    polluted = 1;
+}
+
+static void innocent() {
+    CU_ASSERT(1);
+}
+
+static void victim() {
+    CU_ASSERT(!polluted);
+}
+
+// Tests of the bisection, registered the same way by the children it starts
+static void register_order_tests() {
+    CTestSuite* suite = TEST_SUITE("order", NULL, NULL);
+
+    CTest_add_test(suite, "innocent 1", innocent, __FILE__, __LINE__);
+    CTest_add_test(suite, "pollute", pollute, __FILE__, __LINE__);
+    CTest_add_test(suite, "innocent 2", innocent, __FILE__, __LINE__);
+    CTest_add_test(suite, "innocent 3", innocent, __FILE__, __LINE__);
+    CTest_add_test(suite, "victim", victim, __FILE__, __LINE__);
+}
+
+// Order of one run with --shuffle=seed
+static void shuffled(const char* seed, char* result) {
+    char* args[] = {"shuffle", (char*)seed, NULL};
+    CTestSuite* suite;
+
+    CTest_initialize_registry();
+    CHECK(0 == CTest_parse_args(2, args));
+    suite = TEST_SUITE("letters", NULL, NULL);
+    CTest_add_test(suite, "a", a, __FILE__, __LINE__);
+    CTest_add_test(suite, "b", b, __FILE__, __LINE__);
+    CTest_add_test(suite, "c", c, __FILE__, __LINE__);
+    suite = TEST_SUITE("more letters", NULL, NULL);
+    CTest_add_test(suite, "d", d, __FILE__, __LINE__);
+    CTest_add_test(suite, "e", e, __FILE__, __LINE__);
+    CTest_add_test(suite, "f", f, __FILE__, __LINE__);
+
+    order[0] = '\0';
+    CHECK(0 == check_run());
+    strcpy(result, order);
+    CTest_cleanup_registry();
+}
+
+// Suites stay contiguous: the letters of one suite are next to each other
+static int is_permutation(const char* run) {
+    const char* first = strpbrk(run, "abc");
+
+    return 6 == strlen(run) && NULL != strchr(run, 'a') && NULL != strchr(run, 'b') && NULL != strchr(run, 'c') &&
+           NULL != strchr(run, 'd') && NULL != strchr(run, 'e') && NULL != strchr(run, 'f') &&
+           NULL != first && 3 == strspn(first, "abc");
+}
+
+int main(int argc, char** argv) {
+    char* args[] = {argv[0], "--bisect-order", NULL};
+    char run[64], again[64];
+    static const char* const seeds[] = {"--shuffle=1", "--shuffle=2", "--shuffle=3", "--shuffle=4", "--shuffle=5"};
+    unsigned int i, reordered = 0;
+
+    CTest_initialize_registry();
+
+    // A bisection child, started with --run-order and --event-fd
+    if(argc > 1) {
+        CTest_parse_args(argc, argv);
+        register_order_tests();
+        CTest_run_tests();
+        CTest_cleanup_registry();
+        return 0;
+    }
+
+    CHECK(0 == CTest_parse_args(2, args));
+    register_order_tests();
+    CHECK(1 == check_run());
+    CHECK(NULL != strstr(check_read_file("CONSOLE.TXT"), "Order dependence:\n  order/victim fails after order/pollute"));
+    CTest_cleanup_registry();
+
+    for(i = 0; i < sizeof(seeds) / sizeof(seeds[0]); i++) {
+        shuffled(seeds[i], run);
+        shuffled(seeds[i], again);
+        CHECK(is_permutation(run));
+        CHECK(0 == strcmp(run, again));
+        reordered += (0 != strcmp(run, "abcdef"));
+    }
+
+    CHECK(0 != reordered);
+    CHECK(NULL != strstr(check_read_file("CONSOLE.TXT"), "Shuffle seed: 5 (rerun with --shuffle=5)"));
+
+    return CHECK_RESULT();
+}
@@ -0,0 +1,43 @@
+// Static registration: CTEST_SUITE()/CTEST() nodes run in file and line order, before added ones
+#include "check.h"
+
+static char order[256];
+
+static void note(const char* name) {
+    size_t used = strlen(order);
+
+    snprintf(order + used, sizeof(order) - used, "%s ", name);
+}
+
+static void first() { note("first"); }
+static void second() { note("second"); }
+static void third() { note("third"); }
+static void fourth() { note("fourth"); }
+static void added() { note("added"); }
+
+CTEST_SUITE(alpha, NULL, NULL);
+CTEST(alpha, first);
+CTEST(alpha, second);
+CTEST_SUITE(beta, NULL, NULL);
+CTEST(beta, third);
+CTEST(alpha, fourth);
+
+int main() {
+    CTestSuite* suite;
+
+    CTest_initialize_registry();
+    suite = TEST_SUITE("gamma", NULL, NULL);
+    TEST(suite, "added", added);
+
+    CHECK(0 == check_run());
+    CHECK(0 == strcmp(order, "first second fourth third added "));
+
+    // Linked again from the sections
+    order[0] = '\0';
+    CTest_initialize_registry();
+    CHECK(0 == check_run());
+    CHECK(0 == strcmp(order, "first second fourth third "));
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,52 @@
+// STRESS: one thread per CPU of the affinity mask, each pinned to an allowed CPU, assertions of all threads counted
+#define _GNU_SOURCE
+#include <sched.h>
+#include "check.h"
+
+static cpu_set_t allowed;
+static unsigned int threads_seen = 0;
+static unsigned int off_mask = 0;
+
+static void body(unsigned int thread, unsigned long iteration) {
+    (void)iteration;
+
+    __atomic_fetch_or(&threads_seen, 1u << (thread & 31), __ATOMIC_RELAXED);
+
+    if(!CPU_ISSET(sched_getcpu(), &allowed)) {
+        __atomic_fetch_add(&off_mask, 1, __ATOMIC_RELAXED);
+    }
+
+    CU_ASSERT(thread < 64);
+}
+
+static void failing(unsigned int thread, unsigned long iteration) {
+    CU_ASSERT(thread != 1 || iteration != 3);
+}
+
+int main(int argc, char** argv) {
+    char* args[] = {argv[0], "--stress-ms=20", NULL};
+    CTestSuite* suite;
+    CTestCase* test;
+    int cpus;
+
+    (void)argc;
+    CHECK(0 == sched_getaffinity(0, sizeof(allowed), &allowed));
+    cpus = CPU_COUNT(&allowed);
+
+    CTest_initialize_registry();
+    CHECK(0 == CTest_parse_args(2, args));
+    suite = TEST_SUITE("stress", NULL, NULL);
+    test = STRESS(suite, "per cpu", body, 0, 100);
+    CHECK(NULL == test->test);
+    STRESS(suite, "failing", failing, 2, 10);
+
+    CHECK(1 == check_run());
+    CHECK(2 == check_ended);
+    CHECK((cpus >= 32 ? ~0u : (1u << cpus) - 1) == threads_seen);
+    CHECK(0 == off_mask);
+    CHECK(NULL != strstr(check_log, "stress/failing"));
+    CHECK(NULL == strstr(check_log, "stress/per cpu"));
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,36 @@
+// TEST_TABLE: every row is a case of its own, a failed row fails only itself
+#include "check.h"
+
+typedef struct Row {
+    int a, b, sum;
+} Row;
+
+static const Row rows[] = {
+    {1, 2, 3},
+    {2, 2, 5},  // Wrong on purpose
+    {0, 0, 0},
+    {-1, 1, 0}
+};
+
+static unsigned int calls = 0;
+
+static void add_row(const Row* row) {
+    calls++;
+    CU_ASSERT_EQUAL(row->a + row->b, row->sum);
+}
+
+int main() {
+    CTestSuite* suite;
+
+    CTest_initialize_registry();
+    suite = TEST_SUITE("table", NULL, NULL);
+    TEST_TABLE(suite, add_row, rows, sizeof(rows) / sizeof(rows[0]));
+
+    CHECK(1 == check_run());
+    CHECK(4 == calls);
+    CHECK(NULL != strstr(check_log, "actual=4 expected=5"));
+    CHECK(NULL == strstr(check_log, "expected=3"));
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
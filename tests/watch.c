@@ -0,0 +1,42 @@
+// --run-order (written by the --watch supervisor): last failed tests first, then tests of changed files
+#include "check.h"
+
+static char order[64];
+
+static void note(char c) {
+    size_t used = strlen(order);
+
+    order[used] = c;
+    order[used + 1] = '\0';
+}
+
+static void a() { note('a'); }
+static void b() { note('b'); }
+static void c() { note('c'); }
+static void d() { note('d'); }
+
+int main(int argc, char** argv) {
+    char* args[] = {argv[0], "--run-order=order.txt", NULL};
+    CTestSuite* suite;
+    FILE* f = fopen("order.txt", "w");
+
+    (void)argc;
+    CHECK(NULL != f);
+    fputs("F\twatch\tc\nC\t/home/user/project/src/changed.c\nF\twatch\tmissing\n", f);
+    fclose(f);
+
+    CTest_initialize_registry();
+    CHECK(0 == CTest_parse_args(2, args));
+    suite = TEST_SUITE("watch", NULL, NULL);
+    CTest_add_test(suite, "a", a, __FILE__, __LINE__);
+    CTest_add_test(suite, "b", b, "src/changed.c", 10);
+    CTest_add_test(suite, "c", c, __FILE__, __LINE__);
+    CTest_add_test(suite, "d", d, "src/unchanged.c", 20);
+
+    CHECK(0 == check_run());
+    CHECK(4 == check_ended);
+    CHECK(0 == strcmp(order, "cbad"));
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}
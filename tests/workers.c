@@ -0,0 +1,61 @@
+// --workers: passing assertions of pool threads and of the serial path are all counted
+#include <fcntl.h>
+#include <unistd.h>
+#include "check.h"
+
+#define ASSERTS 10000
+
+static void reentrant() {
+    int i;
+
+    for(i = 0; i < ASSERTS; i++) {
+        CU_ASSERT(i >= 0);
+    }
+}
+
+static void batched() {
+    int i;
+
+    CTEST_BATCH_BEGIN
+    for(i = 0; i < ASSERTS; i++) {
+        CU_ASSERT(i >= 0);
+    }
+    CTEST_BATCH_END
+}
+
+static void serial() {
+    int i;
+
+    for(i = 0; i < ASSERTS; i++) {
+        CU_ASSERT_EQUAL(i, i);
+    }
+}
+
+int main(int argc, char** argv) {
+    int fd = open("events.bin", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    char event_fd[32];
+    char* args[] = {argv[0], "--workers=4", event_fd, NULL};
+    CTestSuite* suite;
+
+    (void)argc;
+    snprintf(event_fd, sizeof(event_fd), "--event-fd=%d", fd);
+    CTest_initialize_registry();
+    CHECK(0 == CTest_parse_args(3, args));
+    suite = TEST_SUITE("workers", NULL, NULL);
+    TEST_REENTRANT(suite, "a", reentrant);
+    TEST_REENTRANT(suite, "b", reentrant);
+    TEST_REENTRANT(suite, "c", batched);
+    TEST_REENTRANT(suite, "d", reentrant);
+    TEST(suite, "serial", serial);
+
+    CHECK(0 == check_run());
+    CHECK(5 == check_ended);
+    close(fd);
+
+    CHECK(0 == check_read_events("events.bin"));
+    CHECK(5 * ASSERTS == check_run_end.asserts);
+    CHECK(0 == check_run_end.asserts_failed);
+
+    CTest_cleanup_registry();
+    return CHECK_RESULT();
+}